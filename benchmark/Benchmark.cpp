@@ -0,0 +1,432 @@
+/*********************************************************************************************************************
+
+                                                     Benchmark.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/Benchmark.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+//! @file
+//!
+//! Measures the throughput of BufferedProxy against an in-memory buffered object.
+//!
+//! Each combination of buffer size, block size, alignment, flags, access pattern, and operation size is run once,
+//! until the given number of bytes have been transferred (or 100000 calls have been made).
+//! The throughput (GB/s), the rate of operations (ops/s), and the number of calls to the buffered object are
+//! reported, one line per combination.
+//!
+//! Then BufferedProxy is compared with FixedBufferedProxy, using the same geometry for each access pattern and
+//! operation size. FixedBufferedProxy is run with the BufferedObject interface and, unless a device is simulated,
+//! with MemoryObject itself, so that the calls to the object are not virtual.
+//!
+//! If a device is given, the in-memory object is wrapped in a SimulatedObject with that device's profile, and the
+//! simulated time is added to the measured time.
+//!
+//! The runs can be limited to one buffer size (-b), one set of flags (-f: -, no-direct, no-fills, or adaptive), and
+//! one access pattern (-p: seq-read, seq-write, strided, random, update, or phased). The pattern also limits the
+//! comparison with FixedBufferedProxy.
+//!
+//! Usage: Benchmark [-b buffer size] [-f flags] [-p pattern] [bytes per run (default 16 MiB)] [hdd | san | nvme]
+
+#include "Buffer.h"
+#include "FixedBufferedProxy.h"
+#include "MemoryObject.h"
+#include "SimulatedObject.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// Access patterns
+
+	enum Pattern
+	{
+		PATTERN_SEQUENTIAL_READ,	// Read from start to end
+		PATTERN_SEQUENTIAL_WRITE,	// Write from start to end
+		PATTERN_STRIDED_READ,		// Read one operation's worth and skip three
+		PATTERN_RANDOM_READ,		// Seek to a random location and read
+		PATTERN_MIXED_UPDATE,		// Seek to a random location, read, seek back, and write
+		PATTERN_PHASED_READ,		// Alternate between reading sequentially and reading at random locations
+		PATTERN_COUNT
+	};
+
+	char const * const	PATTERN_NAMES[ PATTERN_COUNT ]	=
+	{
+		"seq-read",
+		"seq-write",
+		"strided",
+		"random",
+		"update",
+		"phased"
+	};
+
+	int64_t const	BUFFER_SIZES[]		= { 4096, 64 * 1024, 1024 * 1024 };
+	int64_t const	BLOCK_SIZES[]		= { 1, 512, 4096 };
+	unsigned const	ALIGNMENTS[]		= { 1, 4096 };
+	unsigned const	FLAGS[]				= { 0, BufferedProxy::CF_NO_DIRECT_IO, BufferedProxy::CF_NO_FILLS, BufferedProxy::CF_ADAPTIVE };
+	int64_t const	OPERATION_SIZES[]	= { 100, 256 * 1024 };
+
+	int64_t const	OBJECT_SIZE			= 64 * 1024 * 1024;		// Size of the buffered object's data
+	int64_t const	DEFAULT_BYTES		= 16 * 1024 * 1024;		// Default number of bytes transferred by each run
+	int64_t const	MAX_OPS				= 100000;				// Limits runs of small random operations on large buffers
+	int64_t const	PHASE_LENGTH		= 1000;					// Number of operations in each phase of PATTERN_PHASED_READ
+	int64_t const	MAX_ALIGNMENT		= 4096;
+
+	// Geometry of the comparison with FixedBufferedProxy
+
+	int64_t const	FIXED_BUFFER_SIZE	= 64 * 1024;
+	int64_t const	FIXED_BLOCK_SIZE	= 4096;
+	unsigned const	FIXED_ALIGNMENT		= 4096;
+
+	typedef FixedBufferedProxy< FIXED_BLOCK_SIZE, FIXED_ALIGNMENT, FIXED_ALIGNMENT, 0 >					FixedProxy;
+	typedef FixedBufferedProxy< FIXED_BLOCK_SIZE, FIXED_ALIGNMENT, FIXED_ALIGNMENT, 0, MemoryObject >	FixedObjectProxy;
+
+	// Results of a run
+
+	struct Result
+	{
+		double	seconds;	// Elapsed time
+		int64_t	bytes;		// Number of bytes read and written
+		int64_t	ops;		// Number of calls to Read(), Write(), and Seek()
+	};
+
+	// Returns memory of the given size aligned on MAX_ALIGNMENT.
+
+	char * _Align( std::vector< char > & memory, int64_t size )
+	{
+		memory.resize( static_cast< size_t >( size + MAX_ALIGNMENT ) );
+
+		uintptr_t const	address	= reinterpret_cast< uintptr_t >( &memory[ 0 ] );
+
+		return &memory[ 0 ] + ( ( MAX_ALIGNMENT - address % MAX_ALIGNMENT ) % MAX_ALIGNMENT );
+	}
+
+	// Runs the access pattern until the given number of bytes have been transferred or MAX_OPS calls have been made.
+
+	template< typename Proxy >
+	Result _Run( Proxy & proxy, Pattern pattern, int64_t opSize, int64_t bytesPerRun )
+	{
+		std::vector< char >	memory;
+		char * const		pData	= _Align( memory, opSize );
+		std::mt19937_64		random( 12345 );
+		int64_t const		range	= OBJECT_SIZE - opSize;
+		int64_t				location	= 0;
+		Result				result	= { 0.0, 0, 0 };
+
+		std::chrono::steady_clock::time_point const	start	= std::chrono::steady_clock::now();
+
+		while ( result.bytes < bytesPerRun && result.ops < MAX_OPS )
+		{
+			int64_t	n	= 0;
+
+			switch ( pattern )
+			{
+			case PATTERN_SEQUENTIAL_READ:
+			case PATTERN_SEQUENTIAL_WRITE:
+				if ( location > range )
+				{
+					location = 0;
+					proxy.Seek( location );
+					++result.ops;
+				}
+				n = ( pattern == PATTERN_SEQUENTIAL_READ ) ? proxy.Read( pData, opSize ) : proxy.Write( pData, opSize );
+				location += n;
+				++result.ops;
+				break;
+
+			case PATTERN_STRIDED_READ:
+				location = ( location + opSize * 4 <= range ) ? location + opSize * 4 : 0;
+				proxy.Seek( location );
+				n = proxy.Read( pData, opSize );
+				result.ops += 2;
+				break;
+
+			case PATTERN_RANDOM_READ:
+				proxy.Seek( static_cast< int64_t >( random() % static_cast< uint64_t >( range ) ) );
+				n = proxy.Read( pData, opSize );
+				result.ops += 2;
+				break;
+
+			case PATTERN_PHASED_READ:
+				if ( ( result.ops / PHASE_LENGTH ) % 2 == 0 )
+				{
+					location = ( location + opSize <= range ) ? location + opSize : 0;
+				}
+				else
+				{
+					location = static_cast< int64_t >( random() % static_cast< uint64_t >( range ) );
+				}
+				proxy.Seek( location );
+				n = proxy.Read( pData, opSize );
+				result.ops += 2;
+				break;
+
+			case PATTERN_MIXED_UPDATE:
+				location = static_cast< int64_t >( random() % static_cast< uint64_t >( range ) );
+				proxy.Seek( location );
+				n = proxy.Read( pData, opSize );
+				proxy.Seek( location );
+				n += proxy.Write( pData, opSize );
+				result.ops += 4;
+				break;
+
+			default:
+				break;
+			}
+
+			if ( n <= 0 )
+			{
+				break;
+			}
+
+			result.bytes += n;
+		}
+
+		proxy.Flush();
+
+		result.seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+
+		return result;
+	}
+
+	// Returns true if the combination makes sense.
+
+	bool _IsValid( int64_t bufferSize, int64_t blockSize, unsigned alignment, unsigned flags, Pattern pattern )
+	{
+		// The buffer must hold at least one block.
+
+		if ( blockSize > bufferSize )
+		{
+			return false;
+		}
+
+		// The alignment and block size must be multiples of each other.
+
+		if ( alignment > blockSize ? alignment % blockSize != 0 : blockSize % alignment != 0 )
+		{
+			return false;
+		}
+
+		// Without fills, nothing can be read.
+
+		if ( ( flags & BufferedProxy::CF_NO_FILLS ) != 0 && pattern != PATTERN_SEQUENTIAL_WRITE )
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	// Prints a line of the comparison with FixedBufferedProxy.
+
+	void _PrintComparison( char const * pProxy, Pattern pattern, int64_t opSize, Result const & result, MemoryObject const & object )
+	{
+		printf( "%12s %10s %8lld %8.3f %12.0f %10lld %10lld %10lld\n",
+				pProxy,
+				PATTERN_NAMES[ pattern ],
+				static_cast< long long >( opSize ),
+				result.bytes / result.seconds / 1e9,
+				result.ops / result.seconds,
+				static_cast< long long >( object.ReadCount() ),
+				static_cast< long long >( object.WriteCount() ),
+				static_cast< long long >( object.SeekCount() ) );
+	}
+
+	char const * _FlagsName( unsigned flags )
+	{
+		switch ( flags )
+		{
+		case BufferedProxy::CF_NO_DIRECT_IO:	return "no-direct";
+		case BufferedProxy::CF_NO_FILLS:		return "no-fills";
+		case BufferedProxy::CF_ADAPTIVE:		return "adaptive";
+		default:								return "-";
+		}
+	}
+
+} // anonymous namespace
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int main( int argc, char ** argv )
+{
+	int64_t						onlyBufferSize	= 0;	// Only this buffer size is run (if not 0)
+	char const *				pOnlyFlags		= 0;	// Only these flags are run (if not null)
+	char const *				pOnlyPattern	= 0;	// Only this pattern is run (if not null)
+	int							arg				= 1;
+
+	while ( arg + 1 < argc && argv[ arg ][ 0 ] == '-' && argv[ arg ][ 1 ] != 0 && argv[ arg ][ 2 ] == 0 )
+	{
+		switch ( argv[ arg ][ 1 ] )
+		{
+		case 'b':	onlyBufferSize	= std::strtoll( argv[ arg + 1 ], 0, 0 );	break;
+		case 'f':	pOnlyFlags		= argv[ arg + 1 ];						break;
+		case 'p':	pOnlyPattern	= argv[ arg + 1 ];						break;
+		default:
+			fprintf( stderr, "Unknown option: %s\n", argv[ arg ] );
+			return 1;
+		}
+		arg += 2;
+	}
+
+	int64_t const				bytesPerRun	= ( argc > arg ) ? std::strtoll( argv[ arg ], 0, 0 ) : DEFAULT_BYTES;
+	char const * const			pDevice		= ( argc > arg + 1 ) ? argv[ arg + 1 ] : 0;
+	SimulatedObject::Profile	profile		= { 0, 0, 0, 0, 0, 0.0 };
+
+	if ( pDevice != 0 )
+	{
+		if ( strcmp( pDevice, "hdd" ) == 0 )
+		{
+			profile = SimulatedObject::Hdd();
+		}
+		else if ( strcmp( pDevice, "san" ) == 0 )
+		{
+			profile = SimulatedObject::San();
+		}
+		else if ( strcmp( pDevice, "nvme" ) == 0 )
+		{
+			profile = SimulatedObject::Nvme();
+		}
+		else
+		{
+			fprintf( stderr, "Unknown device: %s\n", pDevice );
+			return 1;
+		}
+	}
+
+	printf( "%8s %6s %6s %10s %10s %8s %8s %12s %10s %10s %10s\n",
+			"buffer", "block", "align", "flags", "pattern", "op", "GB/s", "ops/s", "reads", "writes", "seeks" );
+
+	for ( int64_t bufferSize : BUFFER_SIZES )
+	{
+		for ( int64_t blockSize : BLOCK_SIZES )
+		{
+			for ( unsigned alignment : ALIGNMENTS )
+			{
+				for ( unsigned flags : FLAGS )
+				{
+					for ( int pattern = 0; pattern < PATTERN_COUNT; ++pattern )
+					{
+						for ( int64_t opSize : OPERATION_SIZES )
+						{
+							if (    !_IsValid( bufferSize, blockSize, alignment, flags, Pattern( pattern ) )
+								 || ( onlyBufferSize != 0 && bufferSize != onlyBufferSize )
+								 || ( pOnlyFlags != 0 && strcmp( _FlagsName( flags ), pOnlyFlags ) != 0 )
+								 || ( pOnlyPattern != 0 && strcmp( PATTERN_NAMES[ pattern ], pOnlyPattern ) != 0 ) )
+							{
+								continue;
+							}
+
+							MemoryObject		object( blockSize, OBJECT_SIZE );
+							SimulatedObject		device( &object, profile, blockSize, false );
+							std::vector< char >	memory;
+							char * const		pBuffer	= _Align( memory, bufferSize );
+							BufferedProxy		proxy( pBuffer, bufferSize, 0,
+													   ( pDevice != 0 ) ? static_cast< BufferedProxy::BufferedObject * >( &device ) : &object,
+													   flags, blockSize, alignment, alignment );
+
+							Result	result	= _Run( proxy, Pattern( pattern ), opSize, bytesPerRun );
+
+							if ( pDevice != 0 )
+							{
+								result.seconds += device.SimulatedTime() / 1e9;
+							}
+
+							printf( "%8lld %6lld %6u %10s %10s %8lld %8.3f %12.0f %10lld %10lld %10lld\n",
+									static_cast< long long >( bufferSize ),
+									static_cast< long long >( blockSize ),
+									alignment,
+									_FlagsName( flags ),
+									PATTERN_NAMES[ pattern ],
+									static_cast< long long >( opSize ),
+									result.bytes / result.seconds / 1e9,
+									result.ops / result.seconds,
+									static_cast< long long >( object.ReadCount() ),
+									static_cast< long long >( object.WriteCount() ),
+									static_cast< long long >( object.SeekCount() ) );
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Compare BufferedProxy with FixedBufferedProxy
+
+	printf( "\n%12s %10s %8s %8s %12s %10s %10s %10s\n",
+			"proxy", "pattern", "op", "GB/s", "ops/s", "reads", "writes", "seeks" );
+
+	for ( int pattern = 0; pattern < PATTERN_COUNT; ++pattern )
+	{
+		if ( pOnlyPattern != 0 && strcmp( PATTERN_NAMES[ pattern ], pOnlyPattern ) != 0 )
+		{
+			continue;
+		}
+
+		for ( int64_t opSize : OPERATION_SIZES )
+		{
+			std::vector< char >	memory;
+			char * const		pBuffer	= _Align( memory, FIXED_BUFFER_SIZE );
+
+			{
+				MemoryObject		object( FIXED_BLOCK_SIZE, OBJECT_SIZE );
+				SimulatedObject		device( &object, profile, FIXED_BLOCK_SIZE, false );
+				BufferedProxy		proxy( pBuffer, FIXED_BUFFER_SIZE, 0,
+										   ( pDevice != 0 ) ? static_cast< BufferedProxy::BufferedObject * >( &device ) : &object,
+										   0, FIXED_BLOCK_SIZE, FIXED_ALIGNMENT, FIXED_ALIGNMENT );
+
+				Result	result	= _Run( proxy, Pattern( pattern ), opSize, bytesPerRun );
+
+				if ( pDevice != 0 )
+				{
+					result.seconds += device.SimulatedTime() / 1e9;
+				}
+
+				_PrintComparison( "dynamic", Pattern( pattern ), opSize, result, object );
+			}
+
+			{
+				MemoryObject		object( FIXED_BLOCK_SIZE, OBJECT_SIZE );
+				SimulatedObject		device( &object, profile, FIXED_BLOCK_SIZE, false );
+				FixedProxy			proxy( pBuffer, FIXED_BUFFER_SIZE, 0,
+										   ( pDevice != 0 ) ? static_cast< BufferedProxy::BufferedObject * >( &device ) : &object );
+
+				Result	result	= _Run( proxy, Pattern( pattern ), opSize, bytesPerRun );
+
+				if ( pDevice != 0 )
+				{
+					result.seconds += device.SimulatedTime() / 1e9;
+				}
+
+				_PrintComparison( "fixed", Pattern( pattern ), opSize, result, object );
+			}
+
+			// The simulated device wraps the object, so the object's own type can't be used with it.
+
+			if ( pDevice == 0 )
+			{
+				MemoryObject		object( FIXED_BLOCK_SIZE, OBJECT_SIZE );
+				FixedObjectProxy	proxy( pBuffer, FIXED_BUFFER_SIZE, 0, &object );
+
+				Result	result	= _Run( proxy, Pattern( pattern ), opSize, bytesPerRun );
+
+				_PrintComparison( "fixed-object", Pattern( pattern ), opSize, result, object );
+			}
+		}
+	}
+
+	return 0;
+}
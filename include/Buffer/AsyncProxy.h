@@ -0,0 +1,394 @@
+#if !defined( ASYNCPROXY_H_INCLUDED )
+#define ASYNCPROXY_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                     AsyncProxy.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/AsyncProxy.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#if __cplusplus < 202002L
+#error "AsyncProxy.h requires C++20 coroutines (configure with BUFFER_COROUTINES)."
+#endif // __cplusplus < 202002L
+
+#include "Buffer.h"
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template< typename T > class AsyncTask;
+
+//! A simple executor that runs jobs and resumes coroutines on the thread that calls Run().
+//
+//! Jobs can be posted from any thread. I/O completions are posted to the executor, so the coroutines using an
+//! AsyncProxy are always resumed by the executor's thread, and many proxies can share one thread.
+
+class AsyncExecutor
+{
+public:
+
+	//! Constructor
+	AsyncExecutor();
+	~AsyncExecutor();
+
+	//! Queues a job to be run by Run() or Poll(). This function may be called from any thread.
+	void Post( std::function< void() > job );
+
+	//! Starts a task on the executor. The task is owned by the executor until it completes.
+	void Spawn( AsyncTask< void > task );
+
+	//! Runs jobs until all spawned tasks have completed or Stop() is called.
+	void Run();
+
+	//! Runs the jobs that are ready without waiting. Returns the number of jobs run.
+	int Poll();
+
+	//! Makes Run() return as soon as possible. This function may be called from any thread.
+	void Stop();
+
+private:
+
+	struct Detached;
+
+	// Prevent copying
+	AsyncExecutor( AsyncExecutor const & );
+	AsyncExecutor & operator =( AsyncExecutor const & );
+
+	// Runs a spawned task and notes when it has completed.
+	static Detached Drive( AsyncExecutor * pExecutor, AsyncTask< void > task );
+
+	std::deque< std::function< void() > >	m_Jobs;		// Queued jobs
+	std::mutex								m_Mutex;	// Guards the queue and the counts
+	std::condition_variable					m_Wake;		// Signaled when a job is queued or the work is done
+	int										m_Work;		// Number of spawned tasks that have not completed
+	bool									m_Stop;		// True if Run() should return
+};
+
+//! The result of an asynchronous operation, or a coroutine returning a value of type @a T.
+//
+//! A task is started when it is awaited, and the awaiting coroutine is resumed when it completes. A task that was
+//! created with its result already known completes without suspending the awaiting coroutine.
+//!
+//! @note	An exception escaping the coroutine terminates the program.
+
+template< typename T >
+class AsyncTask
+{
+public:
+
+	struct promise_type;
+	typedef std::coroutine_handle< promise_type >	Handle;
+
+	//! Resumes the awaiting coroutine when the task's coroutine completes
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept											{ return false; }
+		std::coroutine_handle<> await_suspend( Handle h ) noexcept					{ return h.promise().continuation ? h.promise().continuation : std::noop_coroutine(); }
+		void await_resume() const noexcept											{}
+	};
+
+	//! Coroutine state (required by the compiler)
+	struct promise_type
+	{
+		AsyncTask			get_return_object()										{ return AsyncTask( Handle::from_promise( *this ) ); }
+		std::suspend_always	initial_suspend() const noexcept						{ return std::suspend_always(); }
+		FinalAwaiter		final_suspend() const noexcept							{ return FinalAwaiter(); }
+		void				return_value( T v )										{ value = std::move( v ); }
+		void				unhandled_exception()									{ std::terminate(); }
+
+		T						value;			//!< The result
+		std::coroutine_handle<>	continuation;	//!< The awaiting coroutine
+	};
+
+	//! Constructor for a task whose result is already known
+	explicit AsyncTask( T value )
+		: m_Handle( nullptr ),
+		  m_Value( std::move( value ) )
+	{
+	}
+
+	AsyncTask( AsyncTask && other ) noexcept
+		: m_Handle( std::exchange( other.m_Handle, nullptr ) ),
+		  m_Value( std::move( other.m_Value ) )
+	{
+	}
+
+	~AsyncTask()
+	{
+		if ( m_Handle )
+		{
+			m_Handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept												{ return !m_Handle; }
+
+	std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept
+	{
+		m_Handle.promise().continuation = awaiting;
+		return m_Handle;
+	}
+
+	T await_resume()																{ return m_Handle ? std::move( m_Handle.promise().value ) : std::move( m_Value ); }
+
+private:
+
+	explicit AsyncTask( Handle h )
+		: m_Handle( h ),
+		  m_Value()
+	{
+	}
+
+	// Prevent copying
+	AsyncTask( AsyncTask const & );
+	AsyncTask & operator =( AsyncTask const & );
+
+	Handle	m_Handle;	// The coroutine, or null if the result is already known
+	T		m_Value;	// The result, if it was already known
+};
+
+//! A coroutine that returns nothing (see AsyncTask).
+
+template<>
+class AsyncTask< void >
+{
+public:
+
+	struct promise_type;
+	typedef std::coroutine_handle< promise_type >	Handle;
+
+	//! Resumes the awaiting coroutine when the task's coroutine completes
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept											{ return false; }
+		std::coroutine_handle<> await_suspend( Handle h ) noexcept					{ return h.promise().continuation ? h.promise().continuation : std::noop_coroutine(); }
+		void await_resume() const noexcept											{}
+	};
+
+	//! Coroutine state (required by the compiler)
+	struct promise_type
+	{
+		AsyncTask			get_return_object()										{ return AsyncTask( Handle::from_promise( *this ) ); }
+		std::suspend_always	initial_suspend() const noexcept						{ return std::suspend_always(); }
+		FinalAwaiter		final_suspend() const noexcept							{ return FinalAwaiter(); }
+		void				return_void()											{}
+		void				unhandled_exception()									{ std::terminate(); }
+
+		std::coroutine_handle<>	continuation;	//!< The awaiting coroutine
+	};
+
+	AsyncTask( AsyncTask && other ) noexcept
+		: m_Handle( std::exchange( other.m_Handle, nullptr ) )
+	{
+	}
+
+	~AsyncTask()
+	{
+		if ( m_Handle )
+		{
+			m_Handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept												{ return false; }
+
+	std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept
+	{
+		m_Handle.promise().continuation = awaiting;
+		return m_Handle;
+	}
+
+	void await_resume() const noexcept												{}
+
+private:
+
+	explicit AsyncTask( Handle h )
+		: m_Handle( h )
+	{
+	}
+
+	// Prevent copying
+	AsyncTask( AsyncTask const & );
+	AsyncTask & operator =( AsyncTask const & );
+
+	Handle	m_Handle;	// The coroutine
+};
+
+//! A stream buffer like BufferedProxy whose operations are awaited instead of blocking.
+//
+//! Reads and writes that can be done entirely in the buffer complete immediately, without suspending the awaiting
+//! coroutine. Otherwise, the buffer is flushed and filled through an AsyncObject, and the awaiting coroutine is
+//! resumed by the executor once the data has been transferred. The executor's thread is never blocked waiting for
+//! I/O, so one thread can serve many proxies.
+//!
+//! The buffered object's requirements are the same as a BufferedProxy's: it is asked to read or write whole blocks
+//! at locations aligned on the sector alignment, to or from memory aligned on the buffer alignment.
+//!
+//! @note	Only one operation on a proxy can be in progress at a time (i.e. an operation must complete before the
+//!			next one is started).
+//! @note	Unwritten data is not flushed by the destructor. FlushAsync() must be awaited first.
+//! @note	The data is always transferred through the buffer. There is no direct I/O, read-ahead, or write-behind.
+
+class AsyncProxy
+{
+public:
+
+	//! Asynchronous buffered object
+	//
+	//! Derive from this class to implement the functions required by an AsyncProxy. The functions start a transfer
+	//! and return. When the transfer completes, the callback is called with the number of blocks transferred (which
+	//! can be less than requested), or < 0 if there was an error. The callback may be called from any thread, and
+	//! even before the function returns.
+
+	class AsyncObject
+	{
+	public:
+
+		//! Function called when a transfer completes, with the number of blocks transferred or < 0
+		typedef std::function< void( int64_t ) >	Callback;
+
+		virtual ~AsyncObject()
+		{
+		}
+
+		//! Starts reading @a n blocks at @a location from @a handle to @a pBuffer.
+		virtual void ReadAsync( unsigned handle, char * pBuffer, int64_t n, int64_t location, Callback done )			= 0;
+
+		//! Starts writing @a n blocks from @a pBuffer to @a handle at @a location.
+		virtual void WriteAsync( unsigned handle, char const * pBuffer, int64_t n, int64_t location, Callback done )	= 0;
+	};
+
+	//! An AsyncObject that does the blocking I/O of a BufferedProxy::BufferedObject on background threads.
+	//
+	//! This allows the existing buffered objects (e.g. DirectFile or MemoryObject) to be used with an AsyncProxy.
+	//! The transfers are done with ReadAt() and WriteAt(). If the buffered object is not positional, they are done
+	//! one at a time.
+
+	class BlockingObjectAdapter final : public AsyncObject
+	{
+	public:
+
+		//! Constructor
+		BlockingObjectAdapter( BufferedProxy::BufferedObject * pObject, int threads = 1 );
+		virtual ~BlockingObjectAdapter();
+
+		// AsyncObject overrides
+
+		virtual void ReadAsync( unsigned handle, char * pBuffer, int64_t n, int64_t location, Callback done );
+		virtual void WriteAsync( unsigned handle, char const * pBuffer, int64_t n, int64_t location, Callback done );
+
+	private:
+
+		// Prevent copying
+		BlockingObjectAdapter( BlockingObjectAdapter const & );
+		BlockingObjectAdapter & operator =( BlockingObjectAdapter const & );
+
+		// Queues a job for the background threads.
+		void Post( std::function< void() > job );
+
+		// Executes jobs until the adapter is destroyed.
+		void Run();
+
+		BufferedProxy::BufferedObject *			m_pObject;		// The buffered object
+		std::deque< std::function< void() > >	m_Jobs;			// Queued jobs
+		std::mutex								m_Mutex;		// Guards the queue
+		std::mutex								m_ObjectMutex;	// Serializes the calls to a buffered object that is not positional
+		std::condition_variable					m_Wake;			// Signaled when a job is queued or the threads should quit
+		bool									m_Quit;			// True if the threads should exit once the queue is empty
+		std::vector< std::thread >				m_Threads;		// Background threads
+	};
+
+	//! Constructor
+	AsyncProxy( void * pBuffer,
+				int64_t bufferSize,
+				unsigned handle,
+				AsyncObject * pObject,
+				AsyncExecutor * pExecutor,
+				int64_t blockSize		= 1,
+				unsigned sectorAlign	= 1,
+				unsigned bufferAlign	= 1 );
+	~AsyncProxy();
+
+	//! Returns the number of bytes that can be written before the buffer will have to be flushed.
+	int64_t RemainingWriteSpace() const		{ return m_BufferSize - m_Point; }
+
+	//! Returns the number of bytes that can be read before the buffer will have to be filled.
+	int64_t RemainingReadAmount() const		{ return m_IsFilled ? m_DataSize * m_BlockSize - m_Point : 0; }
+
+	//! Reads @a n bytes from the buffered object through the buffer. The result is the number of bytes read.
+	AsyncTask< int64_t > ReadAsync( void * pDst, int64_t n );
+
+	//! Writes @a n bytes to the buffered object through the buffer. The result is the number of bytes written.
+	AsyncTask< int64_t > WriteAsync( void const * pSrc, int64_t n );
+
+	//! Moves the current location in the buffered object. The result is the actual location, or < 0 if there is an error.
+	AsyncTask< int64_t > SeekAsync( int64_t location );
+
+	//! Writes any unwritten data to the buffered object. The result is false if it could not all be written.
+	AsyncTask< bool > FlushAsync();
+
+private:
+
+	struct Transfer;
+
+	// Prevent copying
+	AsyncProxy( AsyncProxy const & );
+	AsyncProxy & operator =( AsyncProxy const & );
+
+	// Reads through the buffer, filling it as needed.
+	AsyncTask< int64_t > ReadThroughBuffer( char * pDst, int64_t n );
+
+	// Writes through the buffer, filling and flushing it as needed.
+	AsyncTask< int64_t > WriteThroughBuffer( char const * pSrc, int64_t n );
+
+	// Flushes the buffer and moves it to the given location (in bytes). Returns the location, or < 0 if the flush failed.
+	AsyncTask< int64_t > MoveTo( int64_t location );
+
+	// Writes the unwritten data in the buffer to the buffered object. Returns false if it could not all be written.
+	AsyncTask< bool > FlushBuffer();
+
+	// Fills the buffer from the buffered object.
+	AsyncTask< void > Fill();
+
+	// Reads or writes blocks at the given location. Returns the number of blocks transferred or < 0.
+	AsyncTask< int64_t > TransferBlocks( int64_t location, char * pBuffer, int64_t n, bool isWrite );
+
+	// Copies data into the buffer at the current location and moves the current location past it.
+	void CopyIn( char const * pSrc, int64_t n );
+
+	unsigned			m_Handle;				// Handle passed to the buffered object
+	char *				m_paBuffer;				// The buffer
+	int64_t				m_BufferSize;			// Size of the buffer (in bytes)
+	int64_t				m_BufferSizeInBlocks;	// Size of the buffer (in blocks)
+	AsyncObject *		m_pObject;				// The buffered object
+	AsyncExecutor *		m_pExecutor;			// Resumes the coroutines when transfers complete
+	int64_t				m_BlockSize;			// Size of a block
+	int64_t				m_FlushGranule;			// Locations in the buffer are aligned on this many blocks
+	int64_t				m_Point;				// Current location relative to the start of the buffer (in bytes)
+	int64_t				m_BufferLoc;			// Location of the buffer in the buffered object (in blocks)
+	int64_t				m_DataSize;				// Amount of data in the buffer (in blocks)
+	bool				m_IsFilled;				// True if the buffer has been filled at its location
+	bool				m_IsDirty;				// True if the buffer contains unwritten data
+	int64_t				m_DirtyBegin;			// Start of the unwritten data (in bytes), if dirty
+	int64_t				m_DirtyEnd;				// End of the unwritten data (in bytes), if dirty
+};
+
+
+#endif // !defined( ASYNCPROXY_H_INCLUDED )
@@ -16,6 +16,12 @@
 
 *********************************************************************************************************************/
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+class BufferPool;
+
 //! A stream buffer that enables non-aligned and non-blocksize I/O to/from an object that requires aligned and/or
 //! block I/O or requires I/O to/from a specific memory location.
 
@@ -27,7 +33,9 @@ public:
 	enum
 	{
 		//! The buffer normally assumes that both reading and writing will be performed. Performance can be
-		//! improved when I/O is one or the other, but not both.
+		//! improved when I/O is one or the other, but not both. With CF_READ_ONLY, writes fail and nothing is
+		//! ever flushed. With CF_WRITE_ONLY, reads fail and the buffer is never filled (as with CF_NO_FILLS), so
+		//! the unwritten part of a partially written block is undefined.
 
 		CF_READ_ONLY		= 0x00000001,	//!< Allow only reads
 		CF_WRITE_ONLY		= 0x00000002,	//!< Allow only writes
@@ -49,9 +57,17 @@ public:
 		//! The buffer normally assumes that most I/O is sequential or reads are larger than the size of a buffer.
 		//! If that is not the case, the buffer may perform many unnecessary fills. This flag improves performance
 		//! when the I/O is mostly random and the size of the reads are usually smaller than the size of the
-		//! buffer.
+		//! buffer. The buffer is divided into pages that are cached, so locations that are revisited are not
+		//! filled again (see SetPageSize()).
 
 		CF_RANDOM_ACCESS	= 0x00000010,	//!< Assume mostly random access
+
+		//! Instead of assuming one kind of access, the buffer can watch the locations of the reads and adapt as the
+		//! access changes. Sequential reads fill the whole buffer and read ahead (see SetReadAhead()), reads that
+		//! are a fixed distance apart read ahead at that distance, and random reads fill only the blocks that they
+		//! need. This flag cannot be combined with CF_RANDOM_ACCESS.
+
+		CF_ADAPTIVE			= 0x00000020,	//!< Detect the access pattern and adapt to it
 	};
 
 	//! Buffered object
@@ -77,7 +93,7 @@ public:
 		//! @note	@a n is always a multiple of the block size.
 		//! @note	@a pBuffer is always aligned to the buffer alignment.
 
-		virtual int	Read( unsigned handle, char * pBuffer, int n )			= 0;
+		virtual int64_t	Read( unsigned handle, char * pBuffer, int64_t n )			= 0;
 
 		//! Writes @a n bytes of data from the buffer starting at @a pBuffer to @a handle. Returns the number of blocks written.
 		//
@@ -91,7 +107,7 @@ public:
 		//!			was copied from the buffer.
 		//! @note	@a pBuffer is always aligned to the buffer alignment.
 
-		virtual int	Write( unsigned handle, char const * pBuffer, int n )	= 0;
+		virtual int64_t	Write( unsigned handle, char const * pBuffer, int64_t n )	= 0;
 
 		//! Sets @a handle's "current location" to the given location. Returns the resulting location.
 		//
@@ -102,65 +118,672 @@ public:
 		//!
 		//! @note	The data in the buffered object is assumed to start at 0.
 		
-		virtual int	Seek( unsigned handle, int location )					= 0;
+		virtual int64_t	Seek( unsigned handle, int64_t location )				= 0;
+
+		//! Returns true if the buffered object implements ReadAt() and WriteAt().
+		//
+		//! If it does, the Buffer uses them instead of Seek(), Read(), and Write(), and the buffered object may be
+		//! accessed concurrently by the Buffer's background threads.
+
+		virtual bool IsPositional() const
+		{
+			return false;
+		}
+
+		//! Reads @a n blocks of data at @a location from @a handle to the buffer starting at @a pBuffer. Returns the number of blocks read.
+		//
+		//! @param	handle		Handle provided to the Buffer.
+		//! @param	pBuffer		Location to put the data.
+		//! @param	n			Number of blocks to read.
+		//! @param	location	Location of the data (which block).
+		//!
+		//! @return		Number of blocks actually read, or < 0 if there was an error.
+		//!
+		//! @note	@a handle's "current location" is not used and does not change.
+		//! @note	This function may be called concurrently from several threads.
+		//! @note	The default implementation uses Seek() and Read().
+
+		virtual int64_t	ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location )
+		{
+			if ( Seek( handle, location ) != location )
+			{
+				return -1;
+			}
+
+			return Read( handle, pBuffer, n );
+		}
+
+		//! Writes @a n blocks of data from the buffer starting at @a pBuffer to @a handle at @a location. Returns the number of blocks written.
+		//
+		//! @param	handle		Handle provided to the Buffer.
+		//! @param	pBuffer		Location of the data.
+		//! @param	n			Number of blocks to write.
+		//! @param	location	Where to put the data (which block).
+		//!
+		//! @return		Number of blocks actually written, or < 0 if there was an error.
+		//!
+		//! @note	@a handle's "current location" is not used and does not change.
+		//! @note	This function may be called concurrently from several threads.
+		//! @note	The default implementation uses Seek() and Write().
+
+		virtual int64_t	WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location )
+		{
+			if ( Seek( handle, location ) != location )
+			{
+				return -1;
+			}
+
+			return Write( handle, pBuffer, n );
+		}
+	};
+
+	//! Performance statistics (see GetStats())
+	//
+	//! @note	If BUFFER_NO_STATS is defined when the library is compiled, statistics are not collected and all values
+	//!			are 0.
+
+	struct Stats
+	{
+		//! Buffered object functions whose latencies are measured
+		enum Callback
+		{
+			CALLBACK_READ,						//!< Read() and ReadAt()
+			CALLBACK_WRITE,						//!< Write() and WriteAt()
+			CALLBACK_SEEK,						//!< Seek()
+			CALLBACK_COUNT
+		};
+
+		//! Number of buckets in a latency histogram
+		enum
+		{
+			LATENCY_BUCKETS	= 32
+		};
+
+		int64_t	fills;							//!< Number of times the buffer was filled
+		int64_t	readAheadHits;					//!< Number of fills that used data that had been read ahead
+		int64_t	flushes;						//!< Number of times a buffer was written to the buffered object
+		int64_t	seeks;							//!< Number of calls to Seek()
+		int64_t	seekHits;						//!< Number of calls to Seek() with a location already in the buffer
+		int64_t	directBytesRead;				//!< Bytes read directly from the buffered object, bypassing the buffer
+		int64_t	directBytesWritten;				//!< Bytes written directly to the buffered object, bypassing the buffer
+		int64_t	copiedBytesRead;				//!< Bytes copied out of the buffer (except by the inline typed reads)
+		int64_t	copiedBytesWritten;				//!< Bytes copied into the buffer (except by the inline typed writes)
+		int64_t	rejectedReads;					//!< Number of reads that failed because of CF_WRITE_ONLY
+		int64_t	rejectedWrites;					//!< Number of writes that failed because of CF_READ_ONLY
+		int64_t	patternChanges;					//!< Number of times the detected access pattern changed (CF_ADAPTIVE)
+		int64_t	parallelTransfers;				//!< Number of direct transfers split among worker threads
+
+		//! Latency histogram of each function. Bucket i counts the calls taking less than 2^(i+1) ns (and at least
+		//! 2^i ns if i > 0). The last bucket also counts longer calls.
+		int64_t	latency[ CALLBACK_COUNT ][ LATENCY_BUCKETS ];
 	};
 
 	//! Constructor
 	BufferedProxy( void * pBuffer,				
-		   int bufferSize,				
+		   int64_t bufferSize,				
 		   unsigned handle,				
 		   BufferedObject * pBufferedObject,
 		   unsigned flags,				
-		   int blockSize		= 1,	
+		   int64_t blockSize		= 1,	
 		   unsigned sectorAlign	= 1,	
 		   unsigned bufferAlign	= 1		
 										
 		 );
+
+	//! Constructor (the buffer is allocated from a pool)
+	BufferedProxy( int64_t bufferSize,
+		   unsigned handle,
+		   BufferedObject * pBufferedObject,
+		   unsigned flags,
+		   int64_t blockSize		= 1,
+		   unsigned sectorAlign	= 1,
+		   unsigned bufferAlign	= 1,
+		   BufferPool * pPool		= 0
+		 );
+
+	//! Move constructor
+	BufferedProxy( BufferedProxy && other );
+
 	virtual ~BufferedProxy();
 
+	//! Move assignment operator
+	BufferedProxy & operator =( BufferedProxy && other );
+
 	//! Returns the number of bytes that can be written before the buffer will have to be flushed.
-	int RemainingWriteSpace() const;
+	int64_t RemainingWriteSpace() const		{ return m_BufferSizeInBlocks * m_BlockSize - m_Point; }
 
 	//! Returns the number of bytes that can be read before the buffer will have to be filled.
-	int RemainingReadAmount() const;
+	int64_t RemainingReadAmount() const		{ return m_DataSize * m_BlockSize - m_Point; }
 
 	//! Reads @a n bytes from the buffered object through the buffer. Returns the number of bytes read, or < 0 if there is an error.
-	int Read( void * pDst, int n );
+	int64_t Read( void * pDst, int64_t n );
 
 	//! Writes @a n bytes to the buffered object through the buffer. Returns the number of bytes written, or < 0 if there is an error.
-	int Write( void const * pSrc, int n );
+	int64_t Write( void const * pSrc, int64_t n );
+
+	//! Reads a value of type @a T. Returns true if the whole value was read.
+	template< typename T >
+	bool Read( T * pValue );
+
+	//! Writes a value of type @a T. Returns true if the whole value was written.
+	template< typename T >
+	bool Write( T const & value );
+
+	//! Reads an integer stored in little-endian byte order. Returns true if the whole value was read.
+	template< typename T >
+	bool ReadLittleEndian( T * pValue );
+
+	//! Reads an integer stored in big-endian byte order. Returns true if the whole value was read.
+	template< typename T >
+	bool ReadBigEndian( T * pValue );
+
+	//! Writes an integer in little-endian byte order. Returns true if the whole value was written.
+	template< typename T >
+	bool WriteLittleEndian( T value );
+
+	//! Writes an integer in big-endian byte order. Returns true if the whole value was written.
+	template< typename T >
+	bool WriteBigEndian( T value );
+
+	//! Reads an unsigned integer stored as a LEB128 varint. Returns true if the whole value was read.
+	bool ReadVarint( uint64_t * pValue );
+
+	//! Writes an unsigned integer as a LEB128 varint. Returns true if the whole value was written.
+	bool WriteVarint( uint64_t value );
+
+	//! Returns the address of the data at the current location in the buffer. Returns the number of bytes available there, or < 0 if there is an error.
+	int64_t Peek( void const ** ppData );
+
+	//! Moves the current location past @a n bytes of the data returned by Peek().
+	void Consume( int64_t n );
+
+	//! Returns the address of the space at the current location in the buffer. Returns the number of bytes available there, or < 0 if there is an error.
+	int64_t Reserve( void ** ppSpace );
+
+	//! Moves the current location past @a n bytes written to the space returned by Reserve().
+	void Commit( int64_t n );
 
 	//! Moves the current location in the buffered object. Returns the actual location, or < 0 if there is an error.
-	int Seek( int location );
+	int64_t Seek( int64_t location );
 
-	//! Forces the buffer to flush any unwritten data to the buffered object.
-	void Flush();
+	//! Forces the buffer to flush any unwritten data to the buffered object. Returns false if any of it could not be written.
+	bool Flush();
 
-	//! Forces the buffer to refresh itself from the buffered object.
+	//! Forces the buffer to refresh itself from the buffered object. The current location moves to the start of the buffer.
 	void Fill();
 
+	//! Enables (or disables) asynchronous read-ahead.
+	void SetReadAhead( void * pBuffers, int depth );
+
+	//! Enables (or disables) asynchronous write-behind.
+	void SetWriteBehind( void * pBuffers, int depth );
+
+	//! Sets the size of the cached pages (CF_RANDOM_ACCESS only).
+	void SetPageSize( int64_t pageSize );
+
+	//! Enables (or disables) splitting large direct transfers among worker threads.
+	void SetParallelTransfers( int threads, int64_t chunkSize );
+
+	//! Returns the performance statistics collected since the proxy was created or ResetStats() was called.
+	void GetStats( Stats * pStats ) const;
+
+	//! Resets the performance statistics to 0.
+	void ResetStats();
+
 private:
 
+	struct Async;
+	struct Cache;
+	struct Pattern;
+	struct Parallel;
+	struct Counters;
+
+	// Prevent copying
+	BufferedProxy( BufferedProxy const & );
+	BufferedProxy & operator =( BufferedProxy const & );
+
+	// Validates the parameters and initializes the proxy. Throws ConstructorFailedException if they are invalid.
+	void Initialize( void * pBuffer, int64_t bufferSize, unsigned handle, BufferedObject * pBufferedObject,
+					 unsigned flags, int64_t blockSize, unsigned sectorAlign, unsigned bufferAlign );
+
+	// Flushes the buffer, stops the background I/O, and releases everything the proxy owns.
+	void Destroy();
+
+	// Takes over the state of another proxy, leaving it empty.
+	void MoveFrom( BufferedProxy & other );
+
+	// Flushes the buffer because its contents are about to be replaced. The buffer's contents are undefined afterwards.
+	void Retire();
+
+	// Moves the buffer to the data following the data in the buffer, flushing it first. The buffer is not filled.
+	void Advance();
+
+	// Moves the buffer to the given location (in blocks), flushing it first. The buffer is not filled.
+	void MoveTo( int64_t location );
+
+	// Reads the blocks that will be partially overwritten by writing up to the given offset in the buffer.
+	void FillEdges( int64_t end );
+
+	// Reads the whole buffer from the buffered object (or swaps in the data read ahead).
+	void FillBuffer();
+
+	// Reads blocks of the buffered object into the same blocks of the buffer. Returns the number of blocks read.
+	int64_t FillBlocks( int64_t first, int64_t n );
+
+	// Fills the empty buffer for a read ending at the given offset in the buffer, as the access pattern suggests.
+	void Load( int64_t end );
+
+	// Updates the access pattern with a read of @a n bytes at the given location (in bytes).
+	void DetectPattern( int64_t location, int64_t n );
+
+	// Saves the state of the current page in the cache.
+	void SavePage();
+
+	// Removes a page from the cache (flushing it if necessary) and returns its index.
+	int EvictPage();
+
+	// Flushes a cached page. Returns false if its data could not be written.
+	bool FlushPage( int index );
+
+	// Flushes (and optionally discards) the cached pages overlapping the given blocks.
+	void SyncPages( int64_t location, int64_t n, bool discard );
+
+	// Hands the buffer to the background thread to be written and replaces it with a spare buffer.
+	void WriteBehind();
+
+	// Waits for the pending background writes overlapping the given blocks (all of them if n < 0). Returns false if a
+	// background write has failed since the last Flush().
+	bool WaitForWriteBehind( int64_t location, int64_t n );
+
+	// Reads blocks from the buffered object at the given location. Returns the number of blocks read or < 0.
+	int64_t ReadBlocks( int64_t location, char * pBuffer, int64_t n );
+
+	// Writes blocks to the buffered object at the given location. Returns the number of blocks written or < 0.
+	int64_t WriteBlocks( int64_t location, char const * pBuffer, int64_t n );
+
+	// Reads blocks directly into the user's buffer, splitting a large read among the worker threads.
+	int64_t ReadDirect( int64_t location, char * pBuffer, int64_t n );
+
+	// Writes blocks directly from the user's buffer, splitting a large write among the worker threads.
+	int64_t WriteDirect( int64_t location, char const * pBuffer, int64_t n );
+
+	// If the buffer at the current location has been read ahead, swap it in. Returns true if it was.
+	bool TakeReadAhead();
+
+	// Starts reading the buffers following the current buffer.
+	void ScheduleReadAhead();
+
+	// Discards any read-ahead buffers overlapping the given blocks (all of them if n < 0).
+	void DiscardReadAhead( int64_t location, int64_t n );
+
 	// Copy data from the source into the buffer and update the pointers.
-	void CopyIn( void const ** ppSrc, int n );
+	void CopyIn( void const ** ppSrc, int64_t n );
 
 	// Copy data from the buffer to the destination and update the pointers.
-	void CopyOut( void ** ppDst, int n );
+	void CopyOut( void ** ppDst, int64_t n );
+
+	// Returns true if @a n bytes can be written at the current location without a fill or a flush.
+	bool CanWriteInPlace( int64_t n ) const;
+
+	// Marks @a n bytes written in place at the current location and moves the current location past them.
+	void CommitInPlace( int64_t n );
+
+	// Adds the given bytes of the buffer to the range of data that has not been flushed yet.
+	void MarkDirty( int64_t begin, int64_t end );
+
+	// Returns the blocks of the buffer that must be written to flush the given range of bytes.
+	void GetFlushRange( int64_t dirtyBegin, int64_t dirtyEnd, int64_t dataSize, int64_t * pFirst, int64_t * pCount ) const;
+
+	// Returns the number of bytes to transfer through the buffer so that the rest of a direct transfer is aligned.
+	int64_t GetBounceSize( void const * p, int64_t n ) const;
 
 	unsigned			m_Handle;				// Handle to pass to callback functions
 	char *				m_paBuffer;				// Address of the buffer's buffer
-	int					m_BufferSize;			// Size of the buffer (in bytes)
-	int					m_BufferSizeInBlocks;	// Size of the buffer (in blocks)
+	int64_t				m_BufferSize;			// Size of the buffer (in bytes), or of a page if the pages are cached
+	int64_t				m_BufferSizeInBlocks;	// Size of the buffer (in blocks)
 	BufferedObject *	m_pBufferedObject;		// The interface to the buffered object
-	int					m_BlockSize;			// All fills and flushes are a multiple of this size
+	bool				m_IsPositional;			// True if the buffered object implements ReadAt() and WriteAt()
+	int64_t				m_BlockSize;			// All fills and flushes are a multiple of this size
 	unsigned			m_SectorAlign;			// Fills and flushes start on this boundary on the buffered object
 	unsigned			m_BufferAlign;			// Fills and flushes start on this boundary in memory
 	unsigned			m_Flags;				// Flags
-	int					m_Point;				// Index of the I/O point in the buffer (in bytes)
-	int					m_BufferLoc;			// Location of the buffer in the buffered object's space (in blocks)
-	int					m_DataSize;				// Size of data in the buffer in bytes (sometimes the buffer is not full)
+	int64_t				m_Point;				// Index of the I/O point in the buffer (in bytes)
+	int64_t				m_BufferLoc;			// Location of the buffer in the buffered object's space (in blocks)
+	int64_t				m_DataSize;				// Size of data in the buffer in bytes (sometimes the buffer is not full)
 	bool				m_IsDirty;				// True if the buffer contains data that has not been flushed yet
+	int64_t				m_DirtyBegin;			// Start of the data that has not been flushed yet (in bytes), if dirty
+	int64_t				m_DirtyEnd;				// End of the data that has not been flushed yet (in bytes), if dirty
+	int64_t				m_FlushGranule;			// Flushes start on a multiple of this many blocks in the buffer
+	bool				m_IsPartial;			// True if data following the data in the buffer might not have been read
+	Async *				m_pAsync;				// Read-ahead and write-behind state, or 0 if neither is enabled
+	Cache *				m_pCache;				// Page cache, or 0 if the pages are not cached
+	Pattern *			m_pPattern;				// Access pattern detection, or 0 if it is not enabled
+	Parallel *			m_pParallel;			// Worker threads for large direct transfers, or 0 if not enabled
+	Counters *			m_pCounters;			// Performance statistics, or 0 if they are not collected
+	BufferPool *		m_pPool;				// Pool from which the buffer was allocated, or 0 if it was supplied
+	void *				m_pOwnedBuffer;			// Buffer allocated from the pool (it may have been exchanged since)
+	int64_t				m_OwnedSize;			// Size of the buffer allocated from the pool
 };
 
 
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the value is entirely in the buffer, it is copied directly. Otherwise, Read( void *, int64_t ) is used.
+//!
+//! @param	pValue	Where to store the value. @a T must be trivially copyable.
+//!
+//! @note	Reads done entirely in the buffer are not counted in the statistics.
+
+template< typename T >
+inline bool BufferedProxy::Read( T * pValue )
+{
+	static_assert( std::is_trivially_copyable< T >::value, "The type must be trivially copyable." );
+
+	if ( ( m_Flags & CF_WRITE_ONLY ) == 0 && static_cast< int64_t >( sizeof( T ) ) <= RemainingReadAmount() )
+	{
+		memcpy( pValue, &m_paBuffer[ m_Point ], sizeof( T ) );
+		m_Point += sizeof( T );
+		return true;
+	}
+
+	return Read( static_cast< void * >( pValue ), sizeof( T ) ) == static_cast< int64_t >( sizeof( T ) );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If there is room for the value in the buffer (and it does not need to be filled first), the value is copied
+//! directly. Otherwise, Write( void const *, int64_t ) is used.
+//!
+//! @param	value	Value to write. @a T must be trivially copyable.
+//!
+//! @note	Writes done entirely in the buffer are not counted in the statistics, and a failure of an earlier
+//!			write-behind is not reported until the next write that is not.
+
+template< typename T >
+inline bool BufferedProxy::Write( T const & value )
+{
+	static_assert( std::is_trivially_copyable< T >::value, "The type must be trivially copyable." );
+
+	if ( CanWriteInPlace( sizeof( T ) ) )
+	{
+		memcpy( &m_paBuffer[ m_Point ], &value, sizeof( T ) );
+		CommitInPlace( sizeof( T ) );
+		return true;
+	}
+
+	return Write( static_cast< void const * >( &value ), sizeof( T ) ) == static_cast< int64_t >( sizeof( T ) );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The bytes are assembled with shifts, which compilers reduce to a load (and a byte swap on big-endian hosts).
+
+template< typename T >
+inline bool BufferedProxy::ReadLittleEndian( T * pValue )
+{
+	static_assert( std::is_integral< T >::value, "The type must be an integer." );
+
+	typedef typename std::make_unsigned< T >::type	Unsigned;
+
+	unsigned char	bytes[ sizeof( T ) ];
+
+	if ( !Read( &bytes ) )
+	{
+		return false;
+	}
+
+	Unsigned	value	= 0;
+
+	for ( size_t i = 0; i < sizeof( T ); ++i )
+	{
+		value |= static_cast< Unsigned >( static_cast< Unsigned >( bytes[ i ] ) << ( 8 * i ) );
+	}
+
+	*pValue = static_cast< T >( value );
+
+	return true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The bytes are assembled with shifts, which compilers reduce to a load (and a byte swap on little-endian hosts).
+
+template< typename T >
+inline bool BufferedProxy::ReadBigEndian( T * pValue )
+{
+	static_assert( std::is_integral< T >::value, "The type must be an integer." );
+
+	typedef typename std::make_unsigned< T >::type	Unsigned;
+
+	unsigned char	bytes[ sizeof( T ) ];
+
+	if ( !Read( &bytes ) )
+	{
+		return false;
+	}
+
+	Unsigned	value	= 0;
+
+	for ( size_t i = 0; i < sizeof( T ); ++i )
+	{
+		value |= static_cast< Unsigned >( static_cast< Unsigned >( bytes[ i ] ) << ( 8 * ( sizeof( T ) - 1 - i ) ) );
+	}
+
+	*pValue = static_cast< T >( value );
+
+	return true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+template< typename T >
+inline bool BufferedProxy::WriteLittleEndian( T value )
+{
+	static_assert( std::is_integral< T >::value, "The type must be an integer." );
+
+	typedef typename std::make_unsigned< T >::type	Unsigned;
+
+	Unsigned const	u	= static_cast< Unsigned >( value );
+	unsigned char	bytes[ sizeof( T ) ];
+
+	for ( size_t i = 0; i < sizeof( T ); ++i )
+	{
+		bytes[ i ] = static_cast< unsigned char >( u >> ( 8 * i ) );
+	}
+
+	return Write( bytes );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+template< typename T >
+inline bool BufferedProxy::WriteBigEndian( T value )
+{
+	static_assert( std::is_integral< T >::value, "The type must be an integer." );
+
+	typedef typename std::make_unsigned< T >::type	Unsigned;
+
+	Unsigned const	u	= static_cast< Unsigned >( value );
+	unsigned char	bytes[ sizeof( T ) ];
+
+	for ( size_t i = 0; i < sizeof( T ); ++i )
+	{
+		bytes[ i ] = static_cast< unsigned char >( u >> ( 8 * ( sizeof( T ) - 1 - i ) ) );
+	}
+
+	return Write( bytes );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Each byte holds 7 bits of the value, least significant first. The high bit of a byte is set if another byte
+//! follows. A value takes at most 10 bytes.
+//!
+//! @param	pValue	Where to store the value.
+//!
+//! @return		True if the whole value was read, or false if the end of the data was reached or the varint is
+//!				longer than 10 bytes.
+
+inline bool BufferedProxy::ReadVarint( uint64_t * pValue )
+{
+	uint64_t	value	= 0;
+
+	// If the longest possible varint is in the buffer, then decode it directly from the buffer.
+
+	if ( ( m_Flags & CF_WRITE_ONLY ) == 0 && RemainingReadAmount() >= 10 )
+	{
+		unsigned char const * const	p	= reinterpret_cast< unsigned char const * >( &m_paBuffer[ m_Point ] );
+
+		for ( int i = 0; i < 10; ++i )
+		{
+			value |= static_cast< uint64_t >( p[ i ] & 0x7f ) << ( 7 * i );
+			if ( ( p[ i ] & 0x80 ) == 0 )
+			{
+				m_Point += i + 1;
+				*pValue = value;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Otherwise, read it a byte at a time.
+
+	for ( int i = 0; i < 10; ++i )
+	{
+		unsigned char	byte;
+
+		if ( !Read( &byte ) )
+		{
+			return false;
+		}
+
+		value |= static_cast< uint64_t >( byte & 0x7f ) << ( 7 * i );
+		if ( ( byte & 0x80 ) == 0 )
+		{
+			*pValue = value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! See ReadVarint() for the format.
+
+inline bool BufferedProxy::WriteVarint( uint64_t value )
+{
+	unsigned char	bytes[ 10 ];
+	int				n	= 0;
+
+	do
+	{
+		bytes[ n ] = static_cast< unsigned char >( value & 0x7f );
+		value >>= 7;
+		if ( value != 0 )
+		{
+			bytes[ n ] |= 0x80;
+		}
+		++n;
+	} while ( value != 0 );
+
+	if ( CanWriteInPlace( n ) )
+	{
+		memcpy( &m_paBuffer[ m_Point ], bytes, n );
+		CommitInPlace( n );
+		return true;
+	}
+
+	return Write( bytes, n ) == n;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+// Writing in place is only possible if the space is in the buffer and no part of the buffer has to be filled first.
+
+inline bool BufferedProxy::CanWriteInPlace( int64_t n ) const
+{
+	return ( m_Flags & CF_READ_ONLY ) == 0
+		&& n <= RemainingWriteSpace()
+		&& ( ( m_DataSize > 0 && ( !m_IsPartial || m_Point + n <= m_DataSize * m_BlockSize ) ) || ( m_Flags & CF_NO_FILLS ) != 0 );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+inline void BufferedProxy::CommitInPlace( int64_t n )
+{
+	MarkDirty( m_Point, m_Point + n );
+	m_Point += n;
+
+	// If the size of the data in the buffer is growing, then update the size.
+
+	if ( m_Point > m_DataSize * m_BlockSize )
+	{
+		m_DataSize = ( m_Point + m_BlockSize - 1 ) / m_BlockSize;
+	}
+}
+
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+// The range is kept in bytes so that marking it is cheap. It is converted to blocks when the buffer is flushed.
+
+inline void BufferedProxy::MarkDirty( int64_t begin, int64_t end )
+{
+	if ( !m_IsDirty )
+	{
+		m_DirtyBegin	= begin;
+		m_DirtyEnd		= end;
+		m_IsDirty		= true;
+	}
+	else
+	{
+		if ( begin < m_DirtyBegin )
+		{
+			m_DirtyBegin = begin;
+		}
+
+		if ( end > m_DirtyEnd )
+		{
+			m_DirtyEnd = end;
+		}
+	}
+}
+
+
 #endif // !defined( BUFFER_H_INCLUDED )
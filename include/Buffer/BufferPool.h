@@ -0,0 +1,118 @@
+#if !defined( BUFFERPOOL_H_INCLUDED )
+#define BUFFERPOOL_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                     BufferPool.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/BufferPool.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+//! A pool of aligned buffers that are reused instead of being freed.
+//
+//! Buffers are grouped in size classes (powers of two from 4 KiB to 64 MiB). A buffer is aligned on its size, up to
+//! the size of an arena (2 MiB), so any alignment up to that is satisfied. Smaller buffers are carved out of arenas,
+//! and larger ones are allocated individually. Freed buffers are kept for reuse until the pool is destroyed. Buffers
+//! larger than the largest class are allocated and freed directly.
+//!
+//! Each thread keeps a few freed buffers of each class for itself, so allocating and freeing buffers in the same
+//! thread rarely needs the pool's lock.
+//!
+//! The memory can be backed by huge pages, which reduces the TLB misses when large buffers are accessed.
+//!
+//! @note	All buffers must be freed before the pool is destroyed. The memory is released when it is.
+
+class BufferPool
+{
+public:
+
+	//! Configuration flags
+	enum
+	{
+		//! The memory is allocated from the reserved huge pages (Linux MAP_HUGETLB). If none are available, normal
+		//! pages are used instead.
+		HUGE_PAGES				= 0x00000001,
+
+		//! The memory is marked as eligible for transparent huge pages (Linux MADV_HUGEPAGE).
+		TRANSPARENT_HUGE_PAGES	= 0x00000002,
+	};
+
+	//! Constructor
+	explicit BufferPool( unsigned flags = 0 );
+	~BufferPool();
+
+	//! Returns a buffer of at least @a size bytes aligned on @a alignment, or 0 if it can't be allocated.
+	void * Allocate( int64_t size, unsigned alignment = 1 );
+
+	//! Returns a buffer to the pool. The size and alignment must be the ones given to Allocate().
+	void Free( void * p, int64_t size, unsigned alignment = 1 );
+
+	//! Returns the amount of memory obtained from the system for the pooled buffers (in bytes).
+	int64_t MappedSize() const;
+
+	//! Returns the pool used by default, which uses transparent huge pages.
+	static BufferPool & Default();
+
+private:
+
+	// Size classes
+	enum
+	{
+		MIN_CLASS_SHIFT	= 12,										// Smallest class is 4 KiB
+		MAX_CLASS_SHIFT	= 26,										// Largest class is 64 MiB
+		CLASS_COUNT		= MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1,
+		ARENA_SHIFT		= 21										// Arenas are 2 MiB
+	};
+
+	struct ThreadCaches;
+
+	// Prevent copying
+	BufferPool( BufferPool const & );
+	BufferPool & operator =( BufferPool const & );
+
+	// Returns the class of a buffer, or < 0 if it is too large to be pooled.
+	static int GetClass( int64_t size, unsigned alignment );
+
+	// Returns the maximum number of free buffers of the given class kept by each thread.
+	static int GetThreadCacheLimit( int sizeClass );
+
+	// Returns the calling thread's free buffers for the given pool.
+	static std::vector< void * > * GetThreadCache( BufferPool * pPool );
+
+	// Takes buffers of the given class from the shared free list (allocating more if necessary). Returns the number
+	// of buffers taken.
+	int Take( int sizeClass, void ** ppBuffers, int n );
+
+	// Returns buffers of the given class to the shared free list.
+	void Give( int sizeClass, void * const * ppBuffers, int n );
+
+	// Obtains memory from the system, aligned on an arena boundary. Returns 0 if it can't be obtained.
+	void * Map( size_t size );
+
+	// Returns memory obtained by Map() to the system.
+	static void Unmap( void * p, size_t size );
+
+	unsigned									m_Flags;				// Flags
+	uint64_t									m_Id;					// Identifies the pool in the threads' caches
+	std::vector< void * >						m_aFree[ CLASS_COUNT ];	// Free buffers of each class
+	std::vector< std::pair< void *, size_t > >	m_Mappings;				// Memory obtained from the system
+	int64_t										m_MappedSize;			// Total size of the memory obtained
+	mutable std::mutex							m_Mutex;				// Guards the free lists and the mappings
+};
+
+
+#endif // !defined( BUFFERPOOL_H_INCLUDED )
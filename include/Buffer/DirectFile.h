@@ -0,0 +1,85 @@
+#if !defined( DIRECTFILE_H_INCLUDED )
+#define DIRECTFILE_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                     DirectFile.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/DirectFile.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "Buffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+
+//! A file opened for unbuffered I/O (Linux O_DIRECT).
+//
+//! The operating system's page cache is bypassed, so every transfer must be aligned to the device's logical block
+//! size both in the file and in memory. The alignment requirements are discovered when the file is opened (using
+//! statx(), or the BLKSSZGET ioctl for block devices, or 4096 if neither is available), and CreateProxy() returns a
+//! BufferedProxy with a buffer and geometry that meet them.
+//!
+//! The handle passed to the functions is the file descriptor returned by Handle().
+//!
+//! @note	Only whole blocks are written, so the size of a file written through a proxy is rounded up to a multiple of
+//!			the block size.
+
+class DirectFile : public BufferedProxy::BufferedObject
+{
+public:
+
+	//! Constructor
+	DirectFile( char const * pPath, int oflags, mode_t mode = 0644 );
+	virtual ~DirectFile();
+
+	//! Returns the file descriptor, which is the handle passed to the functions.
+	unsigned Handle() const							{ return static_cast< unsigned >( m_Fd ); }
+
+	//! Returns the size of a block. The offset and size of every transfer must be a multiple of this value.
+	int64_t BlockSize() const						{ return m_BlockSize; }
+
+	//! Returns the memory alignment. The address of every transfer must be aligned on this boundary.
+	unsigned MemoryAlign() const					{ return m_MemoryAlign; }
+
+	//! Returns a proxy for this file with an aligned buffer of (at least) @a bufferSize bytes.
+	std::unique_ptr< BufferedProxy > CreateProxy( int64_t bufferSize, unsigned flags = 0 );
+
+	// BufferedProxy::BufferedObject overrides
+
+	virtual int64_t	Read( unsigned handle, char * pBuffer, int64_t n );
+	virtual int64_t	Write( unsigned handle, char const * pBuffer, int64_t n );
+	virtual int64_t	Seek( unsigned handle, int64_t location );
+	virtual bool	IsPositional() const			{ return true; }
+	virtual int64_t	ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location );
+	virtual int64_t	WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location );
+
+private:
+
+	// Prevent copying
+	DirectFile( DirectFile const & );
+	DirectFile & operator =( DirectFile const & );
+
+	// Determines the block size and memory alignment required by the file.
+	void DiscoverAlignment();
+
+	// Reads or writes blocks at the given location (or at the current location if < 0). Returns the number of
+	// blocks transferred or < 0.
+	int64_t Transfer( int fd, char * pBuffer, int64_t n, int64_t location, bool isWrite );
+
+	int			m_Fd;				// File descriptor
+	int64_t		m_BlockSize;		// Transfers must be a multiple of this size and start on this boundary in the file
+	unsigned	m_MemoryAlign;		// Transfers must start on this boundary in memory
+};
+
+
+#endif // !defined( DIRECTFILE_H_INCLUDED )
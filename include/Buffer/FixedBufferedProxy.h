@@ -0,0 +1,914 @@
+#if !defined( FIXEDBUFFEREDPROXY_H_INCLUDED )
+#define FIXEDBUFFEREDPROXY_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                 FixedBufferedProxy.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/FixedBufferedProxy.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "Buffer.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+//! A BufferedProxy whose geometry and flags are fixed at compile time.
+//
+//! Because the block size and alignments are constants, the divisions and remainders in the I/O paths become shifts
+//! and masks (when the values are powers of two), and the code for disabled features is compiled away. Use
+//! BufferedProxy when the geometry is only known at run time.
+//!
+//! @param	BLOCK_SIZE		The buffered object is always asked to fill or flush a multiple of this size.
+//! @param	SECTOR_ALIGN	Locations in the buffered object are always aligned on this boundary (a power of two).
+//! @param	BUFFER_ALIGN	Fills and flushes always start at a memory address aligned on this boundary (a power of
+//!							two).
+//! @param	FLAGS			Configuration flags (see BufferedProxy). CF_RANDOM_ACCESS and CF_ADAPTIVE are not supported.
+//! @param	OBJECT			Type of the buffered object. If it is a final class (such as MemoryObject), its functions are
+//!							called directly rather than through the BufferedObject interface, so they can be inlined.
+//!							By default, any buffered object can be used, and the calls are virtual.
+//!
+//! @note	Read-ahead, write-behind, page caching, and statistics are only available in BufferedProxy.
+
+template< int64_t BLOCK_SIZE,
+		  unsigned SECTOR_ALIGN = 1,
+		  unsigned BUFFER_ALIGN = 1,
+		  unsigned FLAGS = 0,
+		  typename OBJECT = BufferedProxy::BufferedObject >
+class FixedBufferedProxy
+{
+	static_assert( BLOCK_SIZE > 0, "The block size must be greater than 0." );
+	static_assert( SECTOR_ALIGN > 0 && ( SECTOR_ALIGN & ( SECTOR_ALIGN - 1 ) ) == 0, "The sector alignment must be a power of two." );
+	static_assert( BUFFER_ALIGN > 0 && ( BUFFER_ALIGN & ( BUFFER_ALIGN - 1 ) ) == 0, "The buffer alignment must be a power of two." );
+	static_assert( ( static_cast< int64_t >( SECTOR_ALIGN ) > BLOCK_SIZE ) ? SECTOR_ALIGN % BLOCK_SIZE == 0 : BLOCK_SIZE % SECTOR_ALIGN == 0,
+				   "The sector alignment and the block size must be multiples of each other." );
+	static_assert( ( FLAGS & BufferedProxy::CF_RANDOM_ACCESS ) == 0, "CF_RANDOM_ACCESS is not supported." );
+	static_assert( ( FLAGS & BufferedProxy::CF_ADAPTIVE ) == 0, "CF_ADAPTIVE is not supported." );
+	static_assert( ( FLAGS & BufferedProxy::CF_READ_ONLY ) == 0 || ( FLAGS & BufferedProxy::CF_WRITE_ONLY ) == 0,
+				   "CF_READ_ONLY and CF_WRITE_ONLY are mutually exclusive." );
+	static_assert( std::is_base_of< BufferedProxy::BufferedObject, OBJECT >::value, "The object must be a BufferedObject." );
+
+public:
+
+	//! Constructor
+	FixedBufferedProxy( void * pBuffer, int64_t bufferSize, unsigned handle, OBJECT * pBufferedObject );
+	~FixedBufferedProxy();
+
+	//! Returns the number of bytes that can be written before the buffer will have to be flushed.
+	int64_t RemainingWriteSpace() const						{ return m_BufferSize - m_Point; }
+
+	//! Returns the number of bytes that can be read before the buffer will have to be filled.
+	int64_t RemainingReadAmount() const						{ return m_DataSize * BLOCK_SIZE - m_Point; }
+
+	//! Reads @a n bytes from the buffered object through the buffer. Returns the number of bytes read, or < 0 if there is an error.
+	int64_t Read( void * pDst, int64_t n );
+
+	//! Writes @a n bytes to the buffered object through the buffer. Returns the number of bytes written, or < 0 if there is an error.
+	int64_t Write( void const * pSrc, int64_t n );
+
+	//! Returns the address of the data at the current location in the buffer. Returns the number of bytes available there.
+	int64_t Peek( void const ** ppData );
+
+	//! Moves the current location past @a n bytes of the data returned by Peek().
+	void Consume( int64_t n );
+
+	//! Returns the address of the space at the current location in the buffer. Returns the number of bytes available there.
+	int64_t Reserve( void ** ppSpace );
+
+	//! Moves the current location past @a n bytes written to the space returned by Reserve().
+	void Commit( int64_t n );
+
+	//! Moves the current location in the buffered object. Returns the actual location, or < 0 if there is an error.
+	int64_t Seek( int64_t location );
+
+	//! Forces the buffer to flush any unwritten data to the buffered object. Returns false if any of it could not be written.
+	bool Flush();
+
+	//! Forces the buffer to refresh itself from the buffered object. The current location moves to the start of the buffer.
+	void Fill();
+
+private:
+
+	// Prevent copying
+	FixedBufferedProxy( FixedBufferedProxy const & );
+	FixedBufferedProxy & operator =( FixedBufferedProxy const & );
+
+	// Moves the buffer to the data following the data in the buffer, flushing it first. The buffer is not filled.
+	void Advance();
+
+	// Moves the buffer to the given location (in blocks), flushing it first. The buffer is not filled.
+	void MoveTo( int64_t location );
+
+	// Reads the whole buffer from the buffered object. The current location is not changed.
+	void FillBuffer();
+
+	// Reads the blocks that will be partially overwritten by writing up to the given offset in the buffer.
+	void FillEdges( int64_t end );
+
+	// Reads blocks from the buffered object at the given location. Returns the number of blocks read or < 0.
+	int64_t ReadBlocks( int64_t location, char * pBuffer, int64_t n );
+
+	// Writes blocks to the buffered object at the given location. Returns the number of blocks written or < 0.
+	int64_t WriteBlocks( int64_t location, char const * pBuffer, int64_t n );
+
+	// Copy data from the source into the buffer and update the pointers.
+	void CopyIn( void const ** ppSrc, int64_t n );
+
+	// Copy data from the buffer to the destination and update the pointers.
+	void CopyOut( void ** ppDst, int64_t n );
+
+	// True if the buffer is ever filled (write-only never fills)
+	static bool const	FILLS	= ( FLAGS & ( BufferedProxy::CF_NO_FILLS | BufferedProxy::CF_WRITE_ONLY ) ) == 0;
+
+	// Returns the smallest multiple of @a n blocks whose size is a multiple of both alignments.
+	static constexpr int64_t FlushGranule( int64_t n = 1 )
+	{
+		return ( ( n * BLOCK_SIZE ) % SECTOR_ALIGN == 0 && ( n * BLOCK_SIZE ) % BUFFER_ALIGN == 0 ) ? n : FlushGranule( n * 2 );
+	}
+
+	// Returns true if the address is aligned on the buffer alignment.
+	static bool IsBufferAligned( void const * p )			{ return ( reinterpret_cast< uintptr_t >( p ) & ( BUFFER_ALIGN - 1 ) ) == 0; }
+
+	// Returns the number of bytes to transfer through the buffer so that the rest of a direct transfer is aligned, or
+	// 0 if the address is aligned or is not misaligned by a whole number of blocks and sectors.
+	int64_t GetBounceSize( void const * p, int64_t n ) const
+	{
+		int64_t const	bounce	= ( BUFFER_ALIGN - ( reinterpret_cast< uintptr_t >( p ) & ( BUFFER_ALIGN - 1 ) ) ) & ( BUFFER_ALIGN - 1 );
+
+		return (    ( FLAGS & BufferedProxy::CF_NO_DIRECT_IO ) == 0
+				 && bounce % BLOCK_SIZE == 0
+				 && bounce % SECTOR_ALIGN == 0
+				 && bounce <= m_BufferSize
+				 && n - bounce >= m_BufferSize ) ? bounce : 0;
+	}
+
+	unsigned							m_Handle;				// Handle to pass to callback functions
+	char *								m_paBuffer;				// Address of the buffer's buffer
+	int64_t								m_BufferSize;			// Size of the buffer (in bytes)
+	int64_t								m_BufferSizeInBlocks;	// Size of the buffer (in blocks)
+	OBJECT *							m_pBufferedObject;		// The buffered object
+	bool								m_IsPositional;			// True if the buffered object implements ReadAt() and WriteAt()
+	int64_t								m_Point;				// Index of the I/O point in the buffer (in bytes)
+	int64_t								m_BufferLoc;			// Location of the buffer in the buffered object's space (in blocks)
+	int64_t								m_DataSize;				// Size of data in the buffer (in blocks)
+	bool								m_IsDirty;				// True if the buffer contains data that has not been flushed yet
+	int64_t								m_DirtyBegin;			// Start of the data that has not been flushed yet (in bytes), if dirty
+	int64_t								m_DirtyEnd;				// End of the data that has not been flushed yet (in bytes), if dirty
+	bool								m_IsPartial;			// True if data following the data in the buffer might not have been read
+};
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pBuffer				Memory for use by the buffer. The address must be aligned on a BUFFER_ALIGN boundary.
+//! @param	bufferSize			Size of the buffer. It must be a multiple of BLOCK_SIZE.
+//! @param	handle				Handle to be passed to the buffered object.
+//! @param	pBufferedObject		Interface to the object that fills and flushes the buffer.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::FixedBufferedProxy( void * pBuffer,
+																								 int64_t bufferSize,
+																								 unsigned handle,
+																								 OBJECT * pBufferedObject )
+{
+	// The buffer size must be a multiple of the block size
+
+	if ( bufferSize <= 0 || bufferSize % BLOCK_SIZE != 0 )
+	{
+		throw ConstructorFailedException( "The buffer size must be a multiple of the block size." );
+	}
+
+	// The buffer must be aligned on a BUFFER_ALIGN boundary
+
+	if ( !IsBufferAligned( pBuffer ) )
+	{
+		throw ConstructorFailedException( "The buffer must be aligned on a bufferAlign boundary." );
+	}
+
+	m_Handle				= handle;
+	m_paBuffer				= static_cast< char * >( pBuffer );
+	m_BufferSize			= bufferSize;
+	m_BufferSizeInBlocks	= bufferSize / BLOCK_SIZE;
+	m_pBufferedObject		= pBufferedObject;
+	m_IsPositional			= pBufferedObject->IsPositional();
+	m_Point					= 0;
+	m_BufferLoc				= 0;
+	m_DataSize				= 0;
+	m_IsDirty				= false;
+	m_DirtyBegin			= 0;
+	m_DirtyEnd				= 0;
+	m_IsPartial				= false;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::~FixedBufferedProxy()
+{
+	Flush();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pDst	Location to which data is to be copied from the buffer
+//! @param	n		Number of bytes to read
+//!
+//! @return		The number of bytes actually read.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+int64_t FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Read( void * pDst, int64_t n )
+{
+	int64_t	bytesToRead;
+	int64_t	totalRead	= 0;
+
+	if ( ( FLAGS & BufferedProxy::CF_WRITE_ONLY ) != 0 )
+	{
+		return -1;
+	}
+
+	// If a seek left the current location in the middle of an empty buffer, then the buffer must be filled first.
+
+	if ( m_DataSize == 0 && m_Point > 0 )
+	{
+		FillBuffer();
+	}
+
+	// First, read what is already available in the buffer (if any)
+
+	bytesToRead = std::min( n, RemainingReadAmount() );
+	if ( bytesToRead > 0 )
+	{
+		CopyOut( &pDst, bytesToRead );
+		totalRead += bytesToRead;
+		n -= bytesToRead;
+	}
+
+	// Next, if the remaining amount to read is greater than or equal to the buffer size, then read as many
+	// whole blocks as possible.
+
+	if ( n >= m_BufferSize )
+	{
+		// About to do fills, so a flush is needed.
+
+		Flush();
+
+		// If the destination buffer is misaligned by whole sectors, then read the head through the buffer so that
+		// the rest can be read directly.
+
+		int64_t const	bounce	= GetBounceSize( pDst, n );
+
+		if ( bounce > 0 )
+		{
+			Advance();
+
+			// The head can only be read into the buffer if the buffer starts at the data to be read.
+
+			if ( m_Point == 0 )
+			{
+				m_DataSize = std::max< int64_t >( ReadBlocks( m_BufferLoc, m_paBuffer, bounce / BLOCK_SIZE ), 0 );
+
+				bytesToRead = std::min( bounce, RemainingReadAmount() );
+				if ( bytesToRead > 0 )
+				{
+					CopyOut( &pDst, bytesToRead );
+					totalRead += bytesToRead;
+					n -= bytesToRead;
+				}
+			}
+		}
+
+		// If direct I/O is allowed and the destination buffer is aligned, read the data directly into the
+		// destination buffer. The data to be read must follow the data in the buffer (see BufferedProxy::Read()).
+
+		if (    ( FLAGS & BufferedProxy::CF_NO_DIRECT_IO ) == 0
+			 && IsBufferAligned( pDst )
+			 && m_Point == m_DataSize * BLOCK_SIZE )
+		{
+			int64_t const	location		= m_BufferLoc + m_DataSize;								// The next data to read
+			int64_t const	blocksToRead	= n / BLOCK_SIZE / FlushGranule() * FlushGranule();	// Read whole blocks, keeping the alignment
+			int64_t const	blocksRead		= std::max< int64_t >( ReadBlocks( location, static_cast< char * >( pDst ), blocksToRead ), 0 );
+			int64_t const	bytesRead		= blocksRead * BLOCK_SIZE;
+
+			pDst = static_cast< char * >( pDst ) + bytesRead;
+			totalRead += bytesRead;
+			n -= bytesRead;
+
+			// The buffer must be resynched.
+
+			MoveTo( location + blocksRead );
+		}
+
+		// Otherwise, read the data a buffer at time until less than a full buffer is needed or until the end of
+		// the data is reached.
+
+		else
+		{
+			while ( n >= m_BufferSize )
+			{
+				Advance();
+				FillBuffer();
+
+				bytesToRead = RemainingReadAmount();
+				if ( bytesToRead > 0 )
+				{
+					CopyOut( &pDst, bytesToRead );
+					totalRead += bytesToRead;
+					n -= bytesToRead;
+				}
+
+				// If the end of the data was reached, then abort
+
+				if ( m_DataSize < m_BufferSizeInBlocks )
+				{
+					break;
+				}
+			}
+		}
+	}
+
+	// Read the rest of the data through the buffer.
+
+	if ( n > 0 )
+	{
+		if ( RemainingReadAmount() <= 0 )
+		{
+			Advance();
+		}
+
+		if ( m_DataSize == 0 )
+		{
+			FillBuffer();
+		}
+
+		bytesToRead = std::min( n, RemainingReadAmount() );
+		if ( bytesToRead > 0 )
+		{
+			CopyOut( &pDst, bytesToRead );
+			totalRead += bytesToRead;
+		}
+	}
+
+	return totalRead;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pSrc	Location of the data to be written to the buffer
+//! @param	n		Number of bytes to write
+//!
+//! @return		The number of bytes actually written.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+int64_t FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Write( void const * pSrc, int64_t n )
+{
+	int64_t	totalWritten	= 0;
+
+	if ( ( FLAGS & BufferedProxy::CF_READ_ONLY ) != 0 )
+	{
+		return -1;
+	}
+
+	// If blocks are about to be partially overwritten, then they must be filled first.
+
+	FillEdges( m_Point + std::min( n, RemainingWriteSpace() ) );
+
+	// First, write to the remaining space available in the buffer (if any)
+
+	{
+		int64_t const	bytesToWrite	= std::min( n, RemainingWriteSpace() );
+
+		if ( bytesToWrite > 0 )
+		{
+			CopyIn( &pSrc, bytesToWrite );
+			totalWritten += bytesToWrite;
+			n -= bytesToWrite;
+		}
+	}
+
+	// Next, if the remaining amount to write is greater than or equal to the buffer size, then write as many
+	// whole blocks as possible.
+
+	if ( n >= m_BufferSize )
+	{
+		// The buffer is full, so it must be flushed first.
+
+		Advance();
+
+		// If the source buffer is misaligned by whole sectors, then write the head through the buffer so that the
+		// rest can be written directly. The head's blocks are entirely overwritten, so they are not filled.
+
+		int64_t const	bounce	= GetBounceSize( pSrc, n );
+
+		if ( bounce > 0 )
+		{
+			CopyIn( &pSrc, bounce );
+			totalWritten += bounce;
+			n -= bounce;
+		}
+
+		// If direct I/O is allowed and the source buffer is aligned, write the data directly from the source buffer.
+
+		if ( ( FLAGS & BufferedProxy::CF_NO_DIRECT_IO ) == 0 && IsBufferAligned( pSrc ) )
+		{
+			int64_t const	location		= m_BufferLoc + m_Point / BLOCK_SIZE;					// Follows the head (if any)
+			int64_t const	blocksToWrite	= n / BLOCK_SIZE / FlushGranule() * FlushGranule();	// Write whole blocks, keeping the alignment
+			int64_t const	blocksWritten	= std::max< int64_t >( WriteBlocks( location, static_cast< char const * >( pSrc ), blocksToWrite ), 0 );
+			int64_t const	bytesWritten	= blocksWritten * BLOCK_SIZE;
+
+			pSrc = static_cast< char const * >( pSrc ) + bytesWritten;
+			totalWritten += bytesWritten;
+			n -= bytesWritten;
+
+			// The buffer must be resynched. This also flushes the head (if any).
+
+			MoveTo( location + blocksWritten );
+		}
+
+		// Otherwise, write the data a buffer at time until less than a full buffer is left to write.
+
+		else
+		{
+			while ( n >= m_BufferSize )
+			{
+				CopyIn( &pSrc, m_BufferSize );
+				totalWritten += m_BufferSize;
+				n -= m_BufferSize;
+
+				Advance();
+			}
+		}
+	}
+
+	// Write the rest through the buffer
+
+	while ( n > 0 )
+	{
+		// If the buffer is full, it must be flushed and moved to the data that follows.
+
+		if ( m_Point >= m_BufferSize )
+		{
+			Advance();
+		}
+
+		// If blocks are going to be partially overwritten, then they must be filled first.
+
+		FillEdges( m_Point + std::min( n, RemainingWriteSpace() ) );
+
+		int64_t const	bytesToWrite	= std::min( n, RemainingWriteSpace() );
+
+		if ( bytesToWrite <= 0 )
+		{
+			break;
+		}
+
+		CopyIn( &pSrc, bytesToWrite );
+		totalWritten += bytesToWrite;
+		n -= bytesToWrite;
+
+		if ( m_Point >= m_BufferSize )
+		{
+			Advance();
+		}
+	}
+
+	return totalWritten;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! See BufferedProxy::Peek().
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+int64_t FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Peek( void const ** ppData )
+{
+	if ( ( FLAGS & BufferedProxy::CF_WRITE_ONLY ) != 0 )
+	{
+		return -1;
+	}
+
+	if ( m_DataSize == 0 && m_Point > 0 )
+	{
+		FillBuffer();
+	}
+
+	if ( RemainingReadAmount() <= 0 )
+	{
+		Advance();
+	}
+
+	if ( m_DataSize == 0 )
+	{
+		FillBuffer();
+	}
+
+	*ppData = &m_paBuffer[ m_Point ];
+
+	return std::max< int64_t >( RemainingReadAmount(), 0 );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	n	Number of bytes to consume. It must not be more than the amount returned by the last call to Peek().
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Consume( int64_t n )
+{
+	assert( n >= 0 && m_Point + n <= m_DataSize * BLOCK_SIZE );
+
+	m_Point += n;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! See BufferedProxy::Reserve().
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+int64_t FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Reserve( void ** ppSpace )
+{
+	if ( ( FLAGS & BufferedProxy::CF_READ_ONLY ) != 0 )
+	{
+		return -1;
+	}
+
+	if ( RemainingWriteSpace() <= 0 )
+	{
+		Advance();
+	}
+
+	if ( FILLS )
+	{
+		if ( m_DataSize == 0 )
+		{
+			FillBuffer();
+		}
+		else if ( m_IsPartial )
+		{
+			int64_t const	blocksRead	= ReadBlocks( m_BufferLoc + m_DataSize,
+													  m_paBuffer + m_DataSize * BLOCK_SIZE,
+													  m_BufferSizeInBlocks - m_DataSize );
+
+			m_DataSize += std::max< int64_t >( blocksRead, 0 );
+			m_IsPartial = false;
+		}
+	}
+
+	*ppSpace = &m_paBuffer[ m_Point ];
+
+	return RemainingWriteSpace();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	n	Number of bytes written. It must not be more than the amount returned by the last call to Reserve().
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Commit( int64_t n )
+{
+	assert( n >= 0 && m_Point + n <= m_BufferSize );
+
+	if ( !m_IsDirty )
+	{
+		m_DirtyBegin	= m_Point;
+		m_DirtyEnd		= m_Point + n;
+		m_IsDirty		= true;
+	}
+	else
+	{
+		m_DirtyBegin	= std::min( m_DirtyBegin, m_Point );
+		m_DirtyEnd		= std::max( m_DirtyEnd, m_Point + n );
+	}
+
+	m_Point += n;
+
+	if ( m_Point > m_DataSize * BLOCK_SIZE )
+	{
+		m_DataSize = ( m_Point + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	location	Where to put the current location (specified as the number of bytes from the beginning).
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+int64_t FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Seek( int64_t location )
+{
+	// If the seek location is already in the buffer, then just move the index
+
+	if ( location >= m_BufferLoc * BLOCK_SIZE && location < ( m_BufferLoc + m_DataSize ) * BLOCK_SIZE )
+	{
+		m_Point = location - m_BufferLoc * BLOCK_SIZE;
+		return location;
+	}
+
+	// Otherwise, flush the buffer and move it to the block containing the location. The start of the buffer must
+	// be aligned.
+
+	Flush();
+
+	int64_t	blockLocation	= ( location & ~static_cast< int64_t >( SECTOR_ALIGN - 1 ) ) / BLOCK_SIZE;
+
+	if ( !m_IsPositional )
+	{
+		blockLocation = m_pBufferedObject->Seek( m_Handle, blockLocation );
+	}
+
+	MoveTo( blockLocation );
+
+	// The buffer is not filled until it is needed (see BufferedProxy::Seek()).
+
+	m_Point = location - m_BufferLoc * BLOCK_SIZE;
+
+	return location;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the data could not be written, it remains modified and the next flush tries again.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+bool FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Flush()
+{
+	if ( ( FLAGS & BufferedProxy::CF_READ_ONLY ) == 0 && m_IsDirty && m_DataSize > 0 )
+	{
+		// Only the modified blocks are written, starting at an aligned block (see BufferedProxy::Flush()).
+
+		int64_t const	first	= m_DirtyBegin / BLOCK_SIZE / FlushGranule() * FlushGranule();
+		int64_t const	last	= std::min( ( m_DirtyEnd + BLOCK_SIZE - 1 ) / BLOCK_SIZE, m_DataSize );
+
+		if ( WriteBlocks( m_BufferLoc + first, m_paBuffer + first * BLOCK_SIZE, last - first ) != last - first )
+		{
+			return false;
+		}
+
+		m_IsDirty = false;
+	}
+
+	return true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @warning	Any data in the buffer that has not been flushed will be overwritten.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Fill()
+{
+	FillBuffer();
+	m_Point = 0;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::FillBuffer()
+{
+	if ( FILLS )
+	{
+		m_DataSize	= std::max< int64_t >( ReadBlocks( m_BufferLoc, m_paBuffer, m_BufferSizeInBlocks ), 0 );
+		m_IsPartial	= false;
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::Advance()
+{
+	int64_t const	location	= m_BufferLoc * BLOCK_SIZE + std::max( m_Point, m_DataSize * BLOCK_SIZE );
+
+	MoveTo( location / BLOCK_SIZE );
+	m_Point += location % BLOCK_SIZE;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The start of the buffer must be aligned, so if the location is not on a flush boundary, the buffer starts at the
+//! boundary before it and the I/O point is moved to the location.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::MoveTo( int64_t location )
+{
+	Flush();
+
+	m_BufferLoc	= location / FlushGranule() * FlushGranule();
+	m_Point		= ( location - m_BufferLoc ) * BLOCK_SIZE;
+	m_DataSize	= 0;
+	m_IsPartial	= false;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! See BufferedProxy::FillEdges(). If flushes must start on a boundary larger than a block, the whole buffer is
+//! filled instead.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::FillEdges( int64_t end )
+{
+	if ( !FILLS || end <= m_DataSize * BLOCK_SIZE )
+	{
+		return;
+	}
+
+	if ( m_DataSize == 0 )
+	{
+		if ( m_Point == 0 && end >= m_BufferSize )
+		{
+			return;
+		}
+
+		if ( FlushGranule() > 1 )
+		{
+			FillBuffer();
+			return;
+		}
+	}
+	else if ( !m_IsPartial )
+	{
+		return;
+	}
+
+	int64_t const	headEnd	= std::max( m_DataSize, ( m_Point + BLOCK_SIZE - 1 ) / BLOCK_SIZE );
+
+	if ( headEnd > m_DataSize )
+	{
+		int64_t const	blocksRead	= ReadBlocks( m_BufferLoc + m_DataSize, m_paBuffer + m_DataSize * BLOCK_SIZE, headEnd - m_DataSize );
+
+		m_DataSize += std::max< int64_t >( blocksRead, 0 );
+	}
+
+	if ( end % BLOCK_SIZE != 0 && end / BLOCK_SIZE >= headEnd )
+	{
+		int64_t const	first		= end / BLOCK_SIZE;
+		int64_t const	blocksRead	= ReadBlocks( m_BufferLoc + first, m_paBuffer + first * BLOCK_SIZE, m_BufferSizeInBlocks - first );
+
+		m_DataSize	= std::max( m_DataSize, first + std::max< int64_t >( blocksRead, 0 ) );
+		m_IsPartial	= false;
+	}
+	else
+	{
+		m_IsPartial = true;
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The buffered object may transfer fewer blocks than requested, so the transfer is continued until it is complete
+//! or nothing more can be read.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+int64_t FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::ReadBlocks( int64_t location, char * pBuffer, int64_t n )
+{
+	if ( !m_IsPositional && m_pBufferedObject->Seek( m_Handle, location ) != location )
+	{
+		return -1;
+	}
+
+	int64_t	total	= 0;
+
+	while ( total < n )
+	{
+		int64_t const	blocksRead	= m_IsPositional
+									? m_pBufferedObject->ReadAt( m_Handle, pBuffer + total * BLOCK_SIZE, n - total, location + total )
+									: m_pBufferedObject->Read( m_Handle, pBuffer + total * BLOCK_SIZE, n - total );
+
+		if ( blocksRead <= 0 )
+		{
+			return ( total > 0 ) ? total : blocksRead;
+		}
+
+		total += blocksRead;
+	}
+
+	return total;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The buffered object may transfer fewer blocks than requested, so the transfer is continued until it is complete
+//! or nothing more can be written.
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+int64_t FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::WriteBlocks( int64_t location, char const * pBuffer, int64_t n )
+{
+	if ( !m_IsPositional && m_pBufferedObject->Seek( m_Handle, location ) != location )
+	{
+		return -1;
+	}
+
+	int64_t	total	= 0;
+
+	while ( total < n )
+	{
+		int64_t const	blocksWritten	= m_IsPositional
+										? m_pBufferedObject->WriteAt( m_Handle, pBuffer + total * BLOCK_SIZE, n - total, location + total )
+										: m_pBufferedObject->Write( m_Handle, pBuffer + total * BLOCK_SIZE, n - total );
+
+		if ( blocksWritten <= 0 )
+		{
+			return ( total > 0 ) ? total : blocksWritten;
+		}
+
+		total += blocksWritten;
+	}
+
+	return total;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::CopyIn( void const ** ppSrc, int64_t n )
+{
+	assert( m_Point + n <= m_BufferSize );
+
+	memcpy( &m_paBuffer[ m_Point ], *ppSrc, static_cast< size_t >( n ) );
+
+	Commit( n );
+	*ppSrc = static_cast< char const * >( *ppSrc ) + n;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS, typename OBJECT >
+void FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS, OBJECT >::CopyOut( void ** ppDst, int64_t n )
+{
+	assert( m_Point + n <= m_DataSize * BLOCK_SIZE );
+
+	memcpy( *ppDst, &m_paBuffer[ m_Point ], static_cast< size_t >( n ) );
+
+	Consume( n );
+	*ppDst = static_cast< char * >( *ppDst ) + n;
+}
+
+
+#endif // !defined( FIXEDBUFFEREDPROXY_H_INCLUDED )
@@ -0,0 +1,97 @@
+#if !defined( MAPPEDPROXY_H_INCLUDED )
+#define MAPPEDPROXY_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                     MappedProxy.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/MappedProxy.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "Buffer.h"
+
+#include <cstdint>
+
+//! A stream over a memory-mapped file, with the same interface as BufferedProxy.
+//
+//! Instead of being filled and flushed through a buffer, the data is accessed directly in a window of the file that
+//! is mapped into memory. Reads are copied straight from the window and writes land in it, and Peek() and Reserve()
+//! return addresses in the window. When the location moves outside the window, the window is remapped there.
+//!
+//! The flags are the BufferedProxy configuration flags. CF_READ_ONLY maps the file read-only. CF_RANDOM_ACCESS
+//! advises the system to expect random access, otherwise it is advised to expect sequential access. The other flags
+//! have no effect.
+//!
+//! @note	While the file is being written, it may be larger than the data written to it. Flush() sets its size.
+
+class MappedProxy
+{
+public:
+
+	//! Constructor
+	MappedProxy( int fd, unsigned flags, int64_t windowSize = 1024 * 1024 * 1024 );
+	virtual ~MappedProxy();
+
+	//! Returns the number of bytes that can be written before the window will have to be moved.
+	int64_t RemainingWriteSpace() const;
+
+	//! Returns the number of bytes that can be read before the window will have to be moved.
+	int64_t RemainingReadAmount() const;
+
+	//! Reads @a n bytes from the file. Returns the number of bytes read, or < 0 if there is an error.
+	int64_t Read( void * pDst, int64_t n );
+
+	//! Writes @a n bytes to the file. Returns the number of bytes written, or < 0 if there is an error.
+	int64_t Write( void const * pSrc, int64_t n );
+
+	//! Returns the address of the data at the current location. Returns the number of bytes available there.
+	int64_t Peek( void const ** ppData );
+
+	//! Moves the current location past @a n bytes of the data returned by Peek().
+	void Consume( int64_t n );
+
+	//! Returns the address of the space at the current location. Returns the number of bytes available there, or < 0 if there is an error.
+	int64_t Reserve( void ** ppSpace );
+
+	//! Moves the current location past @a n bytes written to the space returned by Reserve().
+	void Commit( int64_t n );
+
+	//! Moves the current location in the file. Returns the actual location, or < 0 if there is an error.
+	int64_t Seek( int64_t location );
+
+	//! Sets the size of the file to the amount of data written and schedules the written data to be written to disk.
+	void Flush();
+
+private:
+
+	// Prevent copying
+	MappedProxy( MappedProxy const & );
+	MappedProxy & operator =( MappedProxy const & );
+
+	// Maps the window containing the given location (in bytes). Returns false if it could not be mapped.
+	bool MapWindow( int64_t location );
+
+	// Makes sure that the file is at least as large as the given size (in bytes). Returns false if it can't be.
+	bool Extend( int64_t size );
+
+	int			m_Fd;				// The file
+	unsigned	m_Flags;			// Flags
+	int64_t		m_WindowSize;		// Size of the window (in bytes)
+	char *		m_pWindow;			// Address of the mapped window, or 0 if nothing is mapped
+	int64_t		m_WindowLoc;		// Location of the window in the file (in bytes)
+	int64_t		m_Location;			// Current location in the file (in bytes)
+	int64_t		m_FileSize;			// Size of the data in the file (in bytes)
+	int64_t		m_AllocatedSize;	// Actual size of the file, which may be larger while it is being written (in bytes)
+	bool		m_IsDirty;			// True if the window has been written
+};
+
+
+#endif // !defined( MAPPEDPROXY_H_INCLUDED )
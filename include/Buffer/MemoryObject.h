@@ -0,0 +1,89 @@
+#if !defined( MEMORYOBJECT_H_INCLUDED )
+#define MEMORYOBJECT_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                    MemoryObject.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/MemoryObject.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "Buffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+//! A buffered object whose data is kept in memory.
+//
+//! The data grows as it is written. The number of calls to each function is counted, which makes it useful for
+//! measuring and testing a BufferedProxy without involving a device. The handle passed to the functions is ignored.
+
+class MemoryObject final : public BufferedProxy::BufferedObject
+{
+public:
+
+	//! Constructor
+	MemoryObject( int64_t blockSize, int64_t size = 0, bool isPositional = false );
+	virtual ~MemoryObject();
+
+	//! Returns the address of the data.
+	char * Data()									{ return m_Data.empty() ? 0 : &m_Data[ 0 ]; }
+
+	//! Returns the size of the data (in bytes).
+	int64_t Size() const							{ return static_cast< int64_t >( m_Data.size() ); }
+
+	//! Returns the number of calls to Read() and ReadAt().
+	int64_t ReadCount() const						{ return m_ReadCount.load( std::memory_order_relaxed ); }
+
+	//! Returns the number of calls to Write() and WriteAt().
+	int64_t WriteCount() const						{ return m_WriteCount.load( std::memory_order_relaxed ); }
+
+	//! Returns the number of calls to Seek().
+	int64_t SeekCount() const						{ return m_SeekCount.load( std::memory_order_relaxed ); }
+
+	//! Resets the call counts to 0.
+	void ResetCounts();
+
+	// BufferedProxy::BufferedObject overrides
+
+	virtual int64_t	Read( unsigned handle, char * pBuffer, int64_t n );
+	virtual int64_t	Write( unsigned handle, char const * pBuffer, int64_t n );
+	virtual int64_t	Seek( unsigned handle, int64_t location );
+	virtual bool	IsPositional() const			{ return m_IsPositional; }
+	virtual int64_t	ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location );
+	virtual int64_t	WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location );
+
+private:
+
+	// Prevent copying
+	MemoryObject( MemoryObject const & );
+	MemoryObject & operator =( MemoryObject const & );
+
+	// Copies blocks from the data at the given location. Returns the number of blocks copied.
+	int64_t CopyOut( char * pBuffer, int64_t n, int64_t location );
+
+	// Copies blocks to the data at the given location. Returns the number of blocks copied.
+	int64_t CopyIn( char const * pBuffer, int64_t n, int64_t location );
+
+	std::vector< char >		m_Data;			// The data
+	int64_t					m_BlockSize;	// Size of a block
+	int64_t					m_Location;		// Current location (in blocks)
+	bool					m_IsPositional;	// True if ReadAt() and WriteAt() are advertised
+	std::mutex				m_Mutex;		// Guards the data, which may be accessed by several threads
+	std::atomic< int64_t >	m_ReadCount;	// Number of calls to Read() and ReadAt()
+	std::atomic< int64_t >	m_WriteCount;	// Number of calls to Write() and WriteAt()
+	std::atomic< int64_t >	m_SeekCount;	// Number of calls to Seek()
+};
+
+
+#endif // !defined( MEMORYOBJECT_H_INCLUDED )
@@ -0,0 +1,125 @@
+#if !defined( SHAREDBLOCKCACHE_H_INCLUDED )
+#define SHAREDBLOCKCACHE_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                   SharedBlockCache.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/SharedBlockCache.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "Buffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+//! A buffered object that caches the blocks of another buffered object for many proxies at once.
+//
+//! Proxies that use the same data (possibly in different threads) are attached to the cache instead of to the
+//! buffered object. Their fills and flushes become copies to and from the cache's pages, so a block is read from the
+//! buffered object once no matter how many proxies fill it, and a block written by one proxy is seen by the others
+//! the next time they fill it. Modified pages are written back when they are evicted or when Flush() is called.
+//!
+//! The memory given to the constructor is divided into pages, each holding the data of one handle at a location that
+//! is a multiple of the page size. The pages are divided among several stripes, each with its own lock, so threads
+//! using different pages rarely wait for each other. Any number of threads can copy from a page at once, but a
+//! thread copying to a page has it to itself. Pages are evicted using the CLOCK algorithm, and a page is never
+//! evicted while it is being used.
+//!
+//! @note	The cache implements ReadAt() and WriteAt(), so the proxies never move the current location of the
+//!			buffered object. If the buffered object does not implement them, the calls to it are serialized.
+//! @note	Each proxy still has its own buffer, so the data in it can become stale until it is filled again.
+//! @note	The proxies flush whole blocks, and the cache does not merge the changes of different proxies to the same
+//!			block. Two proxies that modify different parts of the same block overwrite each other's changes, so
+//!			they must coordinate their writes to a block themselves.
+//! @note	If a page cannot be written back, the data is lost and all subsequent writes fail.
+
+class SharedBlockCache final : public BufferedProxy::BufferedObject
+{
+public:
+
+	//! Constructor
+	SharedBlockCache( BufferedProxy::BufferedObject * pObject,
+					  void * pMemory,
+					  int64_t memorySize,
+					  int64_t pageSize,
+					  int64_t blockSize );
+	virtual ~SharedBlockCache();
+
+	//! Writes back all of the modified pages. Returns false if any of them could not be written.
+	bool Flush();
+
+	//! Returns the number of pages found in the cache.
+	int64_t HitCount() const						{ return m_HitCount.load( std::memory_order_relaxed ); }
+
+	//! Returns the number of pages read from the buffered object (or created, if they were entirely overwritten).
+	int64_t MissCount() const						{ return m_MissCount.load( std::memory_order_relaxed ); }
+
+	//! Returns the number of modified pages written back to the buffered object.
+	int64_t WriteBackCount() const					{ return m_WriteBackCount.load( std::memory_order_relaxed ); }
+
+	// BufferedProxy::BufferedObject overrides
+
+	virtual int64_t	Read( unsigned handle, char * pBuffer, int64_t n );
+	virtual int64_t	Write( unsigned handle, char const * pBuffer, int64_t n );
+	virtual int64_t	Seek( unsigned handle, int64_t location );
+	virtual bool	IsPositional() const			{ return true; }
+	virtual int64_t	ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location );
+	virtual int64_t	WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location );
+
+private:
+
+	struct Page;
+	struct Stripe;
+
+	// Prevent copying
+	SharedBlockCache( SharedBlockCache const & );
+	SharedBlockCache & operator =( SharedBlockCache const & );
+
+	// Returns the stripe holding the page of the given handle at the given location.
+	Stripe & GetStripe( unsigned handle, int64_t location );
+
+	// Finds or loads the page at the given location and pins it. Returns the page's index in the stripe.
+	int Acquire( Stripe & stripe, std::unique_lock< std::mutex > & lock, unsigned handle, int64_t location, bool exclusive, bool fill );
+
+	// Unpins a page.
+	void Release( Stripe & stripe, Page & page, bool exclusive );
+
+	// Frees a page in the stripe (writing it back if necessary). Returns its index, or < 0 if all pages are in use.
+	int Evict( Stripe & stripe, std::unique_lock< std::mutex > & lock );
+
+	// Writes the modified blocks of a page to the buffered object. Returns false if they could not be written.
+	bool WriteBack( Stripe & stripe, std::unique_lock< std::mutex > & lock, Page & page );
+
+	// Reads from the buffered object. Returns the number of blocks read or < 0.
+	int64_t ReadObject( unsigned handle, char * pBuffer, int64_t n, int64_t location );
+
+	// Writes to the buffered object. Returns the number of blocks written or < 0.
+	int64_t WriteObject( unsigned handle, char const * pBuffer, int64_t n, int64_t location );
+
+	BufferedProxy::BufferedObject *	m_pObject;			// The buffered object being cached
+	int64_t							m_BlockSize;		// Size of a block
+	int64_t							m_PageSizeInBlocks;	// Size of a page (in blocks)
+	Stripe *						m_paStripes;		// Stripes
+	int								m_StripeCount;		// Number of stripes
+	std::mutex						m_ObjectMutex;		// Serializes the calls to a buffered object that is not positional
+	std::map< unsigned, int64_t >	m_Locations;		// Current location of each handle for Read() and Write()
+	std::mutex						m_LocationMutex;	// Guards the current locations
+	std::atomic< bool >				m_WriteFailed;		// True if a page could not be written back
+	std::atomic< int64_t >			m_HitCount;			// Number of pages found in the cache
+	std::atomic< int64_t >			m_MissCount;		// Number of pages not found in the cache
+	std::atomic< int64_t >			m_WriteBackCount;	// Number of pages written back
+};
+
+
+#endif // !defined( SHAREDBLOCKCACHE_H_INCLUDED )
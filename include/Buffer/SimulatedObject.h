@@ -0,0 +1,100 @@
+#if !defined( SIMULATEDOBJECT_H_INCLUDED )
+#define SIMULATEDOBJECT_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                   SimulatedObject.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/SimulatedObject.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "Buffer.h"
+
+#include <cstdint>
+#include <mutex>
+#include <random>
+
+//! A buffered object that simulates the performance of a storage device.
+//
+//! The calls are passed on to another buffered object (e.g. a MemoryObject or a DirectFile), and each read or write
+//! is delayed by the time the simulated device would take. Some reads and writes can be made to transfer fewer
+//! blocks than requested, as real devices sometimes do.
+//!
+//! The delay of a read or write is the sum of:
+//!		- a fixed latency,
+//!		- a seek penalty proportional to the distance from the end of the previous read or write, and
+//!		- the time to transfer the data at the device's bandwidth.
+
+class SimulatedObject final : public BufferedProxy::BufferedObject
+{
+public:
+
+	//! Characteristics of the simulated device
+	struct Profile
+	{
+		int64_t	latency;			//!< Time added to every read and write (in ns)
+		int64_t	bandwidth;			//!< Transfer rate (in bytes per second), or 0 if unlimited
+		int64_t	seekPenalty;		//!< Time to move a distance of 1 GiB (in ns)
+		int64_t	maxSeekPenalty;		//!< Maximum time to move any distance (in ns), or 0 if unlimited
+		int64_t	maxBlocks;			//!< Maximum number of blocks transferred by a single call, or 0 if unlimited
+		double	shortRate;			//!< Probability that a read or write transfers fewer blocks than requested
+	};
+
+	//! Returns a profile resembling a hard disk drive.
+	static Profile Hdd();
+
+	//! Returns a profile resembling a storage area network.
+	static Profile San();
+
+	//! Returns a profile resembling an NVMe solid-state drive.
+	static Profile Nvme();
+
+	//! Constructor
+	SimulatedObject( BufferedProxy::BufferedObject * pObject, Profile const & profile, int64_t blockSize, bool sleeps = true );
+	virtual ~SimulatedObject();
+
+	//! Returns the total time that the calls have been delayed (in ns).
+	int64_t SimulatedTime() const;
+
+	// BufferedProxy::BufferedObject overrides
+
+	virtual int64_t	Read( unsigned handle, char * pBuffer, int64_t n );
+	virtual int64_t	Write( unsigned handle, char const * pBuffer, int64_t n );
+	virtual int64_t	Seek( unsigned handle, int64_t location );
+	virtual bool	IsPositional() const;
+	virtual int64_t	ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location );
+	virtual int64_t	WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location );
+
+private:
+
+	// Prevent copying
+	SimulatedObject( SimulatedObject const & );
+	SimulatedObject & operator =( SimulatedObject const & );
+
+	// Determines how many blocks of a transfer are actually transferred.
+	int64_t Shorten( int64_t n );
+
+	// Delays a transfer of the given number of blocks at the given location.
+	void Delay( int64_t location, int64_t n );
+
+	BufferedProxy::BufferedObject *	m_pObject;			// The buffered object being simulated
+	Profile							m_Profile;			// Characteristics of the simulated device
+	int64_t							m_BlockSize;		// Size of a block
+	bool							m_Sleeps;			// If false, delays are only added to the simulated time
+	int64_t							m_Location;			// Current location for Read() and Write() (in blocks)
+	int64_t							m_Head;				// End of the previous transfer (in blocks)
+	int64_t							m_SimulatedTime;	// Total of the delays (in ns)
+	std::mt19937					m_Random;			// Decides which transfers are short
+	mutable std::mutex				m_Mutex;			// Guards the simulation state
+};
+
+
+#endif // !defined( SIMULATEDOBJECT_H_INCLUDED )
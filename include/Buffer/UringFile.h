@@ -0,0 +1,74 @@
+#if !defined( URINGFILE_H_INCLUDED )
+#define URINGFILE_H_INCLUDED
+
+#pragma once
+
+/** @file *//********************************************************************************************************
+
+                                                      UringFile.h
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/UringFile.h#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "DirectFile.h"
+
+#include <cstdint>
+#include <sys/types.h>
+
+//! A file opened for unbuffered I/O whose transfers are submitted through a Linux io_uring.
+//
+//! Each transfer is split into chunks that are submitted together, and up to the queue depth chunks are in flight
+//! at once. Transfers from several threads (e.g. a proxy's read-ahead and write-behind thread and its direct reads
+//! and writes) share the ring, so they are in flight at the same time as well.
+//!
+//! The alignment requirements and CreateProxy() are inherited from DirectFile.
+
+class UringFile final : public DirectFile
+{
+public:
+
+	//! Constructor
+	UringFile( char const * pPath, int oflags, unsigned queueDepth = 32, int64_t chunkSize = 128 * 1024, mode_t mode = 0644 );
+	virtual ~UringFile();
+
+	//! Returns the maximum number of chunks in flight.
+	unsigned QueueDepth() const						{ return m_QueueDepth; }
+
+	// BufferedProxy::BufferedObject overrides
+
+	virtual int64_t	Read( unsigned handle, char * pBuffer, int64_t n );
+	virtual int64_t	Write( unsigned handle, char const * pBuffer, int64_t n );
+	virtual int64_t	ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location );
+	virtual int64_t	WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location );
+
+private:
+
+	struct Ring;
+	struct Request;
+
+	// Prevent copying
+	UringFile( UringFile const & );
+	UringFile & operator =( UringFile const & );
+
+	// Reads or writes blocks at the given location through the ring. Returns the number of blocks transferred or < 0.
+	int64_t Transfer( int fd, char * pBuffer, int64_t n, int64_t location, bool isWrite );
+
+	// Reads or writes blocks at the file's current location, and moves the current location past them.
+	int64_t TransferAtCurrentLocation( int fd, char * pBuffer, int64_t n, bool isWrite );
+
+	// Removes the completions from the ring and updates their requests. Returns true if there were any.
+	bool Reap();
+
+	Ring *		m_pRing;		// The io_uring
+	unsigned	m_QueueDepth;	// Maximum number of chunks in flight
+	int64_t		m_ChunkSize;	// Transfers are split into chunks of this size (in bytes)
+};
+
+
+#endif // !defined( URINGFILE_H_INCLUDED )
@@ -0,0 +1,813 @@
+/*********************************************************************************************************************
+
+                                                    AsyncProxy.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/AsyncProxy.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "AsyncProxy.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	inline bool _IsPowerOf2( int64_t n )
+	{
+		return ( ( n & ( n - 1 ) ) == 0 );
+	}
+
+	inline int64_t _HighestMultiple( int64_t n, int64_t m )
+	{
+		return ( n - n % m );
+	}
+
+	inline int64_t _Gcd( int64_t a, int64_t b )
+	{
+		while ( b != 0 )
+		{
+			int64_t const	t	= a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	inline int64_t _Lcm( int64_t a, int64_t b )
+	{
+		return a / _Gcd( a, b ) * b;
+	}
+
+} // anonymous namespace
+
+
+// A coroutine that is not awaited. It starts when it is resumed and destroys itself when it completes.
+
+struct AsyncExecutor::Detached
+{
+	struct promise_type
+	{
+		Detached			get_return_object()					{ return Detached{ std::coroutine_handle< promise_type >::from_promise( *this ) }; }
+		std::suspend_always	initial_suspend() const noexcept	{ return std::suspend_always(); }
+		std::suspend_never	final_suspend() const noexcept		{ return std::suspend_never(); }
+		void				return_void()						{}
+		void				unhandled_exception()				{ std::terminate(); }
+	};
+
+	std::coroutine_handle< promise_type >	handle;		// The coroutine
+};
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+AsyncExecutor::AsyncExecutor()
+	: m_Work( 0 ),
+	  m_Stop( false )
+{
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @note	Tasks that have not completed are not destroyed.
+
+AsyncExecutor::~AsyncExecutor()
+{
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The executor is notified while the lock is held, because the thread that posted the last job may still be
+//! notifying it after Run() has returned and the executor has been destroyed otherwise.
+
+void AsyncExecutor::Post( std::function< void() > job )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+	m_Jobs.push_back( std::move( job ) );
+	m_Wake.notify_one();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	task	The task. It starts running the next time the executor runs its jobs.
+
+void AsyncExecutor::Spawn( AsyncTask< void > task )
+{
+	{
+		std::lock_guard< std::mutex >	lock( m_Mutex );
+		++m_Work;
+	}
+
+	std::coroutine_handle<> const	h	= Drive( this, std::move( task ) ).handle;
+
+	Post( [h] { h.resume(); } );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The jobs are run on the calling thread. When there are no jobs ready, the thread waits for one to be posted
+//! (e.g. by the completion of a transfer).
+
+void AsyncExecutor::Run()
+{
+	std::unique_lock< std::mutex >	lock( m_Mutex );
+
+	for ( ;; )
+	{
+		m_Wake.wait( lock, [this] { return m_Stop || !m_Jobs.empty() || m_Work == 0; } );
+		if ( m_Stop || m_Jobs.empty() )
+		{
+			break;
+		}
+
+		std::function< void() >	job	= std::move( m_Jobs.front() );
+		m_Jobs.pop_front();
+
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+
+	m_Stop = false;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! This allows the executor to be driven by an existing event loop. Jobs posted by the jobs being run are run too.
+
+int AsyncExecutor::Poll()
+{
+	int	count	= 0;
+
+	std::unique_lock< std::mutex >	lock( m_Mutex );
+
+	while ( !m_Jobs.empty() )
+	{
+		std::function< void() >	job	= std::move( m_Jobs.front() );
+		m_Jobs.pop_front();
+
+		lock.unlock();
+		job();
+		++count;
+		lock.lock();
+	}
+
+	return count;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void AsyncExecutor::Stop()
+{
+	{
+		std::lock_guard< std::mutex >	lock( m_Mutex );
+		m_Stop = true;
+	}
+	m_Wake.notify_all();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+AsyncExecutor::Detached AsyncExecutor::Drive( AsyncExecutor * pExecutor, AsyncTask< void > task )
+{
+	co_await task;
+
+	{
+		std::lock_guard< std::mutex >	lock( pExecutor->m_Mutex );
+		--pExecutor->m_Work;
+	}
+	pExecutor->m_Wake.notify_all();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pObject		The buffered object
+//! @param	threads		Number of background threads (at least 1). Only one is useful if the buffered object is not
+//!						positional.
+
+AsyncProxy::BlockingObjectAdapter::BlockingObjectAdapter( BufferedProxy::BufferedObject * pObject, int threads /* = 1*/ )
+	: m_pObject( pObject ),
+	  m_Quit( false )
+{
+	if ( threads <= 0 )
+	{
+		throw ConstructorFailedException( "The number of threads must be greater than 0." );
+	}
+
+	for ( int i = 0; i < threads; ++i )
+	{
+		m_Threads.emplace_back( &BlockingObjectAdapter::Run, this );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Any transfers still in the queue are done before the threads exit.
+
+AsyncProxy::BlockingObjectAdapter::~BlockingObjectAdapter()
+{
+	{
+		std::lock_guard< std::mutex >	lock( m_Mutex );
+		m_Quit = true;
+	}
+	m_Wake.notify_all();
+
+	for ( size_t i = 0; i < m_Threads.size(); ++i )
+	{
+		m_Threads[ i ].join();
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void AsyncProxy::BlockingObjectAdapter::ReadAsync( unsigned handle, char * pBuffer, int64_t n, int64_t location, Callback done )
+{
+	Post( [this, handle, pBuffer, n, location, done]
+		  {
+			  std::unique_lock< std::mutex >	lock;
+
+			  if ( !m_pObject->IsPositional() )
+			  {
+				  lock = std::unique_lock< std::mutex >( m_ObjectMutex );
+			  }
+
+			  int64_t const	blocksRead	= m_pObject->ReadAt( handle, pBuffer, n, location );
+
+			  if ( lock.owns_lock() )
+			  {
+				  lock.unlock();
+			  }
+
+			  done( blocksRead );
+		  } );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void AsyncProxy::BlockingObjectAdapter::WriteAsync( unsigned handle, char const * pBuffer, int64_t n, int64_t location, Callback done )
+{
+	Post( [this, handle, pBuffer, n, location, done]
+		  {
+			  std::unique_lock< std::mutex >	lock;
+
+			  if ( !m_pObject->IsPositional() )
+			  {
+				  lock = std::unique_lock< std::mutex >( m_ObjectMutex );
+			  }
+
+			  int64_t const	blocksWritten	= m_pObject->WriteAt( handle, pBuffer, n, location );
+
+			  if ( lock.owns_lock() )
+			  {
+				  lock.unlock();
+			  }
+
+			  done( blocksWritten );
+		  } );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void AsyncProxy::BlockingObjectAdapter::Post( std::function< void() > job )
+{
+	{
+		std::lock_guard< std::mutex >	lock( m_Mutex );
+		m_Jobs.push_back( std::move( job ) );
+	}
+	m_Wake.notify_one();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void AsyncProxy::BlockingObjectAdapter::Run()
+{
+	std::unique_lock< std::mutex >	lock( m_Mutex );
+
+	for ( ;; )
+	{
+		m_Wake.wait( lock, [this] { return m_Quit || !m_Jobs.empty(); } );
+		if ( m_Jobs.empty() )
+		{
+			break;
+		}
+
+		std::function< void() >	job	= std::move( m_Jobs.front() );
+		m_Jobs.pop_front();
+
+		lock.unlock();
+		job();
+		lock.lock();
+	}
+}
+
+
+// Awaits a single read or write of the buffered object
+//
+// The awaiting coroutine is resumed by the executor, whichever thread the completion callback is called from. Once
+// the transfer has been started, the awaiter may be destroyed at any moment (the coroutine may already have been
+// resumed), so nothing is done after that.
+
+struct AsyncProxy::Transfer
+{
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend( std::coroutine_handle<> h )
+	{
+		AsyncExecutor * const	pExecutor	= pProxy->m_pExecutor;
+		int64_t * const			pResult		= &result;
+		AsyncObject::Callback	done		= [pExecutor, pResult, h]( int64_t n )
+											  {
+												  *pResult = n;
+												  pExecutor->Post( [h] { h.resume(); } );
+											  };
+
+		if ( isWrite )
+		{
+			pProxy->m_pObject->WriteAsync( pProxy->m_Handle, pBuffer, n, location, std::move( done ) );
+		}
+		else
+		{
+			pProxy->m_pObject->ReadAsync( pProxy->m_Handle, pBuffer, n, location, std::move( done ) );
+		}
+	}
+
+	int64_t await_resume() const noexcept
+	{
+		return result;
+	}
+
+	AsyncProxy *	pProxy;		// The proxy
+	int64_t			location;	// Location of the data in the buffered object (in blocks)
+	char *			pBuffer;	// The data
+	int64_t			n;			// Number of blocks to transfer
+	bool			isWrite;	// True if the data is written
+	int64_t			result;		// Number of blocks transferred, or < 0
+};
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pBuffer		Memory for use by the buffer. The address must be aligned on a @a bufferAlign boundary.
+//! @param	bufferSize	Size of the buffer. It must be a multiple of @a blockSize, @a sectorAlign, and
+//!						@a bufferAlign.
+//! @param	handle		Handle to be passed to the buffered object.
+//! @param	pObject		Interface to the object that fills and flushes the buffer.
+//! @param	pExecutor	Executor that resumes the coroutines awaiting the proxy's operations.
+//! @param	blockSize	The buffered object will always be asked to fill or flush a multiple of this size.
+//! @param	sectorAlign	Locations in the buffered object are always aligned on this boundary. This value must be a
+//!						power of two.
+//! @param	bufferAlign	The buffered object is always asked to fill or flush starting at an memory address aligned
+//!						on this boundary. This value must be a power of two.
+
+AsyncProxy::AsyncProxy( void * pBuffer,
+						int64_t bufferSize,
+						unsigned handle,
+						AsyncObject * pObject,
+						AsyncExecutor * pExecutor,
+						int64_t blockSize		/* = 1*/,
+						unsigned sectorAlign	/* = 1*/,
+						unsigned bufferAlign	/* = 1*/ )
+{
+	if ( blockSize <= 0 )
+	{
+		throw ConstructorFailedException( "The block size must be greater than 0." );
+	}
+
+	if ( !_IsPowerOf2( sectorAlign ) || !_IsPowerOf2( bufferAlign ) )
+	{
+		throw ConstructorFailedException( "The sector alignment and the buffer alignment must be powers of two." );
+	}
+
+	int64_t const	unit	= _Lcm( _Lcm( blockSize, sectorAlign ), bufferAlign );
+
+	if ( bufferSize <= 0 || bufferSize % unit != 0 )
+	{
+		throw ConstructorFailedException( "The buffer size must be a multiple of the block size and the alignments." );
+	}
+
+	if ( ( reinterpret_cast< uintptr_t >( pBuffer ) & ( bufferAlign - 1 ) ) != 0 )
+	{
+		throw ConstructorFailedException( "The buffer must be aligned on a bufferAlign boundary." );
+	}
+
+	m_Handle				= handle;
+	m_paBuffer				= reinterpret_cast< char * >( pBuffer );
+	m_BufferSize			= bufferSize;
+	m_BufferSizeInBlocks	= bufferSize / blockSize;
+	m_pObject				= pObject;
+	m_pExecutor				= pExecutor;
+	m_BlockSize				= blockSize;
+	m_FlushGranule			= unit / blockSize;
+	m_Point					= 0;
+	m_BufferLoc				= 0;
+	m_DataSize				= 0;
+	m_IsFilled				= false;
+	m_IsDirty				= false;
+	m_DirtyBegin			= 0;
+	m_DirtyEnd				= 0;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @note	Any unwritten data is discarded, since it can't be written without waiting (see FlushAsync()).
+
+AsyncProxy::~AsyncProxy()
+{
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pDst	Location to which data is to be copied from the buffer
+//! @param	n		Number of bytes to read
+//!
+//! @return		A task whose result is the number of bytes actually read. If the data is already in the buffer, the
+//!				task has completed already.
+
+AsyncTask< int64_t > AsyncProxy::ReadAsync( void * pDst, int64_t n )
+{
+	assert( n >= 0 );
+
+	if ( n <= RemainingReadAmount() )
+	{
+		memcpy( pDst, m_paBuffer + m_Point, static_cast< size_t >( n ) );
+		m_Point += n;
+		return AsyncTask< int64_t >( n );
+	}
+
+	return ReadThroughBuffer( reinterpret_cast< char * >( pDst ), n );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pSrc	Location of the data to be copied to the buffer
+//! @param	n		Number of bytes to write
+//!
+//! @return		A task whose result is the number of bytes actually written. If the data fits in the buffer, the task
+//!				has completed already.
+
+AsyncTask< int64_t > AsyncProxy::WriteAsync( void const * pSrc, int64_t n )
+{
+	assert( n >= 0 );
+
+	if ( m_IsFilled && n <= RemainingWriteSpace() )
+	{
+		CopyIn( reinterpret_cast< char const * >( pSrc ), n );
+		return AsyncTask< int64_t >( n );
+	}
+
+	return WriteThroughBuffer( reinterpret_cast< char const * >( pSrc ), n );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	location	New location (in bytes)
+//!
+//! @return		A task whose result is the new location, or < 0 if unwritten data could not be written. If the
+//!				location is in the buffer, the task has completed already.
+
+AsyncTask< int64_t > AsyncProxy::SeekAsync( int64_t location )
+{
+	if ( location < 0 )
+	{
+		return AsyncTask< int64_t >( -1 );
+	}
+
+	int64_t const	offset	= location - m_BufferLoc * m_BlockSize;
+
+	if ( offset >= 0 && offset < m_BufferSize )
+	{
+		m_Point = offset;
+		return AsyncTask< int64_t >( location );
+	}
+
+	return MoveTo( location );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @return		A task whose result is false if the unwritten data could not all be written. If there is no unwritten
+//!				data, the task has completed already.
+
+AsyncTask< bool > AsyncProxy::FlushAsync()
+{
+	if ( !m_IsDirty )
+	{
+		return AsyncTask< bool >( true );
+	}
+
+	return FlushBuffer();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+AsyncTask< int64_t > AsyncProxy::ReadThroughBuffer( char * pDst, int64_t n )
+{
+	int64_t	total	= 0;
+
+	while ( n > 0 )
+	{
+		if ( !m_IsFilled )
+		{
+			co_await Fill();
+		}
+
+		int64_t const	available	= m_DataSize * m_BlockSize - m_Point;
+
+		if ( available > 0 )
+		{
+			int64_t const	size	= std::min( n, available );
+
+			memcpy( pDst, m_paBuffer + m_Point, static_cast< size_t >( size ) );
+			m_Point += size;
+			pDst += size;
+			total += size;
+			n -= size;
+		}
+
+		// If the buffer isn't full, then the end of the data has been reached.
+
+		else if ( m_DataSize < m_BufferSizeInBlocks )
+		{
+			break;
+		}
+
+		// Otherwise, the buffer has been used up, so move it to the data that follows.
+
+		else
+		{
+			int64_t const	location	= co_await MoveTo( m_BufferLoc * m_BlockSize + m_Point );
+
+			if ( location < 0 )
+			{
+				break;
+			}
+		}
+	}
+
+	co_return total;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+AsyncTask< int64_t > AsyncProxy::WriteThroughBuffer( char const * pSrc, int64_t n )
+{
+	int64_t	total	= 0;
+
+	while ( n > 0 )
+	{
+		if ( m_Point >= m_BufferSize )
+		{
+			int64_t const	location	= co_await MoveTo( m_BufferLoc * m_BlockSize + m_Point );
+
+			if ( location < 0 )
+			{
+				break;
+			}
+		}
+
+		// The buffer must be filled first unless the data will replace all of it.
+
+		if ( !m_IsFilled )
+		{
+			if ( m_Point == 0 && n >= m_BufferSize )
+			{
+				m_IsFilled = true;
+				m_DataSize = 0;
+			}
+			else
+			{
+				co_await Fill();
+			}
+		}
+
+		int64_t const	size	= std::min( n, m_BufferSize - m_Point );
+
+		CopyIn( pSrc, size );
+		pSrc += size;
+		total += size;
+		n -= size;
+	}
+
+	co_return total;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+AsyncTask< int64_t > AsyncProxy::MoveTo( int64_t location )
+{
+	if ( m_IsDirty )
+	{
+		bool const	flushed	= co_await FlushBuffer();
+
+		if ( !flushed )
+		{
+			co_return -1;
+		}
+	}
+
+	m_BufferLoc	= _HighestMultiple( location / m_BlockSize, m_FlushGranule );
+	m_Point		= location - m_BufferLoc * m_BlockSize;
+	m_DataSize	= 0;
+	m_IsFilled	= false;
+
+	co_return location;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The blocks before the first modified block are written too if necessary to keep the alignment. They hold the
+//! same data as the buffered object, so writing them again is harmless.
+
+AsyncTask< bool > AsyncProxy::FlushBuffer()
+{
+	assert( m_IsDirty );
+
+	int64_t const	first			= _HighestMultiple( m_DirtyBegin / m_BlockSize, m_FlushGranule );
+	int64_t const	last			= std::min( ( m_DirtyEnd + m_BlockSize - 1 ) / m_BlockSize, m_DataSize );
+	int64_t const	blocksToFlush	= std::max< int64_t >( last - first, 0 );
+
+	int64_t const	blocksFlushed	= co_await TransferBlocks( m_BufferLoc + first, m_paBuffer + first * m_BlockSize, blocksToFlush, true );
+
+	if ( blocksFlushed != blocksToFlush )
+	{
+		co_return false;
+	}
+
+	m_IsDirty = false;
+	co_return true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the buffer can't be filled, it is treated as empty.
+
+AsyncTask< void > AsyncProxy::Fill()
+{
+	assert( !m_IsDirty );
+
+	int64_t const	blocksRead	= co_await TransferBlocks( m_BufferLoc, m_paBuffer, m_BufferSizeInBlocks, false );
+
+	m_DataSize	= std::max< int64_t >( blocksRead, 0 );
+	m_IsFilled	= true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The buffered object may transfer fewer blocks than requested, so the transfer is continued until it is complete
+//! or nothing more can be transferred.
+
+AsyncTask< int64_t > AsyncProxy::TransferBlocks( int64_t location, char * pBuffer, int64_t n, bool isWrite )
+{
+	int64_t	total	= 0;
+
+	while ( total < n )
+	{
+		int64_t const	transferred	= co_await Transfer{ this, location + total, pBuffer + total * m_BlockSize, n - total, isWrite, 0 };
+
+		if ( transferred <= 0 )
+		{
+			co_return ( total > 0 ) ? total : transferred;
+		}
+
+		total += transferred;
+	}
+
+	co_return total;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the write extends the data in the buffer, the memory between the end of the data and the start of the write,
+//! and the rest of the last block written, is cleared. It holds no data of the buffered object, and it would
+//! otherwise be flushed with the new data.
+
+void AsyncProxy::CopyIn( char const * pSrc, int64_t n )
+{
+	if ( n <= 0 )
+	{
+		return;
+	}
+
+	int64_t const	dataEnd	= m_DataSize * m_BlockSize;
+	int64_t const	end		= m_Point + n;
+
+	if ( end > dataEnd )
+	{
+		int64_t const	blockEnd	= ( end + m_BlockSize - 1 ) / m_BlockSize * m_BlockSize;
+
+		if ( m_Point > dataEnd )
+		{
+			memset( m_paBuffer + dataEnd, 0, static_cast< size_t >( m_Point - dataEnd ) );
+		}
+
+		memset( m_paBuffer + end, 0, static_cast< size_t >( blockEnd - end ) );
+	}
+
+	memcpy( m_paBuffer + m_Point, pSrc, static_cast< size_t >( n ) );
+
+	if ( m_IsDirty )
+	{
+		m_DirtyBegin	= std::min( m_DirtyBegin, m_Point );
+		m_DirtyEnd		= std::max( m_DirtyEnd, m_Point + n );
+	}
+	else
+	{
+		m_IsDirty		= true;
+		m_DirtyBegin	= m_Point;
+		m_DirtyEnd		= m_Point + n;
+	}
+
+	m_Point += n;
+	m_DataSize = std::max( m_DataSize, ( m_Point + m_BlockSize - 1 ) / m_BlockSize );
+}
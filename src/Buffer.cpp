@@ -13,11 +13,24 @@
 
 #include "Buffer.h"
 
+#include "BufferPool.h"
+
 #include "Misc/exceptions.h"
 #include "Misc/assert.h"
 #include "Misc/max.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace
 {
@@ -26,29 +39,45 @@ namespace
 		return ( ( n & ( n - 1 ) ) == 0 );
 	}
 
-	inline bool _IsMultipleOf( int n, int m )
+	inline bool _IsMultipleOf( int64_t n, int64_t m )
 	{
 		return ( n % m == 0 );
 	}
 
-	inline bool	_IsAligned( unsigned n, unsigned align )
+	inline bool	_IsAligned( uint64_t n, uint64_t align )
 	{
 		assert_power_of_two( align + 1 );
 		return ( ( n & align ) == 0 );
 	}
 
-	inline int _HighestMultiple( int n, int m )
+	inline int64_t _HighestMultiple( int64_t n, int64_t m )
 	{
 		return ( n - n % m );
 	}
 
-	inline int _HighestMultiplePowerOf2( int n, int align )
+	inline int64_t _HighestMultiplePowerOf2( int64_t n, int64_t align )
 	{
 		assert_power_of_two( align + 1 );
 		return ( n & ~align );
 	}
 
-	inline int _Pad( int n, int m )
+	inline int64_t _Gcd( int64_t a, int64_t b )
+	{
+		while ( b != 0 )
+		{
+			int64_t const	r	= a % b;
+			a = b;
+			b = r;
+		}
+		return a;
+	}
+
+	inline int64_t _Lcm( int64_t a, int64_t b )
+	{
+		return a / _Gcd( a, b ) * b;
+	}
+
+	inline int64_t _Pad( int64_t n, int64_t m )
 	{
 		return _HighestMultiple( n, m ) + m;
 	}
@@ -59,8 +88,369 @@ namespace
 		return ( ( n + align ) & ~align );
 	}
 
+	// A background thread that executes jobs in the order in which they are posted
+
+	class Worker
+	{
+	public:
+
+		Worker()
+			: m_Busy( false ),
+			  m_Quit( false )
+		{
+			m_Thread = std::thread( &Worker::Run, this );
+		}
+
+		// Any jobs still in the queue are executed before the thread exits.
+		~Worker()
+		{
+			{
+				std::lock_guard< std::mutex >	lock( m_Mutex );
+				m_Quit = true;
+			}
+			m_Wake.notify_one();
+			m_Thread.join();
+		}
+
+		// Queues a job to be executed by the worker thread.
+		void Post( std::function< void() > job )
+		{
+			{
+				std::lock_guard< std::mutex >	lock( m_Mutex );
+				m_Jobs.push_back( std::move( job ) );
+			}
+			m_Wake.notify_one();
+		}
+
+		// Returns when all queued jobs have been executed.
+		void Drain()
+		{
+			std::unique_lock< std::mutex >	lock( m_Mutex );
+			m_Idle.wait( lock, [this] { return m_Jobs.empty() && !m_Busy; } );
+		}
+
+	private:
+
+		void Run()
+		{
+			std::unique_lock< std::mutex >	lock( m_Mutex );
+
+			for ( ;; )
+			{
+				m_Wake.wait( lock, [this] { return m_Quit || !m_Jobs.empty(); } );
+				if ( m_Jobs.empty() )
+				{
+					break;
+				}
+
+				std::function< void() >	job	= std::move( m_Jobs.front() );
+				m_Jobs.pop_front();
+
+				m_Busy = true;
+				lock.unlock();
+				job();
+				lock.lock();
+				m_Busy = false;
+
+				m_Idle.notify_all();
+			}
+		}
+
+		std::deque< std::function< void() > >	m_Jobs;		// Queued jobs
+		std::mutex								m_Mutex;	// Guards the queue
+		std::condition_variable					m_Wake;		// Signaled when a job is queued or the thread should quit
+		std::condition_variable					m_Idle;		// Signaled when a job has been executed
+		bool									m_Busy;		// True while a job is being executed
+		bool									m_Quit;		// True if the thread should exit once the queue is empty
+		std::thread								m_Thread;	// The worker thread
+	};
+
+} // anonymous namespace
+
+
+// Background I/O state
+//
+// Read-ahead: Each slot holds a buffer that is being (or has been) filled with the data following the buffer.
+// Write-behind: Full buffers are queued to be written and replaced by spare buffers.
+//
+// All background I/O is done in order by a single worker thread.
+
+struct BufferedProxy::Async
+{
+	enum SlotState
+	{
+		SLOT_FREE,				// Not in use
+		SLOT_QUEUED,			// Waiting to be read by the worker
+		SLOT_READING,			// Being read by the worker
+		SLOT_READY				// Contains the data at its location
+	};
+
+	struct Slot
+	{
+		char *		pBuffer;	// The slot's buffer
+		int64_t		location;	// Location of the data in the buffered object (in blocks)
+		int64_t		size;		// Number of blocks read
+		SlotState	state;		// State of the slot
+		unsigned	request;	// Incremented each time a read is queued, so a job only does the read it was queued for
+	};
+
+	struct PendingWrite
+	{
+		char *		pBuffer;	// The buffer being written
+		int64_t		first;		// Index of the first block to write in the buffer
+		int64_t		location;	// Location of the data in the buffered object (in blocks)
+		int64_t		size;		// Number of blocks to write
+	};
+
+	Async()
+		: writeBehindDepth( 0 ),
+		  writeFailed( false )
+	{
+	}
+
+	std::vector< Slot >			slots;				// Read-ahead buffers
+	std::vector< char * >		spareBuffers;		// Buffers available to replace a buffer that is being written
+	std::vector< PendingWrite >	pendingWrites;		// Buffers queued to be written
+	int							writeBehindDepth;	// Maximum number of buffers being written at once (0 if disabled)
+	std::atomic< bool >			writeFailed;		// True if a background write has failed since the last Flush()
+	std::mutex					mutex;				// Guards the slots and the write-behind state
+	std::condition_variable		changed;			// Signaled when a slot has been read or a buffer has been written
+	std::mutex					backendMutex;		// Serializes access to the buffered object
+	Worker						worker;				// Does the I/O (declared last so it is stopped first)
+};
+
+
+// Page cache (CF_RANDOM_ACCESS)
+//
+// The memory given to the constructor is divided into fixed-size pages, each holding the data at a location that is
+// a multiple of the page size. The current page is the buffer, and its state is kept in the proxy's members while it
+// is current. Pages are evicted using the CLOCK algorithm.
+
+struct BufferedProxy::Cache
+{
+	struct Page
+	{
+		char *		pBuffer;		// The page's memory
+		int64_t		location;		// Location of the page in the buffered object (in blocks), or < 0 if unused
+		int64_t		dataSize;		// Size of the data in the page (in blocks)
+		bool		isDirty;		// True if the page contains data that has not been flushed yet
+		int64_t		dirtyBegin;		// Start of the data that has not been flushed yet (in bytes), if dirty
+		int64_t		dirtyEnd;		// End of the data that has not been flushed yet (in bytes), if dirty
+		bool		isReferenced;	// True if the page has been used since the clock hand last passed it
+	};
+
+	std::vector< Page >		pages;			// Pages
+	std::map< int64_t, int >	index;			// Maps the location of each cached page to its index
+	int						current;		// Index of the current page
+	int						hand;			// Index of the next page to consider for eviction
+	char *					pMemory;		// Memory given to the constructor
+	int64_t					memorySize;		// Size of the memory given to the constructor
+};
+
+// Default number of pages in the page cache
+static int const	DEFAULT_PAGE_COUNT	= 64;
+
+
+// Access pattern detection (CF_ADAPTIVE)
+//
+// Each read is compared with the previous one. A read near the end of the previous one (close enough that a full
+// buffer would hold both) suggests sequential access, a read the same distance from the previous one as that one
+// was from the one before suggests strided access, and anything else suggests random access. The mode changes once
+// enough consecutive reads suggest the same thing, so a stray read does not change it.
+
+struct BufferedProxy::Pattern
+{
+	enum Mode
+	{
+		MODE_SEQUENTIAL,		// Fill whole buffers and read ahead the buffers that follow
+		MODE_STRIDED,			// Fill only what is needed and read ahead at the stride
+		MODE_RANDOM				// Fill only what is needed and don't read ahead
+	};
+
+	Mode		mode;			// Current mode
+	Mode		candidate;		// Mode suggested by the most recent reads
+	int			count;			// Number of consecutive reads suggesting the candidate
+	int64_t		lastStart;		// Location of the previous read (in bytes)
+	int64_t		lastEnd;		// End of the previous read (in bytes)
+	int64_t		stride;			// Distance from the read before the previous read to the previous read (in bytes)
+};
+
+// Number of consecutive reads that must suggest a mode before the mode changes
+static int const	PATTERN_THRESHOLD	= 2;
+
+
+// Parallel direct transfers
+//
+// A large direct transfer is divided into chunks at consecutive locations. The calling thread transfers the first
+// chunk and the worker threads transfer the rest, each worker taking every Nth chunk. The buffered object must be
+// positional, since the chunks are transferred at the same time.
+
+struct BufferedProxy::Parallel
+{
+	// Transfers n blocks in chunks. The function is called with the offset and size of each chunk (in blocks) and
+	// returns the number of blocks transferred or < 0. Returns the number of consecutive blocks transferred or < 0.
+	int64_t Transfer( int64_t n, std::function< int64_t( int64_t, int64_t ) > const & transfer )
+	{
+		int64_t const				count		= ( n + chunkSize - 1 ) / chunkSize;
+		std::vector< int64_t >		results( static_cast< size_t >( count ) );
+		int64_t						remaining	= count - 1;
+		std::mutex					mutex;
+		std::condition_variable		done;
+
+		for ( int64_t i = 1; i < count; ++i )
+		{
+			int64_t const	first	= i * chunkSize;
+			int64_t const	size	= std::min( chunkSize, n - first );
+
+			workers[ static_cast< size_t >( ( i - 1 ) % workers.size() ) ].Post(
+				[ &, i, first, size ]
+				{
+					int64_t const	result	= transfer( first, size );
+
+					// Notify while holding the lock, because the waiting thread destroys the condition variable as
+					// soon as it sees that nothing remains.
+
+					std::lock_guard< std::mutex >	lock( mutex );
+					results[ static_cast< size_t >( i ) ] = result;
+					--remaining;
+					done.notify_one();
+				} );
+		}
+
+		results[ 0 ] = transfer( 0, std::min( chunkSize, n ) );
+
+		{
+			std::unique_lock< std::mutex >	lock( mutex );
+			done.wait( lock, [&] { return remaining == 0; } );
+		}
+
+		// The result is the data transferred before the first chunk that failed or came up short.
+
+		int64_t	total	= 0;
+
+		for ( int64_t i = 0; i < count; ++i )
+		{
+			int64_t const	result	= results[ static_cast< size_t >( i ) ];
+
+			if ( result < 0 )
+			{
+				return ( total > 0 ) ? total : result;
+			}
+
+			total += result;
+
+			if ( result < std::min( chunkSize, n - i * chunkSize ) )
+			{
+				break;
+			}
+		}
+
+		return total;
+	}
+
+	std::deque< Worker >	workers;		// Worker threads
+	int64_t					chunkSize;		// Size of each chunk (in blocks)
+};
+
+
+// Performance statistics
+//
+// The counters are updated by the background thread too, so they are atomic. Their order doesn't matter, so
+// relaxed operations are used.
+
+struct BufferedProxy::Counters
+{
+	Counters()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		fills.store( 0, std::memory_order_relaxed );
+		readAheadHits.store( 0, std::memory_order_relaxed );
+		flushes.store( 0, std::memory_order_relaxed );
+		seeks.store( 0, std::memory_order_relaxed );
+		seekHits.store( 0, std::memory_order_relaxed );
+		directBytesRead.store( 0, std::memory_order_relaxed );
+		directBytesWritten.store( 0, std::memory_order_relaxed );
+		copiedBytesRead.store( 0, std::memory_order_relaxed );
+		copiedBytesWritten.store( 0, std::memory_order_relaxed );
+		rejectedReads.store( 0, std::memory_order_relaxed );
+		rejectedWrites.store( 0, std::memory_order_relaxed );
+		patternChanges.store( 0, std::memory_order_relaxed );
+		parallelTransfers.store( 0, std::memory_order_relaxed );
+
+		for ( int i = 0; i < Stats::CALLBACK_COUNT; ++i )
+		{
+			for ( int j = 0; j < Stats::LATENCY_BUCKETS; ++j )
+			{
+				latency[ i ][ j ].store( 0, std::memory_order_relaxed );
+			}
+		}
+	}
+
+	std::atomic< int64_t >	fills;
+	std::atomic< int64_t >	readAheadHits;
+	std::atomic< int64_t >	flushes;
+	std::atomic< int64_t >	seeks;
+	std::atomic< int64_t >	seekHits;
+	std::atomic< int64_t >	directBytesRead;
+	std::atomic< int64_t >	directBytesWritten;
+	std::atomic< int64_t >	copiedBytesRead;
+	std::atomic< int64_t >	copiedBytesWritten;
+	std::atomic< int64_t >	rejectedReads;
+	std::atomic< int64_t >	rejectedWrites;
+	std::atomic< int64_t >	patternChanges;
+	std::atomic< int64_t >	parallelTransfers;
+	std::atomic< int64_t >	latency[ Stats::CALLBACK_COUNT ][ Stats::LATENCY_BUCKETS ];
+};
+
+namespace
+{
+	// Measures the time until it is destroyed and counts it in a latency histogram
+
+	class CallbackTimer
+	{
+	public:
+
+		explicit CallbackTimer( std::atomic< int64_t > * pHistogram )
+			: m_pHistogram( pHistogram ),
+			  m_Start( std::chrono::steady_clock::now() )
+		{
+		}
+
+		~CallbackTimer()
+		{
+			int64_t const	ns		= std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - m_Start ).count();
+			int				bucket	= 0;
+
+			while ( bucket < BufferedProxy::Stats::LATENCY_BUCKETS - 1 && ( ns >> ( bucket + 1 ) ) != 0 )
+			{
+				++bucket;
+			}
+
+			m_pHistogram[ bucket ].fetch_add( 1, std::memory_order_relaxed );
+		}
+
+	private:
+
+		std::atomic< int64_t > *				m_pHistogram;	// Histogram to update
+		std::chrono::steady_clock::time_point	m_Start;		// When the timer was created
+	};
+
 } // anonymous namespace
 
+// Statistics are collected with these macros so that they can be compiled out.
+
+#if defined( BUFFER_NO_STATS )
+#define BUFFER_COUNT( counter, n )
+#define BUFFER_TIME( callback )
+#else // defined( BUFFER_NO_STATS )
+#define BUFFER_COUNT( counter, n )	m_pCounters->counter.fetch_add( n, std::memory_order_relaxed )
+#define BUFFER_TIME( callback )		CallbackTimer const	timer( m_pCounters->latency[ Stats::callback ] )
+#endif // defined( BUFFER_NO_STATS )
+
 
 /********************************************************************************************************************/
 /*																													*/
@@ -81,13 +471,120 @@ namespace
 //!								aligned on this boundary. This value must be a power of two.
 
 BufferedProxy::BufferedProxy( void * pBuffer,
-			  int bufferSize,
+			  int64_t bufferSize,
 			  unsigned handle,
 			  BufferedObject * pBufferedObject,
 			  unsigned flags,
-			  int blockSize				/* = 1*/,
+			  int64_t blockSize				/* = 1*/,
 			  unsigned sectorAlign		/* = 1*/,
 			  unsigned bufferAlign		/* = 1*/ )
+{
+	Initialize( pBuffer, bufferSize, handle, pBufferedObject, flags, blockSize, sectorAlign, bufferAlign );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The buffer is allocated from a pool and returned to it when the proxy is destroyed, so proxies that are created
+//! and destroyed frequently reuse the same buffers. The parameters are the same as above.
+//!
+//! @param	pPool	Pool from which the buffer is allocated, or 0 to use the default pool (see BufferPool::Default()).
+//!					The pool must exist as long as the proxy does.
+
+BufferedProxy::BufferedProxy( int64_t bufferSize,
+			  unsigned handle,
+			  BufferedObject * pBufferedObject,
+			  unsigned flags,
+			  int64_t blockSize				/* = 1*/,
+			  unsigned sectorAlign		/* = 1*/,
+			  unsigned bufferAlign		/* = 1*/,
+			  BufferPool * pPool			/* = 0*/ )
+{
+	if ( !_IsPowerOf2( bufferAlign ) )
+	{
+		throw ConstructorFailedException( "The buffer alignment must be a power of two." );
+	}
+
+	BufferPool * const	pool	= ( pPool != 0 ) ? pPool : &BufferPool::Default();
+	void * const		pBuffer	= ( bufferSize > 0 ) ? pool->Allocate( bufferSize, bufferAlign ) : 0;
+
+	if ( pBuffer == 0 )
+	{
+		throw ConstructorFailedException( "Unable to allocate the buffer." );
+	}
+
+	try
+	{
+		Initialize( pBuffer, bufferSize, handle, pBufferedObject, flags, blockSize, sectorAlign, bufferAlign );
+	}
+	catch ( ... )
+	{
+		pool->Free( pBuffer, bufferSize, bufferAlign );
+		throw;
+	}
+
+	m_pPool			= pool;
+	m_pOwnedBuffer	= pBuffer;
+	m_OwnedSize		= bufferSize;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Any background I/O started by the other proxy is finished first. The other proxy is left empty, and it can only
+//! be destroyed or assigned to.
+
+BufferedProxy::BufferedProxy( BufferedProxy && other )
+{
+	MoveFrom( other );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+BufferedProxy::~BufferedProxy()
+{
+	Destroy();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Any unwritten data in this proxy is flushed first (as if it were destroyed). Any background I/O started by the
+//! other proxy is finished first. The other proxy is left empty, and it can only be destroyed or assigned to.
+
+BufferedProxy & BufferedProxy::operator =( BufferedProxy && other )
+{
+	if ( &other != this )
+	{
+		Destroy();
+		MoveFrom( other );
+	}
+
+	return *this;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::Initialize( void * pBuffer,
+								int64_t bufferSize,
+								unsigned handle,
+								BufferedObject * pBufferedObject,
+								unsigned flags,
+								int64_t blockSize,
+								unsigned sectorAlign,
+								unsigned bufferAlign )
 {
 	// The block alignment must be a power of two
 
@@ -96,6 +593,20 @@ BufferedProxy::BufferedProxy( void * pBuffer,
 		throw ConstructorFailedException( "The sector alignment must be a power of two." );
 	}
 
+	// Reading only and writing only are mutually exclusive
+
+	if ( ( flags & CF_READ_ONLY ) != 0 && ( flags & CF_WRITE_ONLY ) != 0 )
+	{
+		throw ConstructorFailedException( "CF_READ_ONLY and CF_WRITE_ONLY are mutually exclusive." );
+	}
+
+	// The access pattern is either assumed to be random or it is detected
+
+	if ( ( flags & CF_RANDOM_ACCESS ) != 0 && ( flags & CF_ADAPTIVE ) != 0 )
+	{
+		throw ConstructorFailedException( "CF_RANDOM_ACCESS and CF_ADAPTIVE are mutually exclusive." );
+	}
+
 	// The buffer alignment must be a power of two
 
 	if ( !_IsPowerOf2( bufferAlign ) )
@@ -112,7 +623,7 @@ BufferedProxy::BufferedProxy( void * pBuffer,
 
 	// The buffer must be aligned on a bufferAlign boundary
 
-	if ( !_IsAligned( reinterpret_cast< unsigned long >( pBuffer ), bufferAlign-1 ) )
+	if ( !_IsAligned( reinterpret_cast< uintptr_t >( pBuffer ), bufferAlign-1 ) )
 	{
 		throw ConstructorFailedException( "The buffer must be aligned on a bufferAlign boundary." );
 	}
@@ -122,7 +633,7 @@ BufferedProxy::BufferedProxy( void * pBuffer,
 	// must be true.
 	//
 
-	if ( static_cast< int >( sectorAlign ) > blockSize )
+	if ( static_cast< int64_t >( sectorAlign ) > blockSize )
 	{
 		if ( !_IsMultipleOf( sectorAlign, blockSize ) )
 		{
@@ -142,7 +653,8 @@ BufferedProxy::BufferedProxy( void * pBuffer,
 	m_BufferSize			= bufferSize;
 	m_BufferSizeInBlocks	= bufferSize / blockSize;
 	m_pBufferedObject		= pBufferedObject;
-	m_Flags					= flags;
+	m_IsPositional			= pBufferedObject->IsPositional();
+	m_Flags					= ( ( flags & CF_WRITE_ONLY ) != 0 ) ? flags | CF_NO_FILLS : flags;	// Write-only never fills
 	m_BlockSize				= blockSize;
 	m_SectorAlign			= sectorAlign - 1;		// Store the mask
 	m_BufferAlign			= bufferAlign - 1;		// Store the mask
@@ -150,6 +662,51 @@ BufferedProxy::BufferedProxy( void * pBuffer,
 	m_BufferLoc				= 0;
 	m_DataSize				= 0;
 	m_IsDirty				= false;
+	m_DirtyBegin			= 0;
+	m_DirtyEnd				= 0;
+	m_FlushGranule			= _Lcm( _Lcm( blockSize, sectorAlign ), bufferAlign ) / blockSize;
+	m_IsPartial				= false;
+	m_pAsync				= 0;
+	m_pCache				= 0;
+	m_pPattern				= 0;
+	m_pParallel				= 0;
+	m_pPool					= 0;
+	m_pOwnedBuffer			= 0;
+	m_OwnedSize				= 0;
+#if defined( BUFFER_NO_STATS )
+	m_pCounters				= 0;
+#else // defined( BUFFER_NO_STATS )
+	m_pCounters				= new Counters;
+#endif // defined( BUFFER_NO_STATS )
+
+	// If random access is expected, the buffer is divided into pages and the pages are cached.
+
+	if ( ( flags & CF_RANDOM_ACCESS ) != 0 )
+	{
+		int64_t const	unit		= _Lcm( _Lcm( blockSize, sectorAlign ), bufferAlign );	// Smallest valid page size
+		int64_t		pageSize	= _HighestMultiple( bufferSize / DEFAULT_PAGE_COUNT, unit );
+
+		if ( pageSize == 0 )
+		{
+			pageSize = ( unit <= bufferSize ) ? unit : bufferSize;
+		}
+
+		SetPageSize( pageSize );
+	}
+
+	// If the access pattern is to be detected, it is assumed to be sequential until the reads suggest otherwise.
+
+	if ( ( flags & CF_ADAPTIVE ) != 0 )
+	{
+		m_pPattern = new Pattern;
+
+		m_pPattern->mode		= Pattern::MODE_SEQUENTIAL;
+		m_pPattern->candidate	= Pattern::MODE_SEQUENTIAL;
+		m_pPattern->count		= 0;
+		m_pPattern->lastStart	= 0;
+		m_pPattern->lastEnd		= 0;
+		m_pPattern->stride		= 0;
+	}
 }
 
 
@@ -158,9 +715,85 @@ BufferedProxy::BufferedProxy( void * pBuffer,
 /*																													*/
 /********************************************************************************************************************/
 
-BufferedProxy::~BufferedProxy()
+//! The buffer allocated from the pool (if any) is freed last, since it may have been exchanged with a buffer used
+//! by the background I/O.
+
+void BufferedProxy::Destroy()
 {
 	Flush();
+	DiscardReadAhead( 0, -1 );
+	delete m_pAsync;
+	delete m_pCache;
+	delete m_pPattern;
+	delete m_pParallel;
+	delete m_pCounters;
+
+	if ( m_pPool != 0 )
+	{
+		m_pPool->Free( m_pOwnedBuffer, m_OwnedSize, m_BufferAlign + 1 );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The background jobs refer to the proxy that started them, so they must all be finished before its state can be
+//! taken over.
+
+void BufferedProxy::MoveFrom( BufferedProxy & other )
+{
+	if ( other.m_pAsync != 0 )
+	{
+		other.m_pAsync->worker.Drain();
+	}
+
+	m_Handle				= other.m_Handle;
+	m_paBuffer				= other.m_paBuffer;
+	m_BufferSize			= other.m_BufferSize;
+	m_BufferSizeInBlocks	= other.m_BufferSizeInBlocks;
+	m_pBufferedObject		= other.m_pBufferedObject;
+	m_IsPositional			= other.m_IsPositional;
+	m_BlockSize				= other.m_BlockSize;
+	m_SectorAlign			= other.m_SectorAlign;
+	m_BufferAlign			= other.m_BufferAlign;
+	m_Flags					= other.m_Flags;
+	m_Point					= other.m_Point;
+	m_BufferLoc				= other.m_BufferLoc;
+	m_DataSize				= other.m_DataSize;
+	m_IsDirty				= other.m_IsDirty;
+	m_DirtyBegin			= other.m_DirtyBegin;
+	m_DirtyEnd				= other.m_DirtyEnd;
+	m_FlushGranule			= other.m_FlushGranule;
+	m_IsPartial				= other.m_IsPartial;
+	m_pAsync				= other.m_pAsync;
+	m_pCache				= other.m_pCache;
+	m_pPattern				= other.m_pPattern;
+	m_pParallel				= other.m_pParallel;
+	m_pCounters				= other.m_pCounters;
+	m_pPool					= other.m_pPool;
+	m_pOwnedBuffer			= other.m_pOwnedBuffer;
+	m_OwnedSize				= other.m_OwnedSize;
+
+	// The other proxy no longer has a buffer or anything else to release.
+
+	other.m_paBuffer			= 0;
+	other.m_BufferSize			= 0;
+	other.m_BufferSizeInBlocks	= 0;
+	other.m_Point				= 0;
+	other.m_BufferLoc			= 0;
+	other.m_DataSize			= 0;
+	other.m_IsDirty				= false;
+	other.m_IsPartial			= false;
+	other.m_pAsync				= 0;
+	other.m_pCache				= 0;
+	other.m_pPattern			= 0;
+	other.m_pParallel			= 0;
+	other.m_pCounters			= 0;
+	other.m_pPool				= 0;
+	other.m_pOwnedBuffer		= 0;
+	other.m_OwnedSize			= 0;
 }
 
 
@@ -171,12 +804,30 @@ BufferedProxy::~BufferedProxy()
 //! @param	pDst	Location to which data is to be copied from the buffer
 //! @param	n		Number of bytes to read
 //!
-//! @return		The number of bytes actually read.
+//! @return		The number of bytes actually read, or < 0 if reading is not allowed (CF_WRITE_ONLY).
 
-int BufferedProxy::Read( void * pDst, int n )
+int64_t BufferedProxy::Read( void * pDst, int64_t n )
 {
-	int	bytesToRead;
-	int	totalRead			= 0;
+	int64_t	bytesToRead;
+	int64_t	totalRead			= 0;
+
+	if ( ( m_Flags & CF_WRITE_ONLY ) != 0 )
+	{
+		BUFFER_COUNT( rejectedReads, 1 );
+		return -1;
+	}
+
+	if ( m_pPattern != 0 )
+	{
+		DetectPattern( m_BufferLoc * m_BlockSize + m_Point, n );
+	}
+
+	// If a seek left the current location in the middle of an empty buffer, then the buffer must be filled first.
+
+	if ( m_DataSize == 0 && m_Point > 0 )
+	{
+		Load( m_Point + n );
+	}
 
 	// First, read what is already available in the buffer (if any)
 
@@ -191,39 +842,74 @@ int BufferedProxy::Read( void * pDst, int n )
 	// At this point, the read is done or it has reached the end of the buffer.
 	//
 	// Next, if the remaining amount to read is greater than or equal to the buffer size, then read as many
-	// buffer-sized blocks as possible.  
+	// whole blocks as possible.
 
 	if ( n >= m_BufferSize )
 	{
 		// About to do fills, so a flush is needed.
 
-		Flush();
+		Retire();
 
-		// If the CF_NO_DIRECT_IO flag is not set and the destination buffer is aligned, read the data directly
-		// into the destination buffer.
+		// If the destination buffer is misaligned by whole sectors, then read the head through the buffer so that
+		// the rest can be read directly.
 
-		if (    ( m_Flags & CF_NO_DIRECT_IO ) == 0
-			 && _IsAligned( reinterpret_cast< unsigned long >( pDst ), m_BufferAlign ) )
+		int64_t const	bounce	= GetBounceSize( pDst, n );
+
+		if ( bounce > 0 )
 		{
-			m_BufferLoc += m_DataSize;							// Move the buffer to the next data to read in the buffered object
+			Advance();
 
-			int const	blocksToRead = _HighestMultiple( n, m_BufferSize ) / m_BlockSize;	// Read a multiple of the buffer size
+			// The head can only be read into the buffer if the buffer starts at the data to be read.
 
-			int const	blocksRead	= m_pBufferedObject->Read( m_Handle,
-															   reinterpret_cast< char * >( pDst ),
-															   blocksToRead );
+			if ( m_Point == 0 )
+			{
+				m_DataSize = FillBlocks( 0, bounce / m_BlockSize );
 
-			int const	bytesRead	= blocksRead * m_BlockSize;
+				bytesToRead = std::min( bounce, RemainingReadAmount() );
+				if ( bytesToRead > 0 )
+				{
+					CopyOut( &pDst, bytesToRead );
+					totalRead += bytesToRead;
+					n -= bytesToRead;
+				}
+			}
+		}
 
-			pDst = reinterpret_cast< char * >( pDst ) + bytesRead;
+		// If the CF_NO_DIRECT_IO flag is not set and the destination buffer is aligned, read the data directly
+		// into the destination buffer. The data to be read must follow the data in the buffer, which is not the
+		// case if the buffer could not be moved to it (because it is not on a flush boundary).
+
+		if (    ( m_Flags & CF_NO_DIRECT_IO ) == 0
+			 && _IsAligned( reinterpret_cast< uintptr_t >( pDst ), m_BufferAlign )
+			 && m_Point == m_DataSize * m_BlockSize )
+		{
+			int64_t const	location	= m_BufferLoc + m_DataSize;	// The next data to read in the buffered object
+
+			int64_t const	blocksToRead = _HighestMultiple( n / m_BlockSize, m_FlushGranule );	// Read whole blocks, keeping the alignment
+
+			DiscardReadAhead( location, blocksToRead );
+
+			// If the buffer is read-only, nothing can have been written, so the cached pages are already in sync.
+
+			if ( ( m_Flags & CF_READ_ONLY ) == 0 )
+			{
+				WaitForWriteBehind( location, blocksToRead );
+				SyncPages( location, blocksToRead, false );
+			}
+
+			int64_t const	blocksRead	= std::max< int64_t >( ReadDirect( location, reinterpret_cast< char * >( pDst ), blocksToRead ), 0 );
+
+			int64_t const	bytesRead	= blocksRead * m_BlockSize;
+
+			BUFFER_COUNT( directBytesRead, bytesRead );
+
+			pDst = reinterpret_cast< char * >( pDst ) + bytesRead;
 			totalRead += bytesRead;
 			n -= bytesRead;
 
 			// The buffer must be resynched.
 
-			m_BufferLoc += blocksRead;
-			m_Point = 0;
-			m_DataSize = 0;
+			MoveTo( location + blocksRead );
 		}
 
 		// Otherwise, read the data a buffer at time until less than a full buffer is needed or until the end of
@@ -233,20 +919,27 @@ int BufferedProxy::Read( void * pDst, int n )
 		{
 			while ( n >= m_BufferSize )
 			{
-				// Load the buffer
+				// Load the buffer (unless it is already cached)
 
-				m_BufferLoc += m_DataSize;		// Move the buffer location to the data to be filled
-				Fill();
+				Advance();		// Move the buffer location to the data to be filled
+				if ( m_DataSize == 0 )
+				{
+					FillBuffer();
+				}
 
 				// Copy a full buffer
 
-				CopyOut( &pDst, m_DataSize * m_BlockSize );
-				totalRead += m_DataSize * m_BlockSize;
-				n -= m_DataSize * m_BlockSize;
+				bytesToRead = RemainingReadAmount();
+				if ( bytesToRead > 0 )
+				{
+					CopyOut( &pDst, bytesToRead );
+					totalRead += bytesToRead;
+					n -= bytesToRead;
+				}
 
 				// If the end of the data was reached, then abort
 
-				if ( m_DataSize < m_BufferSize )
+				if ( m_DataSize < m_BufferSizeInBlocks )
 				{
 					break;
 				}
@@ -260,12 +953,18 @@ int BufferedProxy::Read( void * pDst, int n )
 
 	if ( n > 0 )
 	{
-		// About to do a fill, so a flush is needed.
+		// If the data in the buffer has been used up, then bump the location of the buffer and fill it (unless it
+		// is already cached). About to do a fill, so a flush is needed.
 
-		Flush();
+		if ( RemainingReadAmount() <= 0 )
+		{
+			Advance();
+		}
 
-		m_BufferLoc += m_DataSize;	// Bump the location of the buffer
-		Fill();
+		if ( m_DataSize == 0 )
+		{
+			Load( m_Point + n );
+		}
 
 		bytesToRead = std::min( n, RemainingReadAmount() );
 		if ( bytesToRead > 0 )
@@ -289,16 +988,34 @@ int BufferedProxy::Read( void * pDst, int n )
 //! @param	pSrc	Location from which data is to be copied to the buffer.
 //! @param	n		Number of bytes to copy
 //!
-//! @return		The actual number of bytes written
+//! @return		The actual number of bytes written, or < 0 if writing is not allowed (CF_READ_ONLY) or data written
+//!				in the background was lost.
 
-int BufferedProxy::Write( void const * pSrc, int n )
+int64_t BufferedProxy::Write( void const * pSrc, int64_t n )
 {
-	int			totalWritten	= 0;
+	int64_t		totalWritten	= 0;
+
+	if ( ( m_Flags & CF_READ_ONLY ) != 0 )
+	{
+		BUFFER_COUNT( rejectedWrites, 1 );
+		return -1;
+	}
+
+	// If data written in the background was lost, then report the error (until Flush() has reported it).
+
+	if ( m_pAsync != 0 && m_pAsync->writeFailed.load() )
+	{
+		return -1;
+	}
+
+	// If blocks are about to be partially overwritten, then they must be filled first.
+
+	FillEdges( m_Point + std::min( n, RemainingWriteSpace() ) );
 
 	// First, write to the remaining space available in the buffer (if any)
 
 	{
-		int	const	bytesToWrite	= std::min( n, RemainingWriteSpace() );
+		int64_t	const	bytesToWrite	= std::min( n, RemainingWriteSpace() );
 
 		if ( bytesToWrite > 0 )
 		{
@@ -310,39 +1027,54 @@ int BufferedProxy::Write( void const * pSrc, int n )
 
 	// At this point the write is done or the buffer is full.
 	//
-	// Next, if the remaining amount to write is greater than or equal to the buffer size, then write the largest
-	// multiple of the buffer size as possible.  
+	// Next, if the remaining amount to write is greater than or equal to the buffer size, then write as many
+	// whole blocks as possible.
 
 	if ( n >= m_BufferSize )
 	{
 		// The buffer is full, so it must be flushed first.
 
-		Flush();
-		m_BufferLoc += m_DataSize;
+		Advance();
+
+		// If the source buffer is misaligned by whole sectors, then write the head through the buffer so that the
+		// rest can be written directly. The head's blocks are entirely overwritten, so they are not filled.
+
+		int64_t const	bounce	= GetBounceSize( pSrc, n );
+
+		if ( bounce > 0 )
+		{
+			CopyIn( &pSrc, bounce );
+			totalWritten += bounce;
+			n -= bounce;
+		}
 
 		// If the CF_NO_DIRECT_IO flag is not set and the source buffer is aligned, write the data directly
 		// from the source buffer.
 
 		if ( ( m_Flags & CF_NO_DIRECT_IO ) == 0 &&
-			 _IsAligned( reinterpret_cast< unsigned long >( pSrc ), m_BufferAlign ) )
+			 _IsAligned( reinterpret_cast< uintptr_t >( pSrc ), m_BufferAlign ) )
 		{
-			int const	blocksToWrite	= _HighestMultiple( n, m_BufferSize ) / m_BlockSize;	// Write a multiple of the buffer size
+			int64_t const	location		= m_BufferLoc + m_Point / m_BlockSize;	// Follows the head (if any)
+
+			int64_t const	blocksToWrite	= _HighestMultiple( n / m_BlockSize, m_FlushGranule );	// Write whole blocks, keeping the alignment
 
-			int const	blocksWritten	= m_pBufferedObject->Write( m_Handle,
-																	reinterpret_cast< char const * >( pSrc ),
-																	blocksToWrite );
+			DiscardReadAhead( location, blocksToWrite );
+			WaitForWriteBehind( location, blocksToWrite );
+			SyncPages( location, blocksToWrite, true );
 
-			int const	bytesWritten	= blocksWritten * m_BlockSize;
+			int64_t const	blocksWritten	= std::max< int64_t >( WriteDirect( location, reinterpret_cast< char const * >( pSrc ), blocksToWrite ), 0 );
+
+			int64_t const	bytesWritten	= blocksWritten * m_BlockSize;
+
+			BUFFER_COUNT( directBytesWritten, bytesWritten );
 
 			pSrc = reinterpret_cast< char const * >( pSrc ) + bytesWritten;
 			totalWritten += bytesWritten;
 			n -= bytesWritten;
 
-			// The buffer must be resynched.
+			// The buffer must be resynched. This also flushes the head (if any).
 
-			m_BufferLoc += blocksWritten;
-			m_Point = 0;
-			m_DataSize = 0;
+			MoveTo( location + blocksWritten );
 		}
 
 		// Otherwise, write the data a buffer at time until less than a full buffer is left to write.
@@ -357,10 +1089,9 @@ int BufferedProxy::Write( void const * pSrc, int n )
 				totalWritten += m_BufferSize;
 				n -= m_BufferSize;
 
-				// Flush the buffer
+				// Flush the buffer and move it to the data that follows
 
-				Flush();
-				m_BufferLoc += m_BufferSizeInBlocks;		// Move the buffer location to the data to be filled
+				Advance();
 			}
 		}
 	}
@@ -368,21 +1099,22 @@ int BufferedProxy::Write( void const * pSrc, int n )
 
 	// Write the rest through the buffer
 	//
-	// At this point the buffer is empty and needs to be filled.
+	// At this point the buffer is either full or empty.
 
 	while ( n > 0 )
 	{
-		// The buffer is full, so it must be flushed.
-
-		Flush();
+		// If the buffer is full, it must be flushed and moved to the data that follows.
 
-		// If we are 
-		if ( n < m_BufferSize && ( m_Flags & CF_NO_FILLS ) == 0 )
+		if ( m_Point >= m_BufferSize )
 		{
-			Fill();
+			Advance();
 		}
 
-		int const bytesToWrite = std::min( n, RemainingWriteSpace() );
+		// If blocks are going to be partially overwritten, then they must be filled first.
+
+		FillEdges( m_Point + std::min( n, RemainingWriteSpace() ) );
+
+		int64_t const bytesToWrite = std::min( n, RemainingWriteSpace() );
 		if ( bytesToWrite <= 0 )
 		{
 			break;	// Reached the end of the data
@@ -394,7 +1126,7 @@ int BufferedProxy::Write( void const * pSrc, int n )
 
 		if ( m_Point >= m_BufferSize )
 		{
-			Flush();
+			Advance();
 		}
 	}
 
@@ -407,34 +1139,200 @@ int BufferedProxy::Write( void const * pSrc, int n )
 /*																													*/
 /********************************************************************************************************************/
 
+//! The data is not copied. Instead, the returned address points directly into the buffer. If there is no data
+//! remaining in the buffer, the buffer is filled first. The data must be consumed with Consume() in order to
+//! move the current location past it.
+//!
+//! @param	ppData	Where to store the address of the data.
+//!
+//! @return		The number of bytes available at the address, 0 if the end of the data has been reached, or < 0 if
+//!				reading is not allowed (CF_WRITE_ONLY).
+//!
+//! @warning	The address is only valid until the next call to any other member function other than Consume().
+
+int64_t BufferedProxy::Peek( void const ** ppData )
+{
+	if ( ( m_Flags & CF_WRITE_ONLY ) != 0 )
+	{
+		BUFFER_COUNT( rejectedReads, 1 );
+		return -1;
+	}
+
+	// If a seek left the current location in the middle of an empty buffer, then the buffer must be filled first.
+
+	if ( m_DataSize == 0 && m_Point > 0 )
+	{
+		FillBuffer();
+	}
+
+	// If the data in the buffer has been used up, then bump the location of the buffer and fill it (unless it is
+	// already cached).
+
+	if ( RemainingReadAmount() <= 0 )
+	{
+		Advance();
+	}
+
+	if ( m_DataSize == 0 )
+	{
+		FillBuffer();
+	}
+
+	*ppData = &m_paBuffer[ m_Point ];
+
+	return std::max< int64_t >( RemainingReadAmount(), 0 );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	n	Number of bytes to consume. It must not be more than the amount returned by the last call to Peek().
+
+void BufferedProxy::Consume( int64_t n )
+{
+	assert( n >= 0 && m_Point + n <= m_DataSize * m_BlockSize );
+
+	m_Point += n;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Data is written directly to the returned space instead of being copied with Write(). If the buffer is full, it
+//! is flushed first. Unless CF_NO_FILLS is set, an empty buffer is filled first because the space may only be
+//! partially written. The data must be committed with Commit() in order to be flushed.
+//!
+//! @param	ppSpace		Where to store the address of the space.
+//!
+//! @return		The number of bytes of space available at the address, or < 0 if there is an error.
+//!
+//! @warning	The address is only valid until the next call to any other member function other than Commit().
+
+int64_t BufferedProxy::Reserve( void ** ppSpace )
+{
+	if ( ( m_Flags & CF_READ_ONLY ) != 0 )
+	{
+		BUFFER_COUNT( rejectedWrites, 1 );
+		return -1;
+	}
+
+	// If data written in the background was lost, then report the error (until Flush() has reported it).
+
+	if ( m_pAsync != 0 && m_pAsync->writeFailed.load() )
+	{
+		return -1;
+	}
+
+	// If the buffer is full, it must be flushed and moved to the data that follows.
+
+	if ( RemainingWriteSpace() <= 0 )
+	{
+		Advance();
+	}
+
+	// The space might only be partially overwritten, so an empty buffer must be filled first.
+
+	if ( ( m_Flags & CF_NO_FILLS ) == 0 )
+	{
+		if ( m_DataSize == 0 )
+		{
+			FillBuffer();
+		}
+		else if ( m_IsPartial )
+		{
+			m_DataSize += FillBlocks( m_DataSize, m_BufferSizeInBlocks - m_DataSize );
+			m_IsPartial = false;
+		}
+	}
+
+	*ppSpace = &m_paBuffer[ m_Point ];
+
+	return RemainingWriteSpace();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	n	Number of bytes written. It must not be more than the amount returned by the last call to Reserve().
+
+void BufferedProxy::Commit( int64_t n )
+{
+	assert( n >= 0 && m_Point + n <= m_BufferSize );
+
+	// Mark the data as dirty
+
+	MarkDirty( m_Point, m_Point + n );
+
+	m_Point += n;
+
+	// If the size of the data in the buffer is growing, then update the size.
+
+	if ( m_Point > m_DataSize * m_BlockSize )
+	{
+		m_DataSize = ( m_Point + m_BlockSize-1 ) / m_BlockSize;
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the location is not in the buffer, the buffer is flushed and moved, but it is not filled until it is needed.
 //!
 //! @param	location	Where to put the current location (specified as the number of bytes from the beginning).
 
-int BufferedProxy::Seek( int location )
+int64_t BufferedProxy::Seek( int64_t location )
 {
+	BUFFER_COUNT( seeks, 1 );
+
 	// If the seek location is already in the buffer, then just move the index
 
 	if ( location >= m_BufferLoc * m_BlockSize && location < ( m_BufferLoc + m_DataSize ) * m_BlockSize )
 	{
+		BUFFER_COUNT( seekHits, 1 );
 		m_Point = location - m_BufferLoc * m_BlockSize;
 	}
 	else
 	{
 		// Flush the buffer before seeking
 
-		Flush();
+		Retire();
 
 		// Seek to the new location
 		//
 		// Note that the result of the seek is not guaranteed to be the intended location. This can happen if the
 		// intended location is before the start of the data or after the end.
+		//
+		// If the pages are cached, the buffered object is not involved unless the page is not in the cache. If the
+		// buffered object supports positional I/O, it has no current location, so it is not involved either.
+
+		int64_t const	alignedLocation	= _HighestMultiplePowerOf2( location, m_SectorAlign );	// The start of the buffer must be aligned
+		int64_t		blockLocation	= alignedLocation / m_BlockSize;
+
+		if ( m_pCache == 0 && !m_IsPositional )
+		{
+			std::unique_lock< std::mutex >	lock;
+
+			if ( m_pAsync != 0 )
+			{
+				lock = std::unique_lock< std::mutex >( m_pAsync->backendMutex );
+			}
 
-		int const	alignedLocation	= _HighestMultiplePowerOf2( location, m_SectorAlign );	// The start of the buffer must be aligned
-		m_BufferLoc	= m_pBufferedObject->Seek( m_Handle, alignedLocation / m_BlockSize );
+			BUFFER_TIME( CALLBACK_SEEK );
+			blockLocation = m_pBufferedObject->Seek( m_Handle, blockLocation );
+		}
 
-		// Fill the buffer
+		MoveTo( blockLocation );
 
-		Fill();
+		// The buffer is not filled until data is read from it or a block in it is partially overwritten (see
+		// FillEdges()), so a seek followed by another seek or by a write of whole blocks reads nothing.
 
 		// Point to the seek location in the buffer
 		//
@@ -445,7 +1343,7 @@ int BufferedProxy::Seek( int location )
 		{
 		}
 
-		m_Point += location - m_BufferLoc * m_BlockSize;			// ...and the seek location may be in the middle
+		m_Point = location - m_BufferLoc * m_BlockSize;			// ...and the seek location may be in the middle
 	}
 
 	return location;
@@ -457,31 +1355,75 @@ int BufferedProxy::Seek( int location )
 /*																													*/
 /********************************************************************************************************************/
 
-void BufferedProxy::Flush()
+//! Only the blocks that have been modified since the buffer was last flushed are written (see GetFlushRange()).
+//!
+//! If a buffer written in the background could not be written since the last flush, its data is lost and false is
+//! returned. The error is cleared once it has been reported, so Write() and Reserve() succeed again. If the data in
+//! the buffer (or a cached page) could not be written, it remains modified and the next flush tries again.
+//!
+//! @return		True if all of the data has been written
+//!
+//! @note	The destructor flushes the buffer but can't report an error, so call Flush() first if the result matters.
+
+bool BufferedProxy::Flush()
 {
-	if ( m_IsDirty && m_DataSize > 0 )
+	// If the buffer is read-only, nothing is ever written.
+
+	if ( ( m_Flags & CF_READ_ONLY ) != 0 )
+	{
+		return true;
+	}
+
+	// Wait for the buffers that are being written in the background, and report (and clear) any failure.
+
+	bool	succeeded	= WaitForWriteBehind( 0, -1 );
+
+	if ( m_pAsync != 0 )
 	{
-		int		seekValue;
+		m_pAsync->writeFailed = false;
+	}
 
+	if ( m_IsDirty && m_DataSize > 0 )
+	{
 		assert( _IsAligned( m_BufferLoc * m_BlockSize, m_SectorAlign ) );
 
-		// Seek to the proper location and send the data to the buffered object. Reset the dirty flag if all the
-		// data was written.
+		// Send the modified blocks to the buffered object. Reset the dirty flag if they were all written.
+
+		int64_t	first;
+		int64_t	blocksToFlush;
+
+		GetFlushRange( m_DirtyBegin, m_DirtyEnd, m_DataSize, &first, &blocksToFlush );
+
+		DiscardReadAhead( m_BufferLoc + first, blocksToFlush );
+
+		BUFFER_COUNT( flushes, 1 );
+
+		int64_t const	blocksFlushed	= WriteBlocks( m_BufferLoc + first, m_paBuffer + first * m_BlockSize, blocksToFlush );
 
-		seekValue = m_pBufferedObject->Seek( m_Handle, m_BufferLoc );
-		if ( seekValue == m_BufferLoc )
+		if ( blocksFlushed == blocksToFlush )
 		{
-			int const	blocksToFlush	= m_DataSize;
+			m_IsDirty = false;
+		}
+		else
+		{
+			succeeded = false;
+		}
+	}
 
-			int const	blocksFlushed	= m_pBufferedObject->Write( m_Handle, m_paBuffer, blocksToFlush );
+	// Flush the rest of the cached pages
 
-			if ( blocksFlushed == m_DataSize )
+	if ( m_pCache != 0 )
+	{
+		for ( size_t i = 0; i < m_pCache->pages.size(); ++i )
+		{
+			if ( static_cast< int >( i ) != m_pCache->current && !FlushPage( static_cast< int >( i ) ) )
 			{
-				m_IsDirty = false;
+				succeeded = false;
 			}
-
 		}
 	}
+
+	return succeeded;
 }
 
 
@@ -489,25 +1431,54 @@ void BufferedProxy::Flush()
 /*																													*/
 /********************************************************************************************************************/
 
+//! The buffer is reread from the buffered object and the current location is moved to the start of the buffer.
 //!
 //! @warning	Any data in the buffer that has not been flushed will be overwritten.
 
 void BufferedProxy::Fill()
+{
+	FillBuffer();
+	m_Point = 0;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The current location is not changed.
+//!
+//! @warning	Any data in the buffer that has not been flushed will be overwritten.
+
+void BufferedProxy::FillBuffer()
 {
 	if ( ( m_Flags & CF_NO_FILLS ) == 0 )
 	{
-		int		seekValue;
+		// If the data has already been read ahead, then just swap in that buffer. Otherwise, read the data from
+		// the buffered object.
+
+		BUFFER_COUNT( fills, 1 );
 
-		// Seek to the proper location and read the data from the buffered object.
+		m_IsPartial = false;
 
-		seekValue = m_pBufferedObject->Seek( m_Handle, m_BufferLoc );
-		if ( seekValue == m_BufferLoc )
+		if ( m_pAsync == 0 || m_pCache != 0 || !TakeReadAhead() )
 		{
-			m_DataSize = m_pBufferedObject->Read( m_Handle, m_paBuffer, m_BufferSizeInBlocks );
+			WaitForWriteBehind( m_BufferLoc, m_BufferSizeInBlocks );
+			m_DataSize = std::max< int64_t >( ReadBlocks( m_BufferLoc, m_paBuffer, m_BufferSizeInBlocks ), 0 );
+		}
+		else
+		{
+			BUFFER_COUNT( readAheadHits, 1 );
 		}
-	}
 
-	m_Point = 0;
+		// Start reading the data that follows, unless the end of the data has been reached or the reads are random.
+
+		if (    m_pAsync != 0 && m_pCache == 0 && !m_pAsync->slots.empty() && m_DataSize == m_BufferSizeInBlocks
+			 && ( m_pPattern == 0 || m_pPattern->mode != Pattern::MODE_RANDOM ) )
+		{
+			ScheduleReadAhead();
+		}
+	}
 }
 
 
@@ -515,19 +1486,56 @@ void BufferedProxy::Fill()
 /*																													*/
 /********************************************************************************************************************/
 
-int BufferedProxy::RemainingReadAmount() const
+//! While the data in the buffer is being consumed, the data that follows it is read into additional buffers by a
+//! background thread. When the buffer is filled and the data has already been read ahead, the buffers are swapped
+//! instead of waiting for the buffered object. Read-ahead buffers are discarded when the location moves elsewhere
+//! or when the buffered object is written to.
+//!
+//! @param	pBuffers	Memory for the read-ahead buffers. It must hold @a depth buffers of the size given to the
+//!						constructor, and the address must be aligned on the buffer alignment boundary. The memory
+//!						must remain valid until read-ahead is disabled or the proxy is destroyed. The buffer given
+//!						to the constructor and the read-ahead buffers may be exchanged, so all of the memory must
+//!						remain valid as long as the proxy exists.
+//! @param	depth		Number of buffers to read ahead. If the depth is 0, read-ahead is disabled.
+//!
+//! @note	The buffered object is accessed from a background thread, but never concurrently.
+
+void BufferedProxy::SetReadAhead( void * pBuffers, int depth )
 {
-	return m_DataSize * m_BlockSize - m_Point;
-}
+	assert( depth >= 0 );
+	assert( depth == 0 || _IsAligned( reinterpret_cast< uintptr_t >( pBuffers ), m_BufferAlign ) );
 
+	if ( m_pAsync != 0 )
+	{
+		// Reads that are queued still refer to the slots, so they must be finished before the slots are replaced.
 
-/********************************************************************************************************************/
-/*																													*/
-/********************************************************************************************************************/
+		DiscardReadAhead( 0, -1 );
+		m_pAsync->worker.Drain();
+		m_pAsync->slots.clear();
+	}
+	else if ( depth > 0 )
+	{
+		m_pAsync = new Async;
+	}
 
-int BufferedProxy::RemainingWriteSpace() const
-{
-	return m_BufferSizeInBlocks * m_BlockSize - m_Point;
+	for ( int i = 0; i < depth; ++i )
+	{
+		Async::Slot	slot;
+
+		slot.pBuffer	= reinterpret_cast< char * >( pBuffers ) + i * m_BufferSize;
+		slot.location	= 0;
+		slot.size		= 0;
+		slot.state		= Async::SLOT_FREE;
+		slot.request	= 0;
+
+		m_pAsync->slots.push_back( slot );
+	}
+
+	if ( m_pAsync != 0 && m_pAsync->slots.empty() && m_pAsync->writeBehindDepth == 0 )
+	{
+		delete m_pAsync;
+		m_pAsync = 0;
+	}
 }
 
 
@@ -535,19 +1543,49 @@ int BufferedProxy::RemainingWriteSpace() const
 /*																													*/
 /********************************************************************************************************************/
 
-void BufferedProxy::CopyOut( void * * ppDst, int n )
+//! When the buffer is full, it is handed to a background thread to be written, and writing continues in a spare
+//! buffer instead of waiting for the buffered object. If all of the spare buffers are being written, then writing
+//! waits until one of them is done. Flush() waits until all of the buffers have been written.
+//!
+//! @param	pBuffers	Memory for the spare buffers. It must hold @a depth buffers of the size given to the
+//!						constructor, and the address must be aligned on the buffer alignment boundary. The buffer
+//!						given to the constructor and the spare buffers may be exchanged, so all of the memory must
+//!						remain valid as long as the proxy exists.
+//! @param	depth		Maximum number of buffers being written in the background at once. If the depth is 0,
+//!						write-behind is disabled.
+//!
+//! @note	If a background write fails, the data is lost, and Write() and Reserve() fail until Flush() reports the error.
+
+void BufferedProxy::SetWriteBehind( void * pBuffers, int depth )
 {
-	assert( m_Point + n <= m_DataSize * m_BlockSize );
+	assert( depth >= 0 );
+	assert( depth == 0 || _IsAligned( reinterpret_cast< uintptr_t >( pBuffers ), m_BufferAlign ) );
 
-	void * const	pDst	= *ppDst;	// Convenience
+	if ( m_pAsync != 0 )
+	{
+		WaitForWriteBehind( 0, -1 );
+		m_pAsync->spareBuffers.clear();
+	}
+	else if ( depth > 0 )
+	{
+		m_pAsync = new Async;
+	}
 
-	// Copy from the buffer
-	memcpy( pDst, &m_paBuffer[ m_Point ], n );
+	for ( int i = 0; i < depth; ++i )
+	{
+		m_pAsync->spareBuffers.push_back( reinterpret_cast< char * >( pBuffers ) + i * m_BufferSize );
+	}
 
-	// Bump the pointers
+	if ( m_pAsync != 0 )
+	{
+		m_pAsync->writeBehindDepth = depth;
 
-	m_Point += n;
-	*ppDst = reinterpret_cast< char * >( pDst ) + n;
+		if ( m_pAsync->slots.empty() && depth == 0 )
+		{
+			delete m_pAsync;
+			m_pAsync = 0;
+		}
+	}
 }
 
 
@@ -555,30 +1593,1170 @@ void BufferedProxy::CopyOut( void * * ppDst, int n )
 /*																													*/
 /********************************************************************************************************************/
 
-void BufferedProxy::CopyIn( void const * * ppSrc, int n )
+//! The page size can only be set if the CF_RANDOM_ACCESS flag was given to the constructor. The memory given to
+//! the constructor is divided into as many pages as will fit. By default, the memory is divided into 64 pages (or
+//! as many as possible if the pages would be too small). Any unwritten data is flushed first.
+//!
+//! @param	pageSize	Size of each page. It must be a multiple of the block size, the sector alignment, and the
+//!						buffer alignment, and it must not be larger than the memory given to the constructor.
+//!
+//! @note	Reads and writes that are at least as large as a page normally bypass the cache (see CF_NO_DIRECT_IO).
+//! @note	Read-ahead and write-behind are not used when the pages are cached.
+
+void BufferedProxy::SetPageSize( int64_t pageSize )
 {
-	assert( m_Point + n <= m_BufferSize );
+	assert( ( m_Flags & CF_RANDOM_ACCESS ) != 0 );
 
-	void const * const	pSrc	= *ppSrc;	// Convenience
+	Flush();
 
-	// Copy to the buffer
+	char * const	pMemory		= ( m_pCache != 0 ) ? m_pCache->pMemory : m_paBuffer;
+	int64_t const	memorySize	= ( m_pCache != 0 ) ? m_pCache->memorySize : m_BufferSize;
+	int64_t const	location	= m_BufferLoc * m_BlockSize + m_Point;
 
-	memcpy( &m_paBuffer[ m_Point ], pSrc, n );
+	assert( pageSize > 0 && pageSize <= memorySize );
+	assert( _IsMultipleOf( pageSize, m_BlockSize ) );
+	assert( _IsMultipleOf( pageSize, m_SectorAlign + 1 ) );
+	assert( _IsMultipleOf( pageSize, m_BufferAlign + 1 ) );
 
-	// Bump pointers
+	delete m_pCache;
+	m_pCache = new Cache;
 
-	m_Point += n;
-	*ppSrc = reinterpret_cast< char const * >( pSrc ) + n;
+	m_pCache->pages.resize( memorySize / pageSize );
+	m_pCache->current		= 0;
+	m_pCache->hand			= 0;
+	m_pCache->pMemory		= pMemory;
+	m_pCache->memorySize	= memorySize;
 
-	// Mark the buffer as dirty
+	for ( size_t i = 0; i < m_pCache->pages.size(); ++i )
+	{
+		Cache::Page &	page	= m_pCache->pages[ i ];
+
+		page.pBuffer		= pMemory + i * pageSize;
+		page.location		= -1;
+		page.dataSize		= 0;
+		page.isDirty		= false;
+		page.dirtyBegin		= 0;
+		page.dirtyEnd		= 0;
+		page.isReferenced	= false;
+	}
 
-	m_IsDirty = true;
+	m_BufferSize			= pageSize;
+	m_BufferSizeInBlocks	= pageSize / m_BlockSize;
 
-	// If the size of the data in the buffer is growing, then update the size.
+	// The first page becomes the current page, containing the current location.
 
-	if ( m_Point > m_DataSize * m_BlockSize )
-	{
-		m_DataSize = ( m_Point + m_BlockSize-1 ) / m_BlockSize;
-	}
+	int64_t const	blockLocation	= location / m_BlockSize;
+	int64_t const	pageLocation	= blockLocation - blockLocation % m_BufferSizeInBlocks;
+	Cache::Page &	first			= m_pCache->pages[ 0 ];
+
+	first.location	= pageLocation;
+	m_pCache->index[ pageLocation ] = 0;
+
+	m_paBuffer	= first.pBuffer;
+	m_BufferLoc	= pageLocation;
+	m_DataSize	= 0;
+	m_IsDirty	= false;
+	m_IsPartial	= false;
+	m_Point		= location - pageLocation * m_BlockSize;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Reads and writes that go directly between the caller's memory and the buffered object (see CF_NO_DIRECT_IO)
+//! are divided into chunks if they are at least twice the chunk size, and the chunks are transferred at the same
+//! time by the calling thread and the worker threads. This lets a buffered object that can handle many requests at
+//! once (such as a striped array) do so.
+//!
+//! @param	threads		Number of worker threads. If the number is 0, transfers are not divided.
+//! @param	chunkSize	Size of each chunk. It is rounded down to a multiple of the block size, the sector
+//!						alignment, and the buffer alignment (but not below the smallest such multiple).
+//!
+//! @note	The buffered object must implement ReadAt() and WriteAt() (see BufferedObject::IsPositional()).
+//!			Otherwise, transfers are not divided.
+//! @note	If a chunk comes up short or fails, the amount transferred is the amount before that chunk. When writing,
+//!			the chunks following it may have been written anyway.
+
+void BufferedProxy::SetParallelTransfers( int threads, int64_t chunkSize )
+{
+	assert( threads >= 0 );
+	assert( threads == 0 || m_IsPositional );
+	assert( threads == 0 || chunkSize > 0 );
+
+	delete m_pParallel;
+	m_pParallel = 0;
+
+	if ( threads > 0 && m_IsPositional )
+	{
+		m_pParallel = new Parallel;
+
+		m_pParallel->chunkSize = std::max( _HighestMultiple( chunkSize / m_BlockSize, m_FlushGranule ), m_FlushGranule );
+
+		for ( int i = 0; i < threads; ++i )
+		{
+			m_pParallel->workers.emplace_back();
+		}
+	}
+}
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pStats	Where to store the statistics.
+//!
+//! @note	The values are not captured atomically as a group, so they may be slightly inconsistent while
+//!			background I/O is in progress.
+
+void BufferedProxy::GetStats( Stats * pStats ) const
+{
+	memset( pStats, 0, sizeof( *pStats ) );
+
+	if ( m_pCounters == 0 )
+	{
+		return;
+	}
+
+	pStats->fills				= m_pCounters->fills.load( std::memory_order_relaxed );
+	pStats->readAheadHits		= m_pCounters->readAheadHits.load( std::memory_order_relaxed );
+	pStats->flushes				= m_pCounters->flushes.load( std::memory_order_relaxed );
+	pStats->seeks				= m_pCounters->seeks.load( std::memory_order_relaxed );
+	pStats->seekHits			= m_pCounters->seekHits.load( std::memory_order_relaxed );
+	pStats->directBytesRead		= m_pCounters->directBytesRead.load( std::memory_order_relaxed );
+	pStats->directBytesWritten	= m_pCounters->directBytesWritten.load( std::memory_order_relaxed );
+	pStats->copiedBytesRead		= m_pCounters->copiedBytesRead.load( std::memory_order_relaxed );
+	pStats->copiedBytesWritten	= m_pCounters->copiedBytesWritten.load( std::memory_order_relaxed );
+	pStats->rejectedReads		= m_pCounters->rejectedReads.load( std::memory_order_relaxed );
+	pStats->rejectedWrites		= m_pCounters->rejectedWrites.load( std::memory_order_relaxed );
+	pStats->patternChanges		= m_pCounters->patternChanges.load( std::memory_order_relaxed );
+	pStats->parallelTransfers	= m_pCounters->parallelTransfers.load( std::memory_order_relaxed );
+
+	for ( int i = 0; i < Stats::CALLBACK_COUNT; ++i )
+	{
+		for ( int j = 0; j < Stats::LATENCY_BUCKETS; ++j )
+		{
+			pStats->latency[ i ][ j ] = m_pCounters->latency[ i ][ j ].load( std::memory_order_relaxed );
+		}
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::ResetStats()
+{
+	if ( m_pCounters != 0 )
+	{
+		m_pCounters->Reset();
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::Retire()
+{
+	// If the pages are cached, the page remains in the cache and is flushed when it is evicted.
+
+	if ( m_pCache != 0 || !m_IsDirty || m_DataSize <= 0 )
+	{
+		return;
+	}
+
+	if ( m_pAsync != 0 && m_pAsync->writeBehindDepth > 0 )
+	{
+		WriteBehind();
+	}
+	else
+	{
+		Flush();
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::Advance()
+{
+	// The I/O point is normally at the end of the data, but it may be past the end (after seeking past the end of
+	// the data, for example).
+
+	int64_t const	location	= m_BufferLoc * m_BlockSize + std::max( m_Point, m_DataSize * m_BlockSize );
+
+	MoveTo( location / m_BlockSize );
+	m_Point += location % m_BlockSize;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the pages are cached, the buffer becomes the page containing the location, and the I/O point is moved to
+//! the location. If the page is not already in the cache, a page is evicted (and flushed if necessary) to make
+//! room for it. Otherwise, the buffer is flushed and moved to the location. The start of the buffer must be aligned,
+//! so if the location is not on a flush boundary (e.g. at the end of the data), the buffer starts at the boundary
+//! before it and the I/O point is moved to the location.
+
+void BufferedProxy::MoveTo( int64_t location )
+{
+	if ( m_pCache == 0 )
+	{
+		Retire();
+
+		m_BufferLoc	= _HighestMultiple( location, m_FlushGranule );
+		m_Point		= ( location - m_BufferLoc ) * m_BlockSize;
+		m_DataSize	= 0;
+		m_IsPartial	= false;
+		return;
+	}
+
+	std::vector< Cache::Page > &	pages			= m_pCache->pages;
+	int64_t const					pageLocation	= location - location % m_BufferSizeInBlocks;
+
+	// Save the state of the current page
+
+	SavePage();
+
+	// Find the page in the cache. If it isn't there, then evict a page to make room for it.
+
+	int									page;
+	std::map< int64_t, int >::iterator	entry	= m_pCache->index.find( pageLocation );
+
+	if ( entry != m_pCache->index.end() )
+	{
+		page = entry->second;
+	}
+	else
+	{
+		page = EvictPage();
+
+		pages[ page ].location	= pageLocation;
+		pages[ page ].dataSize	= 0;
+		pages[ page ].isDirty	= false;
+
+		m_pCache->index[ pageLocation ] = page;
+	}
+
+	// Make it the current page
+
+	pages[ page ].isReferenced = true;
+	m_pCache->current = page;
+
+	m_paBuffer		= pages[ page ].pBuffer;
+	m_BufferLoc		= pages[ page ].location;
+	m_DataSize		= pages[ page ].dataSize;
+	m_IsDirty		= pages[ page ].isDirty;
+	m_DirtyBegin	= pages[ page ].dirtyBegin;
+	m_DirtyEnd		= pages[ page ].dirtyEnd;
+	m_Point			= ( location - pageLocation ) * m_BlockSize;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Blocks that are about to be entirely overwritten are never read. Only the blocks between the end of the data in
+//! the buffer and the start of the write (including a partially overwritten first block) and a partially
+//! overwritten last block are read. If the write ends on a block boundary, the data following it is not read, and
+//! the buffer is marked as partial until it is.
+//!
+//! If the pages are cached or flushes must start on a boundary larger than a block, the whole buffer (or the rest
+//! of a partially filled buffer) is filled instead.
+//!
+//! @param	end		End of the data about to be written at the current location (in bytes from the start of the
+//!					buffer)
+
+void BufferedProxy::FillEdges( int64_t end )
+{
+	// Nothing is needed if the write does not extend the data or if the buffer is never filled.
+
+	if ( ( m_Flags & CF_NO_FILLS ) != 0 || end <= m_DataSize * m_BlockSize )
+	{
+		return;
+	}
+
+	if ( m_DataSize == 0 )
+	{
+		// If the whole buffer is about to be overwritten, then nothing needs to be read.
+
+		if ( m_Point == 0 && end >= m_BufferSize )
+		{
+			return;
+		}
+
+		if ( m_pCache != 0 || m_FlushGranule > 1 )
+		{
+			FillBuffer();
+			return;
+		}
+	}
+
+	// If the buffer was filled, then the data in the buffer extends to the end of the buffered object's data.
+
+	else if ( !m_IsPartial )
+	{
+		return;
+	}
+
+	// Otherwise, if flushes must start on a boundary larger than a block, then the rest of the buffer is read. The
+	// data in a partially filled buffer ends on that boundary (see Load()), so the read starts on it too.
+
+	else if ( m_FlushGranule > 1 )
+	{
+		m_DataSize	+= FillBlocks( m_DataSize, m_BufferSizeInBlocks - m_DataSize );
+		m_IsPartial	= false;
+		return;
+	}
+
+	// Read the blocks before the start of the write, including a partially overwritten first block.
+
+	int64_t const	headEnd	= std::max( m_DataSize, ( m_Point + m_BlockSize - 1 ) / m_BlockSize );
+
+	if ( headEnd > m_DataSize )
+	{
+		m_DataSize += FillBlocks( m_DataSize, headEnd - m_DataSize );
+	}
+
+	// If the last block will be partially overwritten, then read it along with the rest of the buffer, which a
+	// following write would otherwise need one block at a time. The blocks in between are about to be overwritten.
+
+	if ( end % m_BlockSize != 0 && end / m_BlockSize >= headEnd )
+	{
+		int64_t const	first	= end / m_BlockSize;
+
+		m_DataSize	= std::max( m_DataSize, first + FillBlocks( first, m_BufferSizeInBlocks - first ) );
+		m_IsPartial	= false;
+	}
+	else
+	{
+		m_IsPartial = true;
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	first	Index of the first block in the buffer
+//! @param	n		Number of blocks to read
+//!
+//! @return		The number of blocks read (0 if there was an error)
+
+int64_t BufferedProxy::FillBlocks( int64_t first, int64_t n )
+{
+	BUFFER_COUNT( fills, 1 );
+
+	WaitForWriteBehind( m_BufferLoc + first, n );
+
+	return std::max< int64_t >( ReadBlocks( m_BufferLoc + first, m_paBuffer + first * m_BlockSize, n ), 0 );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Unless the access pattern is being detected and the reads are not sequential, the whole buffer is filled.
+//! Otherwise, if the data was read ahead, it is swapped in. If not, only the blocks up to the end of the read
+//! (rounded up to the flush granule) are read, and the buffer is marked as partial.
+//!
+//! @param	end		End of the data about to be read (in bytes from the start of the buffer)
+
+void BufferedProxy::Load( int64_t end )
+{
+	assert( m_DataSize == 0 );
+
+	if ( m_pPattern == 0 || m_pPattern->mode == Pattern::MODE_SEQUENTIAL || ( m_Flags & CF_NO_FILLS ) != 0 )
+	{
+		FillBuffer();
+		return;
+	}
+
+	if ( m_pAsync != 0 && TakeReadAhead() )
+	{
+		BUFFER_COUNT( fills, 1 );
+		BUFFER_COUNT( readAheadHits, 1 );
+		m_IsPartial = false;
+	}
+	else
+	{
+		int64_t const	needed	= ( end + m_BlockSize - 1 ) / m_BlockSize;
+		int64_t const	blocks	= std::min( _HighestMultiple( needed + m_FlushGranule - 1, m_FlushGranule ), m_BufferSizeInBlocks );
+
+		m_DataSize	= FillBlocks( 0, blocks );
+		m_IsPartial	= true;
+	}
+
+	// Start reading the data at the following strides.
+
+	if ( m_pAsync != 0 && !m_pAsync->slots.empty() && m_pPattern->mode == Pattern::MODE_STRIDED )
+	{
+		ScheduleReadAhead();
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! When the mode changes to random, the buffers that have been read ahead are no longer useful, so they are
+//! discarded.
+//!
+//! @param	location	Location of the read (in bytes)
+//! @param	n			Number of bytes to read
+
+void BufferedProxy::DetectPattern( int64_t location, int64_t n )
+{
+	Pattern &		pattern	= *m_pPattern;	// Convenience
+	int64_t const	stride	= location - pattern.lastStart;
+	Pattern::Mode	suggested;
+
+	if ( location >= pattern.lastEnd - m_BufferSize && location < pattern.lastEnd + m_BufferSize )
+	{
+		suggested = Pattern::MODE_SEQUENTIAL;
+	}
+	else if ( stride == pattern.stride )
+	{
+		suggested = Pattern::MODE_STRIDED;
+	}
+	else
+	{
+		suggested = Pattern::MODE_RANDOM;
+	}
+
+	pattern.lastStart	= location;
+	pattern.lastEnd		= location + n;
+	pattern.stride		= stride;
+
+	if ( suggested == pattern.candidate )
+	{
+		++pattern.count;
+	}
+	else
+	{
+		pattern.candidate	= suggested;
+		pattern.count		= 1;
+	}
+
+	if ( pattern.count >= PATTERN_THRESHOLD && pattern.mode != pattern.candidate )
+	{
+		BUFFER_COUNT( patternChanges, 1 );
+		pattern.mode = pattern.candidate;
+
+		if ( pattern.mode == Pattern::MODE_RANDOM )
+		{
+			DiscardReadAhead( 0, -1 );
+		}
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::WriteBehind()
+{
+	assert( _IsAligned( m_BufferLoc * m_BlockSize, m_SectorAlign ) );
+
+	// Only the modified blocks are written.
+
+	Async::PendingWrite	write;
+
+	GetFlushRange( m_DirtyBegin, m_DirtyEnd, m_DataSize, &write.first, &write.size );
+	write.pBuffer	= m_paBuffer;
+	write.location	= m_BufferLoc + write.first;
+
+	// Any data that was read ahead from this location is about to become stale.
+
+	DiscardReadAhead( write.location, write.size );
+
+	// Replace the buffer with a spare, waiting for one if necessary.
+
+	{
+		std::unique_lock< std::mutex >	lock( m_pAsync->mutex );
+
+		m_pAsync->changed.wait( lock, [this] { return !m_pAsync->spareBuffers.empty(); } );
+
+		m_paBuffer = m_pAsync->spareBuffers.back();
+		m_pAsync->spareBuffers.pop_back();
+		m_pAsync->pendingWrites.push_back( write );
+	}
+
+	m_IsDirty = false;
+
+	BUFFER_COUNT( flushes, 1 );
+
+	m_pAsync->worker.Post( [this, write] ()
+		{
+			int64_t	blocksWritten	= 0;
+
+			while ( blocksWritten < write.size )
+			{
+				int64_t const	n	= WriteBlocks( write.location + blocksWritten,
+											   write.pBuffer + ( write.first + blocksWritten ) * m_BlockSize,
+											   write.size - blocksWritten );
+				if ( n <= 0 )
+				{
+					break;
+				}
+
+				blocksWritten += n;
+			}
+
+			// Return the buffer to the spares
+
+			{
+				std::lock_guard< std::mutex >			lock( m_pAsync->mutex );
+				std::vector< Async::PendingWrite > &	pending	= m_pAsync->pendingWrites;
+
+				for ( size_t i = 0; i < pending.size(); ++i )
+				{
+					if ( pending[ i ].pBuffer == write.pBuffer )
+					{
+						pending.erase( pending.begin() + i );
+						break;
+					}
+				}
+
+				m_pAsync->spareBuffers.push_back( write.pBuffer );
+
+				if ( blocksWritten < write.size )
+				{
+					m_pAsync->writeFailed = true;
+				}
+			}
+
+			m_pAsync->changed.notify_all();
+		} );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @return		False if a background write has failed since the last Flush()
+
+bool BufferedProxy::WaitForWriteBehind( int64_t location, int64_t n )
+{
+	if ( m_pAsync == 0 )
+	{
+		return true;
+	}
+
+	std::unique_lock< std::mutex >	lock( m_pAsync->mutex );
+
+	m_pAsync->changed.wait( lock, [&] ()
+		{
+			std::vector< Async::PendingWrite > const &	pending	= m_pAsync->pendingWrites;
+
+			for ( size_t i = 0; i < pending.size(); ++i )
+			{
+				if ( n < 0 || ( pending[ i ].location < location + n && location < pending[ i ].location + pending[ i ].size ) )
+				{
+					return false;
+				}
+			}
+
+			return true;
+		} );
+
+	return !m_pAsync->writeFailed.load();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::SavePage()
+{
+	Cache::Page &	page	= m_pCache->pages[ m_pCache->current ];
+
+	page.dataSize	= m_DataSize;
+	page.isDirty	= m_IsDirty;
+	page.dirtyBegin	= m_DirtyBegin;
+	page.dirtyEnd	= m_DirtyEnd;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @return		Index of the page, which is no longer in the cache
+
+int BufferedProxy::EvictPage()
+{
+	std::vector< Cache::Page > &	pages	= m_pCache->pages;
+	int const						nPages	= static_cast< int >( pages.size() );
+
+	// Advance the clock hand until it reaches a page that is unused or has not been referenced since the last pass.
+
+	int		page;
+
+	for ( ;; )
+	{
+		page = m_pCache->hand;
+		m_pCache->hand = ( m_pCache->hand + 1 ) % nPages;
+
+		if ( pages[ page ].location < 0 || !pages[ page ].isReferenced )
+		{
+			break;
+		}
+
+		pages[ page ].isReferenced = false;
+	}
+
+	// Flush the page and remove it from the cache
+
+	if ( pages[ page ].location >= 0 )
+	{
+		FlushPage( page );
+		m_pCache->index.erase( pages[ page ].location );
+		pages[ page ].location = -1;
+	}
+
+	return page;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @return		False if the page's data could not be written
+//!
+//! @note	The state of the current page must have been saved first.
+
+bool BufferedProxy::FlushPage( int index )
+{
+	Cache::Page &	page	= m_pCache->pages[ index ];
+
+	if ( page.isDirty && page.dataSize > 0 )
+	{
+		int64_t	first;
+		int64_t	blocksToFlush;
+
+		GetFlushRange( page.dirtyBegin, page.dirtyEnd, page.dataSize, &first, &blocksToFlush );
+
+		BUFFER_COUNT( flushes, 1 );
+
+		if ( WriteBlocks( page.location + first, page.pBuffer + first * m_BlockSize, blocksToFlush ) != blocksToFlush )
+		{
+			return false;
+		}
+
+		page.isDirty = false;
+	}
+
+	return true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The first block is rounded down so that the flush starts at a location aligned on the sector alignment and at
+//! an address aligned on the buffer alignment. The blocks before it in the buffer hold the same data as the
+//! buffered object (or the data that would have been flushed anyway), so writing them again is harmless.
+//!
+//! @param	dirtyBegin	Start of the data that has not been flushed (in bytes from the start of the buffer)
+//! @param	dirtyEnd	End of the data that has not been flushed (in bytes from the start of the buffer)
+//! @param	dataSize	Size of the data in the buffer (in blocks)
+//! @param	pFirst		Where to store the index of the first block to write
+//! @param	pCount		Where to store the number of blocks to write
+
+void BufferedProxy::GetFlushRange( int64_t dirtyBegin, int64_t dirtyEnd, int64_t dataSize, int64_t * pFirst, int64_t * pCount ) const
+{
+	int64_t const	first	= _HighestMultiple( dirtyBegin / m_BlockSize, m_FlushGranule );
+	int64_t const	last	= std::min( ( dirtyEnd + m_BlockSize - 1 ) / m_BlockSize, dataSize );
+
+	*pFirst = first;
+	*pCount = std::max< int64_t >( last - first, 0 );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Data can only be transferred directly at an address aligned on the buffer alignment. If the user's buffer is
+//! misaligned by a whole number of blocks and sectors, then transferring that many bytes through the buffer first
+//! aligns the rest of it, and the location of the rest of the data on the buffered object remains aligned. A
+//! buffer misaligned in any other way cannot be aligned this way, so its data is copied a buffer at a time.
+//!
+//! The current location must be at the end of the data in the buffer, and the buffer must be flushed.
+//!
+//! @param	p	Address of the user's buffer
+//! @param	n	Number of bytes to transfer
+//!
+//! @return		The number of bytes to transfer through the buffer, or 0 if none should be
+
+int64_t BufferedProxy::GetBounceSize( void const * p, int64_t n ) const
+{
+	if ( ( m_Flags & CF_NO_DIRECT_IO ) != 0 || m_pCache != 0 )
+	{
+		return 0;
+	}
+
+	int64_t const	bounce	= ( m_BufferAlign + 1 - ( reinterpret_cast< uintptr_t >( p ) & m_BufferAlign ) ) & m_BufferAlign;
+
+	if (    bounce % m_BlockSize != 0
+		 || !_IsAligned( bounce, m_SectorAlign )
+		 || bounce > m_BufferSize
+		 || n - bounce < m_BufferSize )
+	{
+		return 0;
+	}
+
+	return bounce;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Before data is transferred directly to or from the buffered object, the cached pages overlapping the data must
+//! be flushed. If the data is being written, the pages become stale and are also discarded.
+//!
+//! @param	location	Location of the data (in blocks)
+//! @param	n			Size of the data (in blocks)
+//! @param	discard		If true, the pages are discarded.
+
+void BufferedProxy::SyncPages( int64_t location, int64_t n, bool discard )
+{
+	if ( m_pCache == 0 )
+	{
+		return;
+	}
+
+	std::vector< Cache::Page > &	pages	= m_pCache->pages;
+
+	SavePage();
+
+	for ( size_t i = 0; i < pages.size(); ++i )
+	{
+		Cache::Page &	page	= pages[ i ];
+
+		if ( page.location >= 0 && page.location < location + n && location < page.location + m_BufferSizeInBlocks )
+		{
+			FlushPage( static_cast< int >( i ) );
+
+			if ( discard )
+			{
+				page.dataSize	= 0;
+				page.isDirty	= false;
+
+				// The current page stays where it is, but it is empty.
+
+				if ( static_cast< int >( i ) != m_pCache->current )
+				{
+					m_pCache->index.erase( page.location );
+					page.location = -1;
+				}
+			}
+		}
+	}
+
+	m_DataSize		= pages[ m_pCache->current ].dataSize;
+	m_IsDirty		= pages[ m_pCache->current ].isDirty;
+	m_DirtyBegin	= pages[ m_pCache->current ].dirtyBegin;
+	m_DirtyEnd		= pages[ m_pCache->current ].dirtyEnd;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the buffered object supports positional I/O, it is used. Otherwise, the buffered object must be seeked first,
+//! so access is serialized when there are background threads.
+//!
+//! The buffered object may transfer fewer blocks than requested, so the transfer is continued until it is complete
+//! or nothing more can be read.
+
+int64_t BufferedProxy::ReadBlocks( int64_t location, char * pBuffer, int64_t n )
+{
+	std::unique_lock< std::mutex >	lock;
+
+	if ( !m_IsPositional )
+	{
+		if ( m_pAsync != 0 )
+		{
+			lock = std::unique_lock< std::mutex >( m_pAsync->backendMutex );
+		}
+
+		BUFFER_TIME( CALLBACK_SEEK );
+		if ( m_pBufferedObject->Seek( m_Handle, location ) != location )
+		{
+			return -1;
+		}
+	}
+
+	int64_t	total	= 0;
+
+	while ( total < n )
+	{
+		int64_t	blocksRead;
+
+		{
+			BUFFER_TIME( CALLBACK_READ );
+			blocksRead = m_IsPositional
+						? m_pBufferedObject->ReadAt( m_Handle, pBuffer + total * m_BlockSize, n - total, location + total )
+						: m_pBufferedObject->Read( m_Handle, pBuffer + total * m_BlockSize, n - total );
+		}
+
+		if ( blocksRead <= 0 )
+		{
+			return ( total > 0 ) ? total : blocksRead;
+		}
+
+		total += blocksRead;
+	}
+
+	return total;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the buffered object supports positional I/O, it is used. Otherwise, the buffered object must be seeked first,
+//! so access is serialized when there are background threads.
+//!
+//! The buffered object may transfer fewer blocks than requested, so the transfer is continued until it is complete
+//! or nothing more can be written.
+
+int64_t BufferedProxy::WriteBlocks( int64_t location, char const * pBuffer, int64_t n )
+{
+	std::unique_lock< std::mutex >	lock;
+
+	if ( !m_IsPositional )
+	{
+		if ( m_pAsync != 0 )
+		{
+			lock = std::unique_lock< std::mutex >( m_pAsync->backendMutex );
+		}
+
+		BUFFER_TIME( CALLBACK_SEEK );
+		if ( m_pBufferedObject->Seek( m_Handle, location ) != location )
+		{
+			return -1;
+		}
+	}
+
+	int64_t	total	= 0;
+
+	while ( total < n )
+	{
+		int64_t	blocksWritten;
+
+		{
+			BUFFER_TIME( CALLBACK_WRITE );
+			blocksWritten = m_IsPositional
+						? m_pBufferedObject->WriteAt( m_Handle, pBuffer + total * m_BlockSize, n - total, location + total )
+						: m_pBufferedObject->Write( m_Handle, pBuffer + total * m_BlockSize, n - total );
+		}
+
+		if ( blocksWritten <= 0 )
+		{
+			return ( total > 0 ) ? total : blocksWritten;
+		}
+
+		total += blocksWritten;
+	}
+
+	return total;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t BufferedProxy::ReadDirect( int64_t location, char * pBuffer, int64_t n )
+{
+	if ( m_pParallel == 0 || n < 2 * m_pParallel->chunkSize )
+	{
+		return ReadBlocks( location, pBuffer, n );
+	}
+
+	BUFFER_COUNT( parallelTransfers, 1 );
+
+	return m_pParallel->Transfer( n,
+								  [this, location, pBuffer]( int64_t first, int64_t size )
+								  {
+									  return ReadBlocks( location + first, pBuffer + first * m_BlockSize, size );
+								  } );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t BufferedProxy::WriteDirect( int64_t location, char const * pBuffer, int64_t n )
+{
+	if ( m_pParallel == 0 || n < 2 * m_pParallel->chunkSize )
+	{
+		return WriteBlocks( location, pBuffer, n );
+	}
+
+	BUFFER_COUNT( parallelTransfers, 1 );
+
+	return m_pParallel->Transfer( n,
+								  [this, location, pBuffer]( int64_t first, int64_t size )
+								  {
+									  return WriteBlocks( location + first, pBuffer + first * m_BlockSize, size );
+								  } );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+bool BufferedProxy::TakeReadAhead()
+{
+	std::unique_lock< std::mutex >	lock( m_pAsync->mutex );
+
+	for ( size_t i = 0; i < m_pAsync->slots.size(); ++i )
+	{
+		Async::Slot &	slot	= m_pAsync->slots[ i ];
+
+		if ( slot.state != Async::SLOT_FREE && slot.location == m_BufferLoc )
+		{
+			// Wait for the worker to finish reading the data
+
+			m_pAsync->changed.wait( lock, [&slot] { return slot.state == Async::SLOT_READY; } );
+
+			// Swap the buffers. The slot's old buffer becomes the buffer, and the old buffer is reused by the slot.
+
+			std::swap( m_paBuffer, slot.pBuffer );
+			m_DataSize	= slot.size;
+			slot.state	= Async::SLOT_FREE;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::ScheduleReadAhead()
+{
+	std::vector< Async::Slot > &	slots	= m_pAsync->slots;
+	int const							depth	= static_cast< int >( slots.size() );
+	std::vector< int64_t >				locations;
+
+	// Normally, the buffers following this one are read. If the reads are strided, the buffers holding the reads at
+	// the following strides are read instead (starting where a seek to them would put the buffer).
+
+	for ( int i = 1; i <= depth; ++i )
+	{
+		if ( m_pPattern != 0 && m_pPattern->mode == Pattern::MODE_STRIDED )
+		{
+			int64_t const	next	= m_pPattern->lastStart + i * m_pPattern->stride;
+
+			if ( next < 0 )
+			{
+				break;
+			}
+
+			locations.push_back( _HighestMultiplePowerOf2( next, m_SectorAlign ) / m_BlockSize );
+		}
+		else
+		{
+			locations.push_back( m_BufferLoc + i * m_BufferSizeInBlocks );
+		}
+	}
+
+	std::lock_guard< std::mutex >	lock( m_pAsync->mutex );
+
+	// Free any slots that are no longer ahead of the buffer. Slots that are being read are left alone until they
+	// are done.
+
+	for ( int i = 0; i < depth; ++i )
+	{
+		Async::Slot &	slot	= slots[ i ];
+
+		if (    ( slot.state == Async::SLOT_QUEUED || slot.state == Async::SLOT_READY )
+			 && std::find( locations.begin(), locations.end(), slot.location ) == locations.end() )
+		{
+			slot.state = Async::SLOT_FREE;
+		}
+	}
+
+	// Queue reads of the buffers that are not already queued.
+
+	for ( int64_t location : locations )
+	{
+		bool	isQueued	= false;
+		int		freeSlot	= -1;
+
+		for ( int i = 0; i < depth; ++i )
+		{
+			if ( slots[ i ].state == Async::SLOT_FREE )
+			{
+				if ( freeSlot < 0 )
+				{
+					freeSlot = i;
+				}
+			}
+			else if ( slots[ i ].location == location )
+			{
+				isQueued = true;
+			}
+		}
+
+		if ( isQueued )
+		{
+			continue;
+		}
+
+		if ( freeSlot < 0 )
+		{
+			break;
+		}
+
+		unsigned const	request	= ++slots[ freeSlot ].request;
+
+		slots[ freeSlot ].location	= location;
+		slots[ freeSlot ].state		= Async::SLOT_QUEUED;
+
+		m_pAsync->worker.Post( [this, freeSlot, request] ()
+			{
+				int64_t	location;
+				char *	pBuffer;
+
+				// If the slot was discarded (and possibly queued again), then there is nothing to do.
+
+				{
+					std::lock_guard< std::mutex >	lock( m_pAsync->mutex );
+
+					if ( freeSlot >= static_cast< int >( m_pAsync->slots.size() ) )
+					{
+						return;
+					}
+
+					Async::Slot &	slot	= m_pAsync->slots[ freeSlot ];
+
+					if ( slot.state != Async::SLOT_QUEUED || slot.request != request )
+					{
+						return;
+					}
+
+					slot.state	= Async::SLOT_READING;
+					location	= slot.location;
+					pBuffer		= slot.pBuffer;
+				}
+
+				int64_t const	blocksRead	= ReadBlocks( location, pBuffer, m_BufferSizeInBlocks );
+
+				{
+					std::lock_guard< std::mutex >	lock( m_pAsync->mutex );
+					Async::Slot &					slot	= m_pAsync->slots[ freeSlot ];
+
+					slot.size	= std::max< int64_t >( blocksRead, 0 );
+					slot.state	= Async::SLOT_READY;
+				}
+
+				m_pAsync->changed.notify_all();
+			} );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::DiscardReadAhead( int64_t location, int64_t n )
+{
+	if ( m_pAsync == 0 )
+	{
+		return;
+	}
+
+	std::unique_lock< std::mutex >	lock( m_pAsync->mutex );
+
+	for ( size_t i = 0; i < m_pAsync->slots.size(); ++i )
+	{
+		Async::Slot &	slot	= m_pAsync->slots[ i ];
+
+		if (    slot.state != Async::SLOT_FREE
+			 && ( n < 0 || ( slot.location < location + n && location < slot.location + m_BufferSizeInBlocks ) ) )
+		{
+			// A slot that is being read can't be reused until the read is done.
+
+			m_pAsync->changed.wait( lock, [&slot] { return slot.state != Async::SLOT_READING; } );
+			slot.state = Async::SLOT_FREE;
+		}
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::CopyOut( void * * ppDst, int64_t n )
+{
+	assert( m_Point + n <= m_DataSize * m_BlockSize );
+
+	void * const	pDst	= *ppDst;	// Convenience
+
+	// Copy from the buffer
+	memcpy( pDst, &m_paBuffer[ m_Point ], n );
+	BUFFER_COUNT( copiedBytesRead, n );
+
+	// Bump the pointers
+
+	Consume( n );
+	*ppDst = reinterpret_cast< char * >( pDst ) + n;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferedProxy::CopyIn( void const * * ppSrc, int64_t n )
+{
+	assert( m_Point + n <= m_BufferSize );
+
+	void const * const	pSrc	= *ppSrc;	// Convenience
+
+	// Copy to the buffer
+
+	memcpy( &m_paBuffer[ m_Point ], pSrc, n );
+	BUFFER_COUNT( copiedBytesWritten, n );
+
+	// Bump pointers and mark the data as written
+
+	Commit( n );
+	*ppSrc = reinterpret_cast< char const * >( pSrc ) + n;
 }
 
@@ -0,0 +1,480 @@
+/*********************************************************************************************************************
+
+                                                    BufferPool.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/BufferPool.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "BufferPool.h"
+
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+
+#if defined( _WIN32 )
+#include <malloc.h>
+#else // defined( _WIN32 )
+#include <sys/mman.h>
+#endif // defined( _WIN32 )
+
+namespace
+{
+	// Maximum amount of memory in the free buffers of each class kept by each thread
+	int64_t const	THREAD_CACHE_SIZE	= 4 * 1024 * 1024;
+
+	// Maximum number of free buffers of each class kept by each thread
+	int const		THREAD_CACHE_COUNT	= 64;
+
+	inline bool _IsPowerOf2( int64_t n )
+	{
+		return ( ( n & ( n - 1 ) ) == 0 );
+	}
+
+	inline int64_t _Pad( int64_t n, int64_t m )
+	{
+		return ( n + m - 1 ) / m * m;
+	}
+
+	// The pools that exist, so a thread's cache is not returned to a pool that has been destroyed. These are
+	// function-local statics so that they are constructed before (and destroyed after) any pool that is a static.
+
+	std::mutex & _RegistryMutex()
+	{
+		static std::mutex	mutex;
+		return mutex;
+	}
+
+	std::set< uint64_t > & _LivePools()
+	{
+		static std::set< uint64_t >	pools;
+		return pools;
+	}
+
+	uint64_t	s_NextId	= 1;	// Id of the next pool (guarded by the registry mutex)
+
+} // anonymous namespace
+
+
+// The free buffers kept by a thread
+//
+// A thread has a cache for each pool that it has used. When the thread exits, the buffers are returned to the pools
+// that still exist. A pool's id is never reused, so a cache for a pool that was destroyed is never mistaken for a
+// cache for a new pool at the same address.
+
+struct BufferPool::ThreadCaches
+{
+	struct Cache
+	{
+		uint64_t				id;						// Id of the pool
+		BufferPool *			pPool;					// The pool
+		std::vector< void * >	aFree[ CLASS_COUNT ];	// Free buffers of each class
+	};
+
+	~ThreadCaches()
+	{
+		std::lock_guard< std::mutex >	lock( _RegistryMutex() );
+
+		for ( size_t i = 0; i < caches.size(); ++i )
+		{
+			Cache &	cache	= caches[ i ];
+
+			if ( _LivePools().count( cache.id ) != 0 )
+			{
+				for ( int c = 0; c < CLASS_COUNT; ++c )
+				{
+					if ( !cache.aFree[ c ].empty() )
+					{
+						cache.pPool->Give( c, &cache.aFree[ c ][ 0 ], static_cast< int >( cache.aFree[ c ].size() ) );
+					}
+				}
+			}
+		}
+	}
+
+	std::vector< Cache >	caches;		// The caches
+};
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	flags	Configuration flags (see enum Flags)
+
+BufferPool::BufferPool( unsigned flags /* = 0*/ )
+	: m_Flags( flags ),
+	  m_MappedSize( 0 )
+{
+	std::lock_guard< std::mutex >	lock( _RegistryMutex() );
+
+	m_Id = s_NextId++;
+	_LivePools().insert( m_Id );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+BufferPool::~BufferPool()
+{
+	{
+		std::lock_guard< std::mutex >	lock( _RegistryMutex() );
+		_LivePools().erase( m_Id );
+	}
+
+	for ( size_t i = 0; i < m_Mappings.size(); ++i )
+	{
+		Unmap( m_Mappings[ i ].first, m_Mappings[ i ].second );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	size		Size of the buffer (in bytes)
+//! @param	alignment	Alignment of the buffer. It must be a power of two.
+//!
+//! @return		The buffer, or 0 if it can't be allocated (or the alignment is larger than 2 MiB).
+
+void * BufferPool::Allocate( int64_t size, unsigned alignment /* = 1*/ )
+{
+	assert( size > 0 );
+
+	if ( alignment > ( 1u << ARENA_SHIFT ) )
+	{
+		return 0;
+	}
+
+	int const	c	= GetClass( size, alignment );
+
+	// A buffer that is too large to be pooled is allocated directly.
+
+	if ( c < 0 )
+	{
+		return Map( static_cast< size_t >( _Pad( size, int64_t( 1 ) << ARENA_SHIFT ) ) );
+	}
+
+	std::vector< void * > &	cached	= GetThreadCache( this )[ c ];
+
+	// If the thread has no free buffers of this class, get half of the maximum from the pool.
+
+	if ( cached.empty() )
+	{
+		int const	limit	= GetThreadCacheLimit( c );
+
+		cached.resize( static_cast< size_t >( std::max( limit / 2, 1 ) ) );
+		cached.resize( static_cast< size_t >( Take( c, &cached[ 0 ], static_cast< int >( cached.size() ) ) ) );
+
+		if ( cached.empty() )
+		{
+			return 0;
+		}
+	}
+
+	void * const	p	= cached.back();
+	cached.pop_back();
+
+	return p;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	p			The buffer returned by Allocate(). If it is 0, nothing is done.
+//! @param	size		Size given to Allocate()
+//! @param	alignment	Alignment given to Allocate()
+
+void BufferPool::Free( void * p, int64_t size, unsigned alignment /* = 1*/ )
+{
+	if ( p == 0 )
+	{
+		return;
+	}
+
+	int const	c	= GetClass( size, alignment );
+
+	if ( c < 0 )
+	{
+		Unmap( p, static_cast< size_t >( _Pad( size, int64_t( 1 ) << ARENA_SHIFT ) ) );
+		return;
+	}
+
+	std::vector< void * > &	cached	= GetThreadCache( this )[ c ];
+
+	cached.push_back( p );
+
+	// If the thread has too many free buffers of this class, return half of them to the pool.
+
+	int const	limit	= GetThreadCacheLimit( c );
+
+	if ( static_cast< int >( cached.size() ) > limit )
+	{
+		int const	n	= static_cast< int >( cached.size() ) - std::max( limit / 2, 1 );
+
+		Give( c, &cached[ cached.size() - n ], n );
+		cached.resize( cached.size() - n );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t BufferPool::MappedSize() const
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	return m_MappedSize;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The default pool is used by the BufferedProxy constructor that allocates its own buffer.
+
+BufferPool & BufferPool::Default()
+{
+	static BufferPool	pool( TRANSPARENT_HUGE_PAGES );
+
+	return pool;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int BufferPool::GetClass( int64_t size, unsigned alignment )
+{
+	assert( _IsPowerOf2( alignment ) );
+	assert( alignment <= ( 1u << ARENA_SHIFT ) );
+
+	int64_t const	needed	= std::max< int64_t >( size, alignment );
+	int				shift	= MIN_CLASS_SHIFT;
+
+	while ( ( int64_t( 1 ) << shift ) < needed )
+	{
+		++shift;
+		if ( shift > MAX_CLASS_SHIFT )
+		{
+			return -1;
+		}
+	}
+
+	return shift - MIN_CLASS_SHIFT;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int BufferPool::GetThreadCacheLimit( int sizeClass )
+{
+	int64_t const	count	= THREAD_CACHE_SIZE >> ( sizeClass + MIN_CLASS_SHIFT );
+
+	return static_cast< int >( std::min< int64_t >( std::max< int64_t >( count, 1 ), THREAD_CACHE_COUNT ) );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @return		The free lists of the calling thread for the pool (one per class).
+
+std::vector< void * > * BufferPool::GetThreadCache( BufferPool * pPool )
+{
+	static thread_local ThreadCaches	threadCaches;
+	std::vector< ThreadCaches::Cache > &	caches	= threadCaches.caches;
+
+	for ( size_t i = 0; i < caches.size(); ++i )
+	{
+		if ( caches[ i ].id == pPool->m_Id )
+		{
+			return caches[ i ].aFree;
+		}
+	}
+
+	// This is the first time the thread has used the pool. Caches for pools that no longer exist are dropped first
+	// (their memory is gone).
+
+	{
+		std::lock_guard< std::mutex >	lock( _RegistryMutex() );
+
+		for ( size_t i = caches.size(); i > 0; --i )
+		{
+			if ( _LivePools().count( caches[ i - 1 ].id ) == 0 )
+			{
+				caches.erase( caches.begin() + ( i - 1 ) );
+			}
+		}
+	}
+
+	caches.push_back( ThreadCaches::Cache() );
+	caches.back().id	= pPool->m_Id;
+	caches.back().pPool	= pPool;
+
+	return caches.back().aFree;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Buffers no larger than an arena are carved out of a new arena. Larger buffers are allocated one at a time.
+
+int BufferPool::Take( int sizeClass, void ** ppBuffers, int n )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	std::vector< void * > &	free	= m_aFree[ sizeClass ];
+
+	if ( free.empty() )
+	{
+		size_t const	size		= size_t( 1 ) << ( sizeClass + MIN_CLASS_SHIFT );
+		size_t const	mapSize		= std::max( size, size_t( 1 ) << ARENA_SHIFT );
+		char * const	pMemory		= reinterpret_cast< char * >( Map( mapSize ) );
+
+		if ( pMemory == 0 )
+		{
+			return 0;
+		}
+
+		m_Mappings.push_back( std::make_pair( static_cast< void * >( pMemory ), mapSize ) );
+		m_MappedSize += mapSize;
+
+		for ( size_t offset = mapSize; offset > 0; offset -= size )
+		{
+			free.push_back( pMemory + offset - size );
+		}
+	}
+
+	int const	count	= std::min( n, static_cast< int >( free.size() ) );
+
+	for ( int i = 0; i < count; ++i )
+	{
+		ppBuffers[ i ] = free.back();
+		free.pop_back();
+	}
+
+	return count;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferPool::Give( int sizeClass, void * const * ppBuffers, int n )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	m_aFree[ sizeClass ].insert( m_aFree[ sizeClass ].end(), ppBuffers, ppBuffers + n );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	size	Size of the memory. It must be a multiple of the arena size.
+//!
+//! @return		The memory, aligned on an arena boundary, or 0 if it can't be obtained.
+
+void * BufferPool::Map( size_t size )
+{
+	size_t const	arena	= size_t( 1 ) << ARENA_SHIFT;
+
+#if defined( _WIN32 )
+
+	return _aligned_malloc( size, arena );
+
+#else // defined( _WIN32 )
+
+	int const	prot	= PROT_READ | PROT_WRITE;
+	int const	flags	= MAP_PRIVATE | MAP_ANONYMOUS;
+
+#if defined( MAP_HUGETLB )
+
+	// Huge pages are aligned on their size. If there aren't enough reserved, normal pages are used instead.
+
+	if ( ( m_Flags & HUGE_PAGES ) != 0 )
+	{
+		void * const	p	= mmap( 0, size, prot, flags | MAP_HUGETLB, -1, 0 );
+
+		if ( p != MAP_FAILED )
+		{
+			return p;
+		}
+	}
+
+#endif // defined( MAP_HUGETLB )
+
+	// Normal pages are only aligned on a page boundary, so an extra arena is mapped and the aligned part is kept.
+
+	char * const	pMapped	= reinterpret_cast< char * >( mmap( 0, size + arena, prot, flags, -1, 0 ) );
+
+	if ( pMapped == MAP_FAILED )
+	{
+		return 0;
+	}
+
+	char * const	p		= reinterpret_cast< char * >( ( reinterpret_cast< uintptr_t >( pMapped ) + arena - 1 ) & ~( arena - 1 ) );
+	size_t const	head	= static_cast< size_t >( p - pMapped );
+
+	if ( head > 0 )
+	{
+		munmap( pMapped, head );
+	}
+
+	if ( arena - head > 0 )
+	{
+		munmap( p + size, arena - head );
+	}
+
+#if defined( MADV_HUGEPAGE )
+
+	if ( ( m_Flags & TRANSPARENT_HUGE_PAGES ) != 0 )
+	{
+		madvise( p, size, MADV_HUGEPAGE );
+	}
+
+#endif // defined( MADV_HUGEPAGE )
+
+	return p;
+
+#endif // defined( _WIN32 )
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void BufferPool::Unmap( void * p, size_t size )
+{
+#if defined( _WIN32 )
+	(void)size;
+	_aligned_free( p );
+#else // defined( _WIN32 )
+	munmap( p, size );
+#endif // defined( _WIN32 )
+}
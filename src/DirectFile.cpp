@@ -0,0 +1,293 @@
+/*********************************************************************************************************************
+
+                                                    DirectFile.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/DirectFile.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "DirectFile.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	// Alignment used if the device's requirements can't be determined
+	int const	DEFAULT_ALIGNMENT	= 4096;
+
+} // anonymous namespace
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pPath	Path of the file (or block device) to open.
+//! @param	oflags	Flags passed to open() (e.g. O_RDWR | O_CREAT). O_DIRECT is added.
+//! @param	mode	Permissions of the file if it is created.
+
+DirectFile::DirectFile( char const * pPath, int oflags, mode_t mode /* = 0644*/ )
+{
+	m_Fd = open( pPath, oflags | O_DIRECT | O_CLOEXEC, mode );
+	if ( m_Fd < 0 )
+	{
+		throw ConstructorFailedException( "Unable to open the file for direct I/O." );
+	}
+
+	DiscoverAlignment();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+DirectFile::~DirectFile()
+{
+	close( m_Fd );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The proxy's block size and sector alignment are the file's block size, and its buffer alignment is the file's
+//! memory alignment. The buffer is allocated from the default buffer pool by the proxy and returned to it (after any
+//! unwritten data has been flushed) when the proxy is destroyed.
+//!
+//! @param	bufferSize	Size of the buffer. It is rounded up to a multiple of the block size.
+//! @param	flags		Configuration flags (see BufferedProxy)
+//!
+//! @return		The proxy, or null if the buffer could not be allocated.
+//!
+//! @note	The proxy must be destroyed before this object is.
+
+std::unique_ptr< BufferedProxy > DirectFile::CreateProxy( int64_t bufferSize, unsigned flags /* = 0*/ )
+{
+	assert( bufferSize > 0 );
+
+	int64_t const	size	= ( bufferSize + m_BlockSize - 1 ) / m_BlockSize * m_BlockSize;
+
+	try
+	{
+		return std::unique_ptr< BufferedProxy >( new BufferedProxy( size, Handle(), this, flags,
+																	  m_BlockSize, static_cast< unsigned >( m_BlockSize ),
+																	  m_MemoryAlign ) );
+	}
+	catch ( ConstructorFailedException const & )
+	{
+		return std::unique_ptr< BufferedProxy >();
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle	File descriptor
+//! @param	pBuffer	Location to put the data.
+//! @param	n		Number of blocks to read.
+//!
+//! @return		Number of blocks actually read, or < 0 if there was an error.
+//!
+//! @note	If the end of the file is in the middle of a block, the rest of the block is filled with 0s.
+
+int64_t DirectFile::Read( unsigned handle, char * pBuffer, int64_t n )
+{
+	return Transfer( static_cast< int >( handle ), pBuffer, n, -1, false );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle	File descriptor
+//! @param	pBuffer	Location of the data.
+//! @param	n		Number of blocks to write.
+//!
+//! @return		Number of blocks actually written, or < 0 if there was an error.
+
+int64_t DirectFile::Write( unsigned handle, char const * pBuffer, int64_t n )
+{
+	return Transfer( static_cast< int >( handle ), const_cast< char * >( pBuffer ), n, -1, true );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		File descriptor
+//! @param	location	Where to put the file's current location (which block).
+//!
+//! @return		Resulting block location, or < 0 if there was an error.
+
+int64_t DirectFile::Seek( unsigned handle, int64_t location )
+{
+	off_t const	offset	= lseek( static_cast< int >( handle ), static_cast< off_t >( location * m_BlockSize ), SEEK_SET );
+
+	return ( offset >= 0 ) ? offset / m_BlockSize : -1;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		File descriptor
+//! @param	pBuffer		Location to put the data.
+//! @param	n			Number of blocks to read.
+//! @param	location	Location of the data (which block).
+//!
+//! @return		Number of blocks actually read, or < 0 if there was an error.
+//!
+//! @note	If the end of the file is in the middle of a block, the rest of the block is filled with 0s.
+
+int64_t DirectFile::ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location )
+{
+	assert( location >= 0 );
+
+	return Transfer( static_cast< int >( handle ), pBuffer, n, location, false );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		File descriptor
+//! @param	pBuffer		Location of the data.
+//! @param	n			Number of blocks to write.
+//! @param	location	Where to put the data (which block).
+//!
+//! @return		Number of blocks actually written, or < 0 if there was an error.
+
+int64_t DirectFile::WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location )
+{
+	assert( location >= 0 );
+
+	return Transfer( static_cast< int >( handle ), const_cast< char * >( pBuffer ), n, location, true );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The requirements are determined in this order:
+//!		-# statx() with STATX_DIOALIGN (Linux 6.1 and later, on file systems and devices that report it)
+//!		-# The logical block size of a block device (BLKSSZGET)
+//!		-# DEFAULT_ALIGNMENT
+
+void DirectFile::DiscoverAlignment()
+{
+	m_BlockSize		= DEFAULT_ALIGNMENT;
+	m_MemoryAlign	= DEFAULT_ALIGNMENT;
+
+#if defined( STATX_DIOALIGN )
+	struct statx	sx;
+
+	if ( statx( m_Fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &sx ) == 0 &&
+		 ( sx.stx_mask & STATX_DIOALIGN ) != 0 &&
+		 sx.stx_dio_offset_align != 0 && sx.stx_dio_mem_align != 0 )
+	{
+		m_BlockSize		= sx.stx_dio_offset_align;
+		m_MemoryAlign	= sx.stx_dio_mem_align;
+		return;
+	}
+#endif // defined( STATX_DIOALIGN )
+
+#if defined( BLKSSZGET )
+	struct stat		st;
+	int				logicalBlockSize;
+
+	if ( fstat( m_Fd, &st ) == 0 && S_ISBLK( st.st_mode ) &&
+		 ioctl( m_Fd, BLKSSZGET, &logicalBlockSize ) == 0 && logicalBlockSize > 0 )
+	{
+		m_BlockSize		= logicalBlockSize;
+		m_MemoryAlign	= logicalBlockSize;
+		return;
+	}
+#endif // defined( BLKSSZGET )
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Interrupted and partial transfers are continued. If the end of the file is reached in the middle of a block, the
+//! rest of the block is filled with 0s and the block is counted.
+
+int64_t DirectFile::Transfer( int fd, char * pBuffer, int64_t n, int64_t location, bool isWrite )
+{
+	assert( n >= 0 );
+	assert( ( reinterpret_cast< uintptr_t >( pBuffer ) & ( m_MemoryAlign - 1 ) ) == 0 );
+
+	int64_t const	size	= n * m_BlockSize;
+	int64_t			done	= 0;
+
+	while ( done < size )
+	{
+		size_t const	count	= static_cast< size_t >( size - done );
+		ssize_t			result;
+
+		if ( location >= 0 )
+		{
+			off_t const	offset	= static_cast< off_t >( location * m_BlockSize + done );
+
+			result = isWrite ? pwrite( fd, pBuffer + done, count, offset ) : pread( fd, pBuffer + done, count, offset );
+		}
+		else
+		{
+			result = isWrite ? write( fd, pBuffer + done, count ) : read( fd, pBuffer + done, count );
+		}
+
+		if ( result < 0 )
+		{
+			if ( errno == EINTR )
+			{
+				continue;
+			}
+
+			return ( done >= m_BlockSize ) ? done / m_BlockSize : -1;
+		}
+
+		if ( result == 0 )
+		{
+			break;
+		}
+
+		done += result;
+	}
+
+	// Pad a partial block at the end of the file.
+
+	int64_t const	partial	= done % m_BlockSize;
+
+	if ( partial != 0 && !isWrite )
+	{
+		memset( pBuffer + done, 0, static_cast< size_t >( m_BlockSize - partial ) );
+		done += m_BlockSize - partial;
+	}
+
+	return done / m_BlockSize;
+}
@@ -0,0 +1,395 @@
+/*********************************************************************************************************************
+
+                                                    MappedProxy.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/MappedProxy.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "MappedProxy.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	inline int64_t _Pad( int64_t n, int64_t m )
+	{
+		return ( n + m - 1 ) / m * m;
+	}
+
+} // anonymous namespace
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	fd			The file. It must be open for reading, and for writing too unless CF_READ_ONLY is set. It
+//!						is not closed when the proxy is destroyed.
+//! @param	flags		Configuration flags (see BufferedProxy)
+//! @param	windowSize	Size of the window. It is rounded up to a multiple of the page size. Files no larger than
+//!						this are mapped once and never remapped.
+
+MappedProxy::MappedProxy( int fd, unsigned flags, int64_t windowSize /* = 1024 * 1024 * 1024*/ )
+{
+	if ( windowSize <= 0 )
+	{
+		throw ConstructorFailedException( "The window size must be greater than 0." );
+	}
+
+	struct stat	st;
+
+	if ( fstat( fd, &st ) != 0 )
+	{
+		throw ConstructorFailedException( "Unable to determine the size of the file." );
+	}
+
+	m_Fd			= fd;
+	m_Flags			= flags;
+	m_WindowSize	= _Pad( windowSize, sysconf( _SC_PAGESIZE ) );
+	m_pWindow		= 0;
+	m_WindowLoc		= 0;
+	m_Location		= 0;
+	m_FileSize		= st.st_size;
+	m_AllocatedSize	= st.st_size;
+	m_IsDirty		= false;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+MappedProxy::~MappedProxy()
+{
+	Flush();
+
+	if ( m_pWindow != 0 )
+	{
+		munmap( m_pWindow, static_cast< size_t >( m_WindowSize ) );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pDst	Location to which data is to be copied from the file
+//! @param	n		Number of bytes to read
+//!
+//! @return		The number of bytes actually read, or < 0 if the window could not be mapped.
+
+int64_t MappedProxy::Read( void * pDst, int64_t n )
+{
+	int64_t	totalRead	= 0;
+
+	n = std::min( n, m_FileSize - m_Location );
+
+	while ( n > 0 )
+	{
+		if ( RemainingReadAmount() <= 0 && !MapWindow( m_Location ) )
+		{
+			return ( totalRead > 0 ) ? totalRead : -1;
+		}
+
+		int64_t const	bytesToRead	= std::min( n, RemainingReadAmount() );
+
+		memcpy( pDst, m_pWindow + ( m_Location - m_WindowLoc ), static_cast< size_t >( bytesToRead ) );
+		pDst = reinterpret_cast< char * >( pDst ) + bytesToRead;
+		m_Location += bytesToRead;
+		totalRead += bytesToRead;
+		n -= bytesToRead;
+	}
+
+	return totalRead;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pSrc	Location of the data to be written to the file
+//! @param	n		Number of bytes to write
+//!
+//! @return		The number of bytes actually written, or < 0 if there is an error.
+
+int64_t MappedProxy::Write( void const * pSrc, int64_t n )
+{
+	if ( ( m_Flags & BufferedProxy::CF_READ_ONLY ) != 0 || !Extend( m_Location + n ) )
+	{
+		return -1;
+	}
+
+	int64_t	totalWritten	= 0;
+
+	while ( n > 0 )
+	{
+		if ( RemainingWriteSpace() <= 0 && !MapWindow( m_Location ) )
+		{
+			return ( totalWritten > 0 ) ? totalWritten : -1;
+		}
+
+		int64_t const	bytesToWrite	= std::min( n, RemainingWriteSpace() );
+
+		memcpy( m_pWindow + ( m_Location - m_WindowLoc ), pSrc, static_cast< size_t >( bytesToWrite ) );
+		m_IsDirty = true;
+		pSrc = reinterpret_cast< char const * >( pSrc ) + bytesToWrite;
+		m_Location += bytesToWrite;
+		m_FileSize = std::max( m_FileSize, m_Location );
+		totalWritten += bytesToWrite;
+		n -= bytesToWrite;
+	}
+
+	return totalWritten;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The returned address points directly into the window. If the current location is not in the window, the window
+//! is moved first. The data must be consumed with Consume() in order to move the current location past it.
+//!
+//! @param	ppData	Where to store the address of the data.
+//!
+//! @return		The number of bytes available at the address, or 0 if the end of the data has been reached.
+//!
+//! @warning	The address is only valid until the next call to any other member function other than Consume().
+
+int64_t MappedProxy::Peek( void const ** ppData )
+{
+	*ppData = 0;
+
+	if ( m_Location >= m_FileSize || ( RemainingReadAmount() <= 0 && !MapWindow( m_Location ) ) )
+	{
+		return 0;
+	}
+
+	*ppData = m_pWindow + ( m_Location - m_WindowLoc );
+
+	return RemainingReadAmount();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	n	Number of bytes to consume. It must not be more than the amount returned by the last call to Peek().
+
+void MappedProxy::Consume( int64_t n )
+{
+	assert( n >= 0 && n <= RemainingReadAmount() );
+
+	m_Location += n;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Data is written directly to the returned space in the window instead of being copied with Write(). If the
+//! current location is not in the window, the window is moved first. The data must be committed with Commit().
+//!
+//! @param	ppSpace		Where to store the address of the space.
+//!
+//! @return		The number of bytes of space available at the address, or < 0 if there is an error.
+//!
+//! @warning	The address is only valid until the next call to any other member function other than Commit().
+
+int64_t MappedProxy::Reserve( void ** ppSpace )
+{
+	if ( ( m_Flags & BufferedProxy::CF_READ_ONLY ) != 0 ||
+		 ( RemainingWriteSpace() <= 0 && !MapWindow( m_Location ) ) ||
+		 !Extend( m_WindowLoc + m_WindowSize ) )
+	{
+		return -1;
+	}
+
+	*ppSpace = m_pWindow + ( m_Location - m_WindowLoc );
+
+	return RemainingWriteSpace();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	n	Number of bytes written. It must not be more than the amount returned by the last call to Reserve().
+
+void MappedProxy::Commit( int64_t n )
+{
+	assert( n >= 0 && n <= RemainingWriteSpace() );
+
+	m_Location += n;
+	m_FileSize = std::max( m_FileSize, m_Location );
+	m_IsDirty = true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! If the location is outside the window, the window is remapped there.
+//!
+//! @param	location	Where to put the current location (specified as the number of bytes from the beginning).
+
+int64_t MappedProxy::Seek( int64_t location )
+{
+	assert( location >= 0 );
+
+	m_Location = location;
+
+	if ( m_pWindow == 0 || location < m_WindowLoc || location >= m_WindowLoc + m_WindowSize )
+	{
+		if ( !MapWindow( location ) )
+		{
+			return -1;
+		}
+	}
+
+	return m_Location;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The data is written to the file as soon as it is written to the window, so it is visible to other users of the
+//! file immediately. Like a write to the file, it is written to disk later. This function starts writing the
+//! window to disk and removes any extra space from the end of the file.
+
+void MappedProxy::Flush()
+{
+	if ( m_IsDirty )
+	{
+		msync( m_pWindow, static_cast< size_t >( m_WindowSize ), MS_ASYNC );
+		m_IsDirty = false;
+	}
+
+	if ( m_AllocatedSize != m_FileSize )
+	{
+		if ( ftruncate( m_Fd, static_cast< off_t >( m_FileSize ) ) == 0 )
+		{
+			m_AllocatedSize = m_FileSize;
+		}
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t MappedProxy::RemainingReadAmount() const
+{
+	if ( m_pWindow == 0 || m_Location < m_WindowLoc )
+	{
+		return 0;
+	}
+
+	return std::max< int64_t >( std::min( m_WindowLoc + m_WindowSize, m_FileSize ) - m_Location, 0 );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t MappedProxy::RemainingWriteSpace() const
+{
+	if ( m_pWindow == 0 || m_Location < m_WindowLoc )
+	{
+		return 0;
+	}
+
+	return std::max< int64_t >( m_WindowLoc + m_WindowSize - m_Location, 0 );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The window starts at the page containing the location.
+
+bool MappedProxy::MapWindow( int64_t location )
+{
+	if ( m_pWindow != 0 )
+	{
+		if ( m_IsDirty )
+		{
+			msync( m_pWindow, static_cast< size_t >( m_WindowSize ), MS_ASYNC );
+			m_IsDirty = false;
+		}
+
+		munmap( m_pWindow, static_cast< size_t >( m_WindowSize ) );
+		m_pWindow = 0;
+	}
+
+	int const	prot	= ( ( m_Flags & BufferedProxy::CF_READ_ONLY ) != 0 ) ? PROT_READ : PROT_READ | PROT_WRITE;
+	void *		pWindow;
+
+	m_WindowLoc = location - location % sysconf( _SC_PAGESIZE );
+
+	pWindow = mmap( 0, static_cast< size_t >( m_WindowSize ), prot, MAP_SHARED, m_Fd, static_cast< off_t >( m_WindowLoc ) );
+	if ( pWindow == MAP_FAILED )
+	{
+		return false;
+	}
+
+	m_pWindow = static_cast< char * >( pWindow );
+
+	// Tell the system how the window will be accessed
+
+	madvise( m_pWindow, static_cast< size_t >( m_WindowSize ),
+			 ( ( m_Flags & BufferedProxy::CF_RANDOM_ACCESS ) != 0 ) ? MADV_RANDOM : MADV_SEQUENTIAL );
+
+	return true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The file grows by at least half of its size at a time, so that it is not resized for every write.
+
+bool MappedProxy::Extend( int64_t size )
+{
+	if ( size <= m_AllocatedSize )
+	{
+		return true;
+	}
+
+	int64_t const	newSize	= std::max( size, m_AllocatedSize + m_AllocatedSize / 2 );
+
+	if ( ftruncate( m_Fd, static_cast< off_t >( newSize ) ) != 0 )
+	{
+		return false;
+	}
+
+	m_AllocatedSize = newSize;
+
+	return true;
+}
@@ -0,0 +1,240 @@
+/*********************************************************************************************************************
+
+                                                   MemoryObject.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/MemoryObject.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "MemoryObject.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	blockSize		Size of a block. It should match the block size given to the proxy.
+//! @param	size			Initial size of the data. The data is initialized to a repeating pattern.
+//! @param	isPositional	If true, the object advertises ReadAt() and WriteAt() (see IsPositional()).
+
+MemoryObject::MemoryObject( int64_t blockSize, int64_t size /* = 0*/, bool isPositional /* = false*/ )
+	: m_Data( static_cast< size_t >( size ) ),
+	  m_BlockSize( blockSize ),
+	  m_Location( 0 ),
+	  m_IsPositional( isPositional ),
+	  m_ReadCount( 0 ),
+	  m_WriteCount( 0 ),
+	  m_SeekCount( 0 )
+{
+	if ( blockSize <= 0 )
+	{
+		throw ConstructorFailedException( "The block size must be greater than 0." );
+	}
+
+	for ( size_t i = 0; i < m_Data.size(); ++i )
+	{
+		m_Data[ i ] = static_cast< char >( i * 7 + i / 251 );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+MemoryObject::~MemoryObject()
+{
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void MemoryObject::ResetCounts()
+{
+	m_ReadCount.store( 0, std::memory_order_relaxed );
+	m_WriteCount.store( 0, std::memory_order_relaxed );
+	m_SeekCount.store( 0, std::memory_order_relaxed );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle	Ignored
+//! @param	pBuffer	Location to put the data.
+//! @param	n		Number of blocks to read.
+//!
+//! @return		Number of blocks actually read.
+//!
+//! @note	If the end of the data is in the middle of a block, the rest of the block is filled with 0s.
+
+int64_t MemoryObject::Read( unsigned /* handle */, char * pBuffer, int64_t n )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	m_ReadCount.fetch_add( 1, std::memory_order_relaxed );
+
+	int64_t const	blocksRead	= CopyOut( pBuffer, n, m_Location );
+
+	m_Location += blocksRead;
+
+	return blocksRead;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle	Ignored
+//! @param	pBuffer	Location of the data.
+//! @param	n		Number of blocks to write.
+//!
+//! @return		Number of blocks actually written.
+
+int64_t MemoryObject::Write( unsigned /* handle */, char const * pBuffer, int64_t n )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	m_WriteCount.fetch_add( 1, std::memory_order_relaxed );
+
+	int64_t const	blocksWritten	= CopyIn( pBuffer, n, m_Location );
+
+	m_Location += blocksWritten;
+
+	return blocksWritten;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		Ignored
+//! @param	location	Where to put the current location (which block).
+//!
+//! @return		Resulting block location, or < 0 if there was an error.
+
+int64_t MemoryObject::Seek( unsigned /* handle */, int64_t location )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	m_SeekCount.fetch_add( 1, std::memory_order_relaxed );
+
+	if ( location < 0 )
+	{
+		return -1;
+	}
+
+	m_Location = location;
+
+	return m_Location;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		Ignored
+//! @param	pBuffer		Location to put the data.
+//! @param	n			Number of blocks to read.
+//! @param	location	Location of the data (which block).
+//!
+//! @return		Number of blocks actually read.
+//!
+//! @note	If the end of the data is in the middle of a block, the rest of the block is filled with 0s.
+
+int64_t MemoryObject::ReadAt( unsigned /* handle */, char * pBuffer, int64_t n, int64_t location )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	m_ReadCount.fetch_add( 1, std::memory_order_relaxed );
+
+	return CopyOut( pBuffer, n, location );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		Ignored
+//! @param	pBuffer		Location of the data.
+//! @param	n			Number of blocks to write.
+//! @param	location	Where to put the data (which block).
+//!
+//! @return		Number of blocks actually written.
+
+int64_t MemoryObject::WriteAt( unsigned /* handle */, char const * pBuffer, int64_t n, int64_t location )
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	m_WriteCount.fetch_add( 1, std::memory_order_relaxed );
+
+	return CopyIn( pBuffer, n, location );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t MemoryObject::CopyOut( char * pBuffer, int64_t n, int64_t location )
+{
+	assert( n >= 0 && location >= 0 );
+
+	int64_t const	start	= location * m_BlockSize;
+	int64_t const	size	= std::max< int64_t >( std::min( n * m_BlockSize, Size() - start ), 0 );
+	int64_t const	blocks	= ( size + m_BlockSize - 1 ) / m_BlockSize;
+
+	if ( size > 0 )
+	{
+		memcpy( pBuffer, &m_Data[ static_cast< size_t >( start ) ], static_cast< size_t >( size ) );
+	}
+
+	// Pad a partial block at the end of the data
+
+	memset( pBuffer + size, 0, static_cast< size_t >( blocks * m_BlockSize - size ) );
+
+	return blocks;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t MemoryObject::CopyIn( char const * pBuffer, int64_t n, int64_t location )
+{
+	assert( n >= 0 && location >= 0 );
+
+	int64_t const	start	= location * m_BlockSize;
+	int64_t const	size	= n * m_BlockSize;
+
+	if ( start + size > Size() )
+	{
+		m_Data.resize( static_cast< size_t >( start + size ) );
+	}
+
+	if ( size > 0 )
+	{
+		memcpy( &m_Data[ static_cast< size_t >( start ) ], pBuffer, static_cast< size_t >( size ) );
+	}
+
+	return n;
+}
@@ -0,0 +1,719 @@
+/*********************************************************************************************************************
+
+                                                  SharedBlockCache.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/SharedBlockCache.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "SharedBlockCache.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	// Maximum number of stripes
+	int const	STRIPE_COUNT	= 16;
+
+} // anonymous namespace
+
+
+// A page holds the data of one handle at a location that is a multiple of the page size. While a page is pinned by
+// readers or by a writer, or while it is being written back, it is not evicted. The data in a page is only changed by
+// the writer that has pinned it, and a writer cannot pin a page that is being written back.
+
+struct SharedBlockCache::Page
+{
+	char *		pBuffer;		// The page's memory
+	unsigned	handle;			// Handle of the data in the page
+	int64_t		location;		// Location of the page (in blocks), or < 0 if unused
+	int64_t		dataSize;		// Size of the data in the page (in blocks)
+	int64_t		dirtyBegin;		// First block that has not been written back yet
+	int64_t		dirtyEnd;		// End of the blocks that have not been written back yet (the page is clean if empty)
+	int			readers;		// Number of threads copying from the page
+	bool		isWriting;		// True while a thread is copying to the page
+	bool		isLoading;		// True while the page is being read from the buffered object
+	bool		isWritingBack;	// True while the page is being written to the buffered object
+	bool		isReferenced;	// True if the page has been used since the clock hand last passed it
+};
+
+
+// A stripe is a group of pages with its own lock. Each page in the cache belongs to one stripe, and the stripe
+// holding the data at a location is determined by the handle and the location.
+
+struct SharedBlockCache::Stripe
+{
+	typedef std::pair< unsigned, int64_t >	Key;	// Handle and location of a page
+
+	std::vector< Page >			pages;		// Pages
+	std::map< Key, int >		index;		// Maps the handle and location of each cached page to its index
+	int							hand;		// Index of the next page to consider for eviction
+	std::mutex					mutex;		// Guards the stripe
+	std::condition_variable		changed;	// Signaled when a page has been loaded, written back, or unpinned
+};
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pObject		The buffered object whose blocks are cached. Its handles are passed through unchanged.
+//! @param	pMemory		Memory for the pages. It must remain valid as long as the cache exists. If the buffered
+//!						object requires aligned buffers, the address must be aligned.
+//! @param	memorySize	Size of the memory. It is divided into as many pages as will fit.
+//! @param	pageSize	Size of each page. It must be a multiple of the block size.
+//! @param	blockSize	Size of a block. It should match the block size given to the proxies, and it must satisfy
+//!						the buffered object's alignment requirements, because blocks are written back individually.
+
+SharedBlockCache::SharedBlockCache( BufferedProxy::BufferedObject * pObject,
+									void * pMemory,
+									int64_t memorySize,
+									int64_t pageSize,
+									int64_t blockSize )
+	: m_pObject( pObject ),
+	  m_BlockSize( blockSize ),
+	  m_PageSizeInBlocks( 0 ),
+	  m_paStripes( 0 ),
+	  m_StripeCount( 0 ),
+	  m_WriteFailed( false ),
+	  m_HitCount( 0 ),
+	  m_MissCount( 0 ),
+	  m_WriteBackCount( 0 )
+{
+	if ( blockSize <= 0 )
+	{
+		throw ConstructorFailedException( "The block size must be greater than 0." );
+	}
+
+	if ( pageSize <= 0 || pageSize % blockSize != 0 )
+	{
+		throw ConstructorFailedException( "The page size must be a multiple of the block size." );
+	}
+
+	if ( pageSize > memorySize )
+	{
+		throw ConstructorFailedException( "The memory must hold at least one page." );
+	}
+
+	int64_t const	pageCount	= memorySize / pageSize;
+
+	m_PageSizeInBlocks	= pageSize / blockSize;
+	m_StripeCount		= static_cast< int >( std::min< int64_t >( pageCount, STRIPE_COUNT ) );
+	m_paStripes			= new Stripe[ m_StripeCount ];
+
+	// The pages are dealt out to the stripes.
+
+	for ( int64_t i = 0; i < pageCount; ++i )
+	{
+		Page	page;
+
+		page.pBuffer		= static_cast< char * >( pMemory ) + i * pageSize;
+		page.handle			= 0;
+		page.location		= -1;
+		page.dataSize		= 0;
+		page.dirtyBegin		= 0;
+		page.dirtyEnd		= 0;
+		page.readers		= 0;
+		page.isWriting		= false;
+		page.isLoading		= false;
+		page.isWritingBack	= false;
+		page.isReferenced	= false;
+
+		m_paStripes[ i % m_StripeCount ].pages.push_back( page );
+	}
+
+	for ( int i = 0; i < m_StripeCount; ++i )
+	{
+		m_paStripes[ i ].hand = 0;
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+SharedBlockCache::~SharedBlockCache()
+{
+	Flush();
+	delete[] m_paStripes;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The pages remain in the cache. Pages that are being written to are written back after the writes are done. The
+//! stripes are not locked while the pages are being written back.
+//!
+//! @note	The proxies attached to the cache must be flushed first, or the data in their buffers is not included.
+
+bool SharedBlockCache::Flush()
+{
+	bool	ok	= true;
+
+	for ( int i = 0; i < m_StripeCount; ++i )
+	{
+		Stripe &						stripe	= m_paStripes[ i ];
+		std::unique_lock< std::mutex >	lock( stripe.mutex );
+
+		for ( size_t j = 0; j < stripe.pages.size(); ++j )
+		{
+			Page &	page	= stripe.pages[ j ];
+
+			stripe.changed.wait( lock, [&page] { return !page.isWriting && !page.isLoading && !page.isWritingBack; } );
+
+			if ( page.location >= 0 && !WriteBack( stripe, lock, page ) )
+			{
+				ok = false;
+			}
+		}
+	}
+
+	return ok;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SharedBlockCache::Read( unsigned handle, char * pBuffer, int64_t n )
+{
+	int64_t	location;
+
+	{
+		std::lock_guard< std::mutex >	lock( m_LocationMutex );
+
+		location = m_Locations[ handle ];
+	}
+
+	int64_t const	blocksRead	= ReadAt( handle, pBuffer, n, location );
+
+	if ( blocksRead > 0 )
+	{
+		std::lock_guard< std::mutex >	lock( m_LocationMutex );
+
+		m_Locations[ handle ] = location + blocksRead;
+	}
+
+	return blocksRead;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SharedBlockCache::Write( unsigned handle, char const * pBuffer, int64_t n )
+{
+	int64_t	location;
+
+	{
+		std::lock_guard< std::mutex >	lock( m_LocationMutex );
+
+		location = m_Locations[ handle ];
+	}
+
+	int64_t const	blocksWritten	= WriteAt( handle, pBuffer, n, location );
+
+	if ( blocksWritten > 0 )
+	{
+		std::lock_guard< std::mutex >	lock( m_LocationMutex );
+
+		m_Locations[ handle ] = location + blocksWritten;
+	}
+
+	return blocksWritten;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SharedBlockCache::Seek( unsigned handle, int64_t location )
+{
+	if ( location < 0 )
+	{
+		return -1;
+	}
+
+	std::lock_guard< std::mutex >	lock( m_LocationMutex );
+
+	m_Locations[ handle ] = location;
+
+	return location;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Only the pages that are not already in the cache are read from the buffered object. If several threads need the
+//! same page at once, it is read once and the other threads wait for it.
+
+int64_t SharedBlockCache::ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location )
+{
+	int64_t	blocksRead	= 0;
+
+	while ( blocksRead < n )
+	{
+		int64_t const	block			= location + blocksRead;
+		int64_t const	offset			= block % m_PageSizeInBlocks;	// Offset of the block in its page
+		int64_t const	pageLocation	= block - offset;
+		Stripe &		stripe			= GetStripe( handle, pageLocation );
+
+		std::unique_lock< std::mutex >	lock( stripe.mutex );
+
+		int const	index	= Acquire( stripe, lock, handle, pageLocation, false, true );
+
+		if ( index < 0 )
+		{
+			return ( blocksRead > 0 ) ? blocksRead : -1;
+		}
+
+		Page &			page	= stripe.pages[ index ];
+		int64_t const	count	= std::max< int64_t >( std::min( n - blocksRead, page.dataSize - offset ), 0 );
+		bool const		isEnd	= page.dataSize < m_PageSizeInBlocks;	// The data ends in this page
+
+		// Other readers can copy from the page at the same time, but it can't be changed or evicted while it is
+		// pinned.
+
+		lock.unlock();
+		memcpy( pBuffer + blocksRead * m_BlockSize, page.pBuffer + offset * m_BlockSize, static_cast< size_t >( count * m_BlockSize ) );
+		lock.lock();
+
+		Release( stripe, page, false );
+
+		blocksRead += count;
+
+		if ( isEnd )
+		{
+			break;
+		}
+	}
+
+	return blocksRead;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The data is copied to the pages and written back later. A page is read from the buffered object first, unless
+//! it is entirely overwritten.
+
+int64_t SharedBlockCache::WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location )
+{
+	if ( m_WriteFailed.load() )
+	{
+		return -1;
+	}
+
+	int64_t	blocksWritten	= 0;
+
+	while ( blocksWritten < n )
+	{
+		int64_t const	block			= location + blocksWritten;
+		int64_t const	offset			= block % m_PageSizeInBlocks;	// Offset of the block in its page
+		int64_t const	pageLocation	= block - offset;
+		int64_t const	count			= std::min( n - blocksWritten, m_PageSizeInBlocks - offset );
+		Stripe &		stripe			= GetStripe( handle, pageLocation );
+
+		std::unique_lock< std::mutex >	lock( stripe.mutex );
+
+		int const	index	= Acquire( stripe, lock, handle, pageLocation, true, count < m_PageSizeInBlocks );
+
+		if ( index < 0 )
+		{
+			return ( blocksWritten > 0 ) ? blocksWritten : -1;
+		}
+
+		Page &	page	= stripe.pages[ index ];
+
+		// Nothing else can use the page while it is pinned by a writer. If the data in the page ends before the
+		// write starts, the gap is cleared.
+
+		lock.unlock();
+
+		if ( offset > page.dataSize )
+		{
+			memset( page.pBuffer + page.dataSize * m_BlockSize, 0, static_cast< size_t >( ( offset - page.dataSize ) * m_BlockSize ) );
+		}
+
+		memcpy( page.pBuffer + offset * m_BlockSize, pBuffer + blocksWritten * m_BlockSize, static_cast< size_t >( count * m_BlockSize ) );
+
+		lock.lock();
+
+		page.dataSize = std::max( page.dataSize, offset + count );
+
+		if ( page.dirtyEnd > page.dirtyBegin )
+		{
+			page.dirtyBegin	= std::min( page.dirtyBegin, offset );
+			page.dirtyEnd	= std::max( page.dirtyEnd, offset + count );
+		}
+		else
+		{
+			page.dirtyBegin	= offset;
+			page.dirtyEnd	= offset + count;
+		}
+
+		Release( stripe, page, true );
+
+		blocksWritten += count;
+	}
+
+	return blocksWritten;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Consecutive pages of a handle are spread across the stripes.
+
+SharedBlockCache::Stripe & SharedBlockCache::GetStripe( unsigned handle, int64_t location )
+{
+	uint64_t const	hash	= ( static_cast< uint64_t >( location / m_PageSizeInBlocks ) + handle * 0x9E3779B97F4A7C15ULL );
+
+	return m_paStripes[ hash % static_cast< uint64_t >( m_StripeCount ) ];
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Readers share a page, but a writer has it to itself, so this waits until the page can be pinned as requested.
+//! If the page is not in the cache, a page is evicted to make room for it, and the data is read from the buffered
+//! object (unless @a fill is false). The stripe is unlocked while waiting and while reading.
+//!
+//! @param	stripe		The stripe holding the page
+//! @param	lock		Lock on the stripe's mutex
+//! @param	handle		Handle of the data
+//! @param	location	Location of the page (in blocks)
+//! @param	exclusive	If true, the page is pinned by a writer. Otherwise, it is pinned by a reader.
+//! @param	fill		If false, the page is about to be entirely overwritten, so it is not read if it is not cached.
+//!
+//! @return		The index of the page in the stripe, or < 0 if the page could not be read
+
+int SharedBlockCache::Acquire( Stripe & stripe,
+							   std::unique_lock< std::mutex > & lock,
+							   unsigned handle,
+							   int64_t location,
+							   bool exclusive,
+							   bool fill )
+{
+	Stripe::Key const	key( handle, location );
+
+	for ( ;; )
+	{
+		std::map< Stripe::Key, int >::iterator	entry	= stripe.index.find( key );
+
+		if ( entry != stripe.index.end() )
+		{
+			Page &	page	= stripe.pages[ entry->second ];
+
+			// If the page is busy, wait and look again, because it could have been evicted in the meantime. Readers
+			// can copy from a page while it is being written back, but a writer can't change it.
+
+			if ( page.isLoading || page.isWriting || ( exclusive && ( page.readers > 0 || page.isWritingBack ) ) )
+			{
+				stripe.changed.wait( lock );
+				continue;
+			}
+
+			m_HitCount.fetch_add( 1, std::memory_order_relaxed );
+
+			page.isReferenced = true;
+			if ( exclusive )
+			{
+				page.isWriting = true;
+			}
+			else
+			{
+				++page.readers;
+			}
+
+			return entry->second;
+		}
+
+		// The page is not in the cache, so make room for it. If all of the pages are in use, wait and look again,
+		// because another thread could have loaded it in the meantime.
+
+		int const	index	= Evict( stripe, lock );
+
+		if ( index < 0 )
+		{
+			stripe.changed.wait( lock );
+			continue;
+		}
+
+		// The stripe may have been unlocked while the evicted page was written back, so another thread could have
+		// loaded the page in the meantime. If so, the evicted page is left unused.
+
+		if ( stripe.index.find( key ) != stripe.index.end() )
+		{
+			continue;
+		}
+
+		m_MissCount.fetch_add( 1, std::memory_order_relaxed );
+
+		Page &	page	= stripe.pages[ index ];
+
+		page.handle			= handle;
+		page.location		= location;
+		page.dataSize		= 0;
+		page.dirtyBegin		= 0;
+		page.dirtyEnd		= 0;
+		page.isReferenced	= true;
+
+		stripe.index[ key ] = index;
+
+		if ( fill )
+		{
+			page.isLoading = true;
+			lock.unlock();
+
+			int64_t const	blocksRead	= ReadObject( handle, page.pBuffer, m_PageSizeInBlocks, location );
+
+			lock.lock();
+			page.isLoading = false;
+			stripe.changed.notify_all();
+
+			if ( blocksRead < 0 )
+			{
+				stripe.index.erase( key );
+				page.location = -1;
+				return -1;
+			}
+
+			page.dataSize = blocksRead;
+		}
+
+		if ( exclusive )
+		{
+			page.isWriting = true;
+		}
+		else
+		{
+			++page.readers;
+		}
+
+		return index;
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+void SharedBlockCache::Release( Stripe & stripe, Page & page, bool exclusive )
+{
+	if ( exclusive )
+	{
+		assert( page.isWriting );
+		page.isWriting = false;
+	}
+	else
+	{
+		assert( page.readers > 0 );
+		--page.readers;
+	}
+
+	stripe.changed.notify_all();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The pages are evicted using the CLOCK algorithm. Pinned pages are skipped. A modified page is written back
+//! before it is evicted, and since the stripe is unlocked while it is being written back, it is only evicted if it
+//! was not used in the meantime.
+
+int SharedBlockCache::Evict( Stripe & stripe, std::unique_lock< std::mutex > & lock )
+{
+	int const	pageCount	= static_cast< int >( stripe.pages.size() );
+
+	// Each page is passed at most twice: once to clear its reference bit and once to evict it.
+
+	for ( int i = 0; i < 2 * pageCount; ++i )
+	{
+		int const	index	= stripe.hand;
+		Page &		page	= stripe.pages[ index ];
+
+		stripe.hand = ( stripe.hand + 1 ) % pageCount;
+
+		if ( page.readers > 0 || page.isWriting || page.isLoading || page.isWritingBack )
+		{
+			continue;
+		}
+
+		if ( page.isReferenced )
+		{
+			page.isReferenced = false;
+			continue;
+		}
+
+		if ( page.location >= 0 )
+		{
+			if ( page.dirtyEnd > page.dirtyBegin )
+			{
+				WriteBack( stripe, lock, page );
+
+				if ( page.readers > 0 || page.isReferenced || page.dirtyEnd > page.dirtyBegin )
+				{
+					continue;
+				}
+			}
+
+			stripe.index.erase( Stripe::Key( page.handle, page.location ) );
+			page.location = -1;
+		}
+
+		return index;
+	}
+
+	return -1;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The page is marked as being written back and the stripe is unlocked during the write, so other threads can use
+//! the stripe (and copy from the page) in the meantime. If the blocks cannot be written, they are lost, and all
+//! subsequent writes fail.
+//!
+//! @param	stripe		The stripe holding the page
+//! @param	lock		Lock on the stripe's mutex
+//! @param	page		The page. It must not be pinned by a writer or being loaded or written back.
+
+bool SharedBlockCache::WriteBack( Stripe & stripe, std::unique_lock< std::mutex > & lock, Page & page )
+{
+	assert( !page.isWriting && !page.isLoading && !page.isWritingBack );
+
+	if ( page.dirtyEnd <= page.dirtyBegin )
+	{
+		return true;
+	}
+
+	int64_t const	begin	= page.dirtyBegin;
+	int64_t const	n		= page.dirtyEnd - page.dirtyBegin;
+
+	page.dirtyBegin		= 0;
+	page.dirtyEnd		= 0;
+	page.isWritingBack	= true;
+	lock.unlock();
+
+	int64_t const	blocksWritten	= WriteObject( page.handle, page.pBuffer + begin * m_BlockSize, n, page.location + begin );
+
+	lock.lock();
+	page.isWritingBack = false;
+	stripe.changed.notify_all();
+
+	m_WriteBackCount.fetch_add( 1, std::memory_order_relaxed );
+
+	if ( blocksWritten != n )
+	{
+		m_WriteFailed.store( true );
+		return false;
+	}
+
+	return true;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The buffered object may transfer fewer blocks than requested, so the read is repeated until all of the blocks
+//! have been read or the end of the data is reached.
+
+int64_t SharedBlockCache::ReadObject( unsigned handle, char * pBuffer, int64_t n, int64_t location )
+{
+	std::unique_lock< std::mutex >	lock( m_ObjectMutex, std::defer_lock );
+
+	if ( !m_pObject->IsPositional() )
+	{
+		lock.lock();
+	}
+
+	int64_t	blocksRead	= 0;
+
+	while ( blocksRead < n )
+	{
+		int64_t const	result	= m_pObject->ReadAt( handle, pBuffer + blocksRead * m_BlockSize, n - blocksRead, location + blocksRead );
+
+		if ( result < 0 )
+		{
+			return ( blocksRead > 0 ) ? blocksRead : result;
+		}
+
+		if ( result == 0 )
+		{
+			break;
+		}
+
+		blocksRead += result;
+	}
+
+	return blocksRead;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The buffered object may transfer fewer blocks than requested, so the write is repeated until all of the blocks
+//! have been written.
+
+int64_t SharedBlockCache::WriteObject( unsigned handle, char const * pBuffer, int64_t n, int64_t location )
+{
+	std::unique_lock< std::mutex >	lock( m_ObjectMutex, std::defer_lock );
+
+	if ( !m_pObject->IsPositional() )
+	{
+		lock.lock();
+	}
+
+	int64_t	blocksWritten	= 0;
+
+	while ( blocksWritten < n )
+	{
+		int64_t const	result	= m_pObject->WriteAt( handle, pBuffer + blocksWritten * m_BlockSize, n - blocksWritten, location + blocksWritten );
+
+		if ( result <= 0 )
+		{
+			return ( blocksWritten > 0 ) ? blocksWritten : result;
+		}
+
+		blocksWritten += result;
+	}
+
+	return blocksWritten;
+}
@@ -0,0 +1,294 @@
+/*********************************************************************************************************************
+
+                                                  SimulatedObject.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/SimulatedObject.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "SimulatedObject.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+namespace
+{
+	int64_t const	GIB		= 1024 * 1024 * 1024;
+	int64_t const	NS		= 1000000000;
+
+} // anonymous namespace
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! A 7200 RPM drive: several milliseconds to rotate and seek, about 150 MB/s once the data is found.
+
+SimulatedObject::Profile SimulatedObject::Hdd()
+{
+	Profile const	profile	= { 4000000, 150000000, 8000000, 8000000, 0, 0.0 };
+
+	return profile;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! A network-attached array: half a millisecond round trip, about 1 GB/s, and no seek penalty. Large transfers are
+//! split by the network.
+
+SimulatedObject::Profile SimulatedObject::San()
+{
+	Profile const	profile	= { 500000, 1000000000, 0, 0, 2048, 0.0 };
+
+	return profile;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! A flash drive: tens of microseconds of latency, about 3 GB/s, and no seek penalty.
+
+SimulatedObject::Profile SimulatedObject::Nvme()
+{
+	Profile const	profile	= { 20000, 3000000000LL, 0, 0, 0, 0.0 };
+
+	return profile;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pObject		The buffered object whose calls are delayed. Its handles are passed through unchanged.
+//! @param	profile		Characteristics of the simulated device.
+//! @param	blockSize	Size of a block. It should match the block size given to the proxy.
+//! @param	sleeps		If true, the calling thread sleeps for the delay. Otherwise, the delay is only added to the
+//!						simulated time (see SimulatedTime()).
+
+SimulatedObject::SimulatedObject( BufferedProxy::BufferedObject * pObject,
+								  Profile const & profile,
+								  int64_t blockSize,
+								  bool sleeps /* = true*/ )
+	: m_pObject( pObject ),
+	  m_Profile( profile ),
+	  m_BlockSize( blockSize ),
+	  m_Sleeps( sleeps ),
+	  m_Location( 0 ),
+	  m_Head( 0 ),
+	  m_SimulatedTime( 0 ),
+	  m_Random( 12345 )
+{
+	if ( blockSize <= 0 )
+	{
+		throw ConstructorFailedException( "The block size must be greater than 0." );
+	}
+
+	if ( profile.shortRate < 0.0 || profile.shortRate > 1.0 )
+	{
+		throw ConstructorFailedException( "The short transfer rate must be between 0 and 1." );
+	}
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+SimulatedObject::~SimulatedObject()
+{
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SimulatedObject::SimulatedTime() const
+{
+	std::lock_guard< std::mutex >	lock( m_Mutex );
+
+	return m_SimulatedTime;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SimulatedObject::Read( unsigned handle, char * pBuffer, int64_t n )
+{
+	n = Shorten( n );
+	Delay( m_Location, n );
+
+	int64_t const	blocksRead	= m_pObject->Read( handle, pBuffer, n );
+
+	if ( blocksRead > 0 )
+	{
+		m_Location += blocksRead;
+	}
+
+	return blocksRead;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SimulatedObject::Write( unsigned handle, char const * pBuffer, int64_t n )
+{
+	n = Shorten( n );
+	Delay( m_Location, n );
+
+	int64_t const	blocksWritten	= m_pObject->Write( handle, pBuffer, n );
+
+	if ( blocksWritten > 0 )
+	{
+		m_Location += blocksWritten;
+	}
+
+	return blocksWritten;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Seeking itself takes no time. The seek penalty is added to the read or write that follows.
+
+int64_t SimulatedObject::Seek( unsigned handle, int64_t location )
+{
+	int64_t const	result	= m_pObject->Seek( handle, location );
+
+	if ( result >= 0 )
+	{
+		m_Location = result;
+	}
+
+	return result;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+bool SimulatedObject::IsPositional() const
+{
+	return m_pObject->IsPositional();
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SimulatedObject::ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location )
+{
+	n = Shorten( n );
+	Delay( location, n );
+
+	return m_pObject->ReadAt( handle, pBuffer, n, location );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t SimulatedObject::WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location )
+{
+	n = Shorten( n );
+	Delay( location, n );
+
+	return m_pObject->WriteAt( handle, pBuffer, n, location );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! A transfer is limited to the profile's maximum number of blocks. A short transfer transfers a random number of
+//! blocks (at least 1).
+
+int64_t SimulatedObject::Shorten( int64_t n )
+{
+	if ( m_Profile.maxBlocks > 0 )
+	{
+		n = std::min( n, m_Profile.maxBlocks );
+	}
+
+	if ( n > 1 && m_Profile.shortRate > 0.0 )
+	{
+		std::lock_guard< std::mutex >	lock( m_Mutex );
+
+		if ( std::uniform_real_distribution< double >( 0.0, 1.0 )( m_Random ) < m_Profile.shortRate )
+		{
+			n = std::uniform_int_distribution< int64_t >( 1, n - 1 )( m_Random );
+		}
+	}
+
+	return n;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! Concurrent transfers are delayed concurrently, as if the device had a queue for each thread.
+
+void SimulatedObject::Delay( int64_t location, int64_t n )
+{
+	int64_t	delay	= m_Profile.latency;
+
+	{
+		std::lock_guard< std::mutex >	lock( m_Mutex );
+
+		// Seek penalty
+
+		int64_t const	distance	= std::abs( location - m_Head ) * m_BlockSize;
+
+		if ( distance > 0 && m_Profile.seekPenalty > 0 )
+		{
+			int64_t const	penalty	= static_cast< int64_t >( static_cast< double >( distance ) / GIB * m_Profile.seekPenalty );
+
+			delay += ( m_Profile.maxSeekPenalty > 0 ) ? std::min( penalty, m_Profile.maxSeekPenalty ) : penalty;
+		}
+
+		// Transfer time
+
+		if ( m_Profile.bandwidth > 0 )
+		{
+			delay += static_cast< int64_t >( static_cast< double >( n * m_BlockSize ) * NS / m_Profile.bandwidth );
+		}
+
+		m_Head = location + n;
+		m_SimulatedTime += delay;
+	}
+
+	if ( m_Sleeps && delay > 0 )
+	{
+		std::this_thread::sleep_for( std::chrono::nanoseconds( delay ) );
+	}
+}
@@ -0,0 +1,580 @@
+/*********************************************************************************************************************
+
+                                                     UringFile.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/UringFile.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+#include "UringFile.h"
+
+#include "Misc/exceptions.h"
+#include "Misc/assert.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+	inline int _Setup( unsigned entries, io_uring_params * pParams )
+	{
+		return static_cast< int >( syscall( __NR_io_uring_setup, entries, pParams ) );
+	}
+
+	inline int _Enter( int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags )
+	{
+		return static_cast< int >( syscall( __NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, 0, 0 ) );
+	}
+
+	inline int64_t _Pad( int64_t n, int64_t m )
+	{
+		return ( n + m - 1 ) / m * m;
+	}
+
+} // anonymous namespace
+
+
+// The io_uring
+//
+// The submission and completion queues are shared with the kernel. All access is guarded by the mutex, except that
+// one thread at a time (the reaper) may wait for completions in the kernel without holding it.
+
+struct UringFile::Ring
+{
+	Ring()
+		: fd( -1 ),
+		  pSqRing( MAP_FAILED ),
+		  pCqRing( MAP_FAILED ),
+		  pSqes( static_cast< io_uring_sqe * >( MAP_FAILED ) ),
+		  inFlight( 0 ),
+		  isReaping( false )
+	{
+	}
+
+	~Ring()
+	{
+		if ( pSqes != MAP_FAILED )
+		{
+			munmap( pSqes, sqesSize );
+		}
+		if ( pCqRing != MAP_FAILED && pCqRing != pSqRing )
+		{
+			munmap( pCqRing, cqRingSize );
+		}
+		if ( pSqRing != MAP_FAILED )
+		{
+			munmap( pSqRing, sqRingSize );
+		}
+		if ( fd >= 0 )
+		{
+			close( fd );
+		}
+	}
+
+	int						fd;				// The ring's file descriptor
+	void *					pSqRing;		// Mapped submission queue
+	size_t					sqRingSize;		// Size of the mapped submission queue
+	void *					pCqRing;		// Mapped completion queue (same as pSqRing if they share a mapping)
+	size_t					cqRingSize;		// Size of the mapped completion queue
+	io_uring_sqe *			pSqes;			// Mapped submission queue entries
+	size_t					sqesSize;		// Size of the mapped submission queue entries
+	unsigned *				pSqTail;		// Submission queue tail (written by us)
+	unsigned *				pSqMask;		// Submission queue index mask
+	unsigned *				pSqArray;		// Submission queue indexes of the entries
+	unsigned *				pCqHead;		// Completion queue head (written by us)
+	unsigned *				pCqTail;		// Completion queue tail (written by the kernel)
+	unsigned *				pCqMask;		// Completion queue index mask
+	io_uring_cqe *			pCqes;			// Completion queue entries
+	unsigned				inFlight;		// Number of chunks submitted and not yet reaped
+	bool					isReaping;		// True if a thread is waiting for completions in the kernel
+	std::mutex				mutex;			// Guards the ring and the requests
+	std::condition_variable	reaped;			// Signaled when completions have been reaped
+};
+
+
+// A transfer
+//
+// The transfer is divided into chunks. A chunk is queued to be submitted again if it is interrupted or only partly
+// transferred.
+
+struct UringFile::Request
+{
+	struct Chunk
+	{
+		Request *	pRequest;	// The request that the chunk belongs to
+		char *		pBuffer;	// Memory of the chunk
+		int64_t		offset;		// Offset of the chunk in the file (in bytes)
+		int64_t		size;		// Size of the chunk (in bytes)
+		int64_t		done;		// Number of bytes transferred
+		bool		failed;		// True if the chunk could not be transferred completely
+	};
+
+	std::vector< Chunk >	chunks;			// Chunks
+	std::deque< Chunk * >	toSubmit;		// Chunks waiting to be submitted
+	size_t					finished;		// Number of chunks that are finished
+	bool					isWrite;		// True if the request is a write
+	int						fd;				// File to read or write
+};
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	pPath		Path of the file (or block device) to open.
+//! @param	oflags		Flags passed to open() (e.g. O_RDWR | O_CREAT). O_DIRECT is added.
+//! @param	queueDepth	Maximum number of chunks in flight at once.
+//! @param	chunkSize	Transfers are split into chunks of this size. It is rounded up to a multiple of the block
+//!						size and the memory alignment.
+//! @param	mode		Permissions of the file if it is created.
+
+UringFile::UringFile( char const * pPath,
+					  int oflags,
+					  unsigned queueDepth	/* = 32*/,
+					  int64_t chunkSize		/* = 128 * 1024*/,
+					  mode_t mode			/* = 0644*/ )
+	: DirectFile( pPath, oflags, mode ),
+	  m_pRing( new Ring )
+{
+	if ( queueDepth == 0 )
+	{
+		delete m_pRing;
+		throw ConstructorFailedException( "The queue depth must be at least 1." );
+	}
+
+	io_uring_params	params;
+	memset( &params, 0, sizeof( params ) );
+
+	m_pRing->fd = _Setup( queueDepth, &params );
+	if ( m_pRing->fd < 0 )
+	{
+		delete m_pRing;
+		throw ConstructorFailedException( "Unable to create the io_uring." );
+	}
+
+	m_pRing->sqRingSize	= params.sq_off.array + params.sq_entries * sizeof( unsigned );
+	m_pRing->cqRingSize	= params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+	m_pRing->sqesSize	= params.sq_entries * sizeof( io_uring_sqe );
+
+	if ( ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0 )
+	{
+		m_pRing->sqRingSize = std::max( m_pRing->sqRingSize, m_pRing->cqRingSize );
+		m_pRing->pSqRing = mmap( 0, m_pRing->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+								 m_pRing->fd, IORING_OFF_SQ_RING );
+		m_pRing->pCqRing = m_pRing->pSqRing;
+	}
+	else
+	{
+		m_pRing->pSqRing = mmap( 0, m_pRing->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+								 m_pRing->fd, IORING_OFF_SQ_RING );
+		m_pRing->pCqRing = mmap( 0, m_pRing->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+								 m_pRing->fd, IORING_OFF_CQ_RING );
+	}
+
+	m_pRing->pSqes = static_cast< io_uring_sqe * >( mmap( 0, m_pRing->sqesSize, PROT_READ | PROT_WRITE,
+														  MAP_SHARED | MAP_POPULATE, m_pRing->fd, IORING_OFF_SQES ) );
+
+	if ( m_pRing->pSqRing == MAP_FAILED || m_pRing->pCqRing == MAP_FAILED || m_pRing->pSqes == MAP_FAILED )
+	{
+		delete m_pRing;
+		throw ConstructorFailedException( "Unable to map the io_uring." );
+	}
+
+	char * const	pSq	= static_cast< char * >( m_pRing->pSqRing );
+	char * const	pCq	= static_cast< char * >( m_pRing->pCqRing );
+
+	m_pRing->pSqTail	= reinterpret_cast< unsigned * >( pSq + params.sq_off.tail );
+	m_pRing->pSqMask	= reinterpret_cast< unsigned * >( pSq + params.sq_off.ring_mask );
+	m_pRing->pSqArray	= reinterpret_cast< unsigned * >( pSq + params.sq_off.array );
+	m_pRing->pCqHead	= reinterpret_cast< unsigned * >( pCq + params.cq_off.head );
+	m_pRing->pCqTail	= reinterpret_cast< unsigned * >( pCq + params.cq_off.tail );
+	m_pRing->pCqMask	= reinterpret_cast< unsigned * >( pCq + params.cq_off.ring_mask );
+	m_pRing->pCqes		= reinterpret_cast< io_uring_cqe * >( pCq + params.cq_off.cqes );
+
+	// The kernel may round the number of entries up, but no more than the requested depth are used.
+
+	m_QueueDepth	= std::min( queueDepth, params.sq_entries );
+
+	int64_t const	unit	= std::max< int64_t >( BlockSize(), MemoryAlign() );
+	m_ChunkSize		= _Pad( std::max< int64_t >( chunkSize, 1 ), unit );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+UringFile::~UringFile()
+{
+	delete m_pRing;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle	File descriptor
+//! @param	pBuffer	Location to put the data.
+//! @param	n		Number of blocks to read.
+//!
+//! @return		Number of blocks actually read, or < 0 if there was an error.
+//!
+//! @note	If the end of the file is in the middle of a block, the rest of the block is filled with 0s.
+
+int64_t UringFile::Read( unsigned handle, char * pBuffer, int64_t n )
+{
+	return TransferAtCurrentLocation( static_cast< int >( handle ), pBuffer, n, false );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle	File descriptor
+//! @param	pBuffer	Location of the data.
+//! @param	n		Number of blocks to write.
+//!
+//! @return		Number of blocks actually written, or < 0 if there was an error.
+
+int64_t UringFile::Write( unsigned handle, char const * pBuffer, int64_t n )
+{
+	return TransferAtCurrentLocation( static_cast< int >( handle ), const_cast< char * >( pBuffer ), n, true );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		File descriptor
+//! @param	pBuffer		Location to put the data.
+//! @param	n			Number of blocks to read.
+//! @param	location	Location of the data (which block).
+//!
+//! @return		Number of blocks actually read, or < 0 if there was an error.
+//!
+//! @note	If the end of the file is in the middle of a block, the rest of the block is filled with 0s.
+
+int64_t UringFile::ReadAt( unsigned handle, char * pBuffer, int64_t n, int64_t location )
+{
+	return Transfer( static_cast< int >( handle ), pBuffer, n, location, false );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! @param	handle		File descriptor
+//! @param	pBuffer		Location of the data.
+//! @param	n			Number of blocks to write.
+//! @param	location	Where to put the data (which block).
+//!
+//! @return		Number of blocks actually written, or < 0 if there was an error.
+
+int64_t UringFile::WriteAt( unsigned handle, char const * pBuffer, int64_t n, int64_t location )
+{
+	return Transfer( static_cast< int >( handle ), const_cast< char * >( pBuffer ), n, location, true );
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The chunks are submitted as space in the ring becomes available. While the calling thread waits, it either waits
+//! in the kernel for completions on behalf of all threads, or it waits for another thread to reap them.
+//!
+//! If a chunk fails or reaches the end of the file, the result only includes the chunks preceding it. If the ring
+//! itself fails, the transfer fails once the chunks already submitted are done. If the end of
+//! the file is reached in the middle of a block, the rest of the block is filled with 0s and the block is counted.
+
+int64_t UringFile::Transfer( int fd, char * pBuffer, int64_t n, int64_t location, bool isWrite )
+{
+	assert( n >= 0 );
+	assert( location >= 0 );
+	assert( ( reinterpret_cast< uintptr_t >( pBuffer ) & ( MemoryAlign() - 1 ) ) == 0 );
+
+	int64_t const	blockSize	= BlockSize();
+	int64_t const	size		= n * blockSize;
+
+	// Divide the transfer into chunks
+
+	Request	request;
+
+	request.finished	= 0;
+	request.isWrite		= isWrite;
+	request.fd			= fd;
+	request.chunks.resize( static_cast< size_t >( ( size + m_ChunkSize - 1 ) / m_ChunkSize ) );
+
+	for ( size_t i = 0; i < request.chunks.size(); ++i )
+	{
+		Request::Chunk &	chunk	= request.chunks[ i ];
+		int64_t const		start	= static_cast< int64_t >( i ) * m_ChunkSize;
+
+		chunk.pRequest	= &request;
+		chunk.pBuffer	= pBuffer + start;
+		chunk.offset	= location * blockSize + start;
+		chunk.size		= std::min( m_ChunkSize, size - start );
+		chunk.done		= 0;
+		chunk.failed	= false;
+
+		request.toSubmit.push_back( &chunk );
+	}
+
+	// Submit the chunks and wait for them to finish
+
+	std::unique_lock< std::mutex >	lock( m_pRing->mutex );
+	bool							isBroken	= false;	// True if the ring refused the chunks
+
+	while ( request.finished < request.chunks.size() )
+	{
+		unsigned	toSubmit	= 0;
+
+		while ( !request.toSubmit.empty() && m_pRing->inFlight < m_QueueDepth )
+		{
+			Request::Chunk * const	pChunk	= request.toSubmit.front();
+			unsigned const			tail	= *m_pRing->pSqTail;
+			unsigned const			index	= tail & *m_pRing->pSqMask;
+			io_uring_sqe &			sqe		= m_pRing->pSqes[ index ];
+
+			request.toSubmit.pop_front();
+
+			memset( &sqe, 0, sizeof( sqe ) );
+			sqe.opcode		= isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe.fd			= fd;
+			sqe.off			= static_cast< uint64_t >( pChunk->offset + pChunk->done );
+			sqe.addr		= reinterpret_cast< uintptr_t >( pChunk->pBuffer + pChunk->done );
+			sqe.len			= static_cast< uint32_t >( pChunk->size - pChunk->done );
+			sqe.user_data	= reinterpret_cast< uintptr_t >( pChunk );
+
+			m_pRing->pSqArray[ index ] = index;
+			__atomic_store_n( m_pRing->pSqTail, tail + 1, __ATOMIC_RELEASE );
+
+			++m_pRing->inFlight;
+			++toSubmit;
+		}
+
+		while ( toSubmit > 0 )
+		{
+			int const	submitted	= _Enter( m_pRing->fd, toSubmit, 0, 0 );
+
+			if ( submitted > 0 )
+			{
+				toSubmit -= submitted;
+			}
+			else if ( submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+			{
+				// The kernel will not take the entries, so no completions will arrive for them. The entries that
+				// were not submitted are the last ones queued (the lock has been held since), so they are taken back
+				// and their chunks fail, along with the chunks that have not been queued yet. Chunks that have already
+				// been submitted are still waited for, since their buffers are in use.
+
+				unsigned const	tail	= *m_pRing->pSqTail - toSubmit;
+
+				for ( unsigned i = 0; i < toSubmit; ++i )
+				{
+					io_uring_sqe const &	sqe		= m_pRing->pSqes[ ( tail + i ) & *m_pRing->pSqMask ];
+					Request::Chunk * const	pChunk	= reinterpret_cast< Request::Chunk * >( static_cast< uintptr_t >( sqe.user_data ) );
+
+					pChunk->failed = true;
+					++request.finished;
+					--m_pRing->inFlight;
+				}
+
+				__atomic_store_n( m_pRing->pSqTail, tail, __ATOMIC_RELEASE );
+
+				while ( !request.toSubmit.empty() )
+				{
+					request.toSubmit.front()->failed = true;
+					++request.finished;
+					request.toSubmit.pop_front();
+				}
+
+				isBroken	= true;
+				toSubmit	= 0;
+			}
+			else
+			{
+				Reap();
+			}
+		}
+
+		// Collect any completions that are already available
+
+		if ( Reap() || request.finished == request.chunks.size() )
+		{
+			continue;
+		}
+
+		// Otherwise, wait for the kernel if no other thread is, or for the thread that is.
+
+		if ( !m_pRing->isReaping && m_pRing->inFlight > 0 )
+		{
+			m_pRing->isReaping = true;
+			lock.unlock();
+			_Enter( m_pRing->fd, 0, 1, IORING_ENTER_GETEVENTS );
+			lock.lock();
+			m_pRing->isReaping = false;
+
+			Reap();
+			m_pRing->reaped.notify_all();
+		}
+		else if ( request.toSubmit.empty() || m_pRing->inFlight >= m_QueueDepth )
+		{
+			m_pRing->reaped.wait( lock );
+		}
+	}
+
+	lock.unlock();
+
+	if ( isBroken )
+	{
+		return -1;
+	}
+
+	// Determine how much of the transfer was done
+
+	int64_t	done	= 0;
+
+	for ( size_t i = 0; i < request.chunks.size(); ++i )
+	{
+		Request::Chunk const &	chunk	= request.chunks[ i ];
+
+		done += chunk.done;
+		if ( chunk.done < chunk.size )
+		{
+			break;
+		}
+	}
+
+	if ( done == 0 && !request.chunks.empty() && request.chunks[ 0 ].failed )
+	{
+		return -1;
+	}
+
+	// Pad a partial block at the end of the file.
+
+	int64_t const	partial	= done % blockSize;
+
+	if ( partial != 0 )
+	{
+		if ( isWrite )
+		{
+			done -= partial;
+		}
+		else
+		{
+			memset( pBuffer + done, 0, static_cast< size_t >( blockSize - partial ) );
+			done += blockSize - partial;
+		}
+	}
+
+	return done / blockSize;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int64_t UringFile::TransferAtCurrentLocation( int fd, char * pBuffer, int64_t n, bool isWrite )
+{
+	off_t const	offset	= lseek( fd, 0, SEEK_CUR );
+
+	if ( offset < 0 )
+	{
+		return -1;
+	}
+
+	assert( offset % BlockSize() == 0 );
+
+	int64_t const	location	= offset / BlockSize();
+	int64_t const	transferred	= Transfer( fd, pBuffer, n, location, isWrite );
+
+	if ( transferred > 0 )
+	{
+		lseek( fd, static_cast< off_t >( ( location + transferred ) * BlockSize() ), SEEK_SET );
+	}
+
+	return transferred;
+}
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+//! The mutex must be held. Interrupted and partial transfers are queued to be submitted again. A read that returns
+//! nothing has reached the end of the file.
+
+bool UringFile::Reap()
+{
+	unsigned		head	= *m_pRing->pCqHead;
+	unsigned const	tail	= __atomic_load_n( m_pRing->pCqTail, __ATOMIC_ACQUIRE );
+
+	if ( head == tail )
+	{
+		return false;
+	}
+
+	while ( head != tail )
+	{
+		io_uring_cqe const &		cqe		= m_pRing->pCqes[ head & *m_pRing->pCqMask ];
+		Request::Chunk * const		pChunk	= reinterpret_cast< Request::Chunk * >( static_cast< uintptr_t >( cqe.user_data ) );
+		Request * const				pRequest	= pChunk->pRequest;
+		int const					result	= cqe.res;
+
+		++head;
+		--m_pRing->inFlight;
+
+		if ( result == -EINTR || result == -EAGAIN )
+		{
+			pRequest->toSubmit.push_back( pChunk );
+		}
+		else if ( result < 0 )
+		{
+			pChunk->failed = true;
+			++pRequest->finished;
+		}
+		else if ( result == 0 )
+		{
+			++pRequest->finished;
+		}
+		else
+		{
+			pChunk->done += result;
+			if ( pChunk->done < pChunk->size )
+			{
+				pRequest->toSubmit.push_back( pChunk );
+			}
+			else
+			{
+				++pRequest->finished;
+			}
+		}
+	}
+
+	__atomic_store_n( m_pRing->pCqHead, head, __ATOMIC_RELEASE );
+
+	m_pRing->reaped.notify_all();
+
+	return true;
+}
@@ -0,0 +1,185 @@
+/*********************************************************************************************************************
+
+                                                  AsyncProxyTest.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/AsyncProxyTest.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+//! @file
+//!
+//! Checks that an AsyncProxy never writes stale buffer memory to the buffered object when a write extends the data.
+//!
+//! The proxy's buffer is filled with garbage before each run. Writes are done after seeking past the end of the data
+//! (within the buffer and beyond it), and the data in the buffered object after a flush is compared with a model in
+//! which the bytes that were never written are 0.
+//!
+//! Returns 0 if all checks pass and 1 if any fail.
+
+#include "AsyncProxy.h"
+#include "MemoryObject.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	int64_t const	BLOCK_SIZE	= 512;			// Size of a block
+	int64_t const	BUFFER_SIZE	= 64 * 1024;	// Size of the proxy's buffer
+	char const		GARBAGE		= '\xAA';		// Initial contents of the buffer
+
+	// A write at a location
+	struct Write
+	{
+		int64_t	location;	// Where to write (in bytes)
+		int64_t	size;		// Number of bytes to write
+	};
+
+	// Initial size of the data and the writes done after it
+	struct Scenario
+	{
+		char const *	pName;			// Description
+		int64_t			initialSize;	// Size of the data in the buffered object before the writes
+		int				writeCount;		// Number of writes
+		Write			writes[ 2 ];	// The writes
+	};
+
+	Scenario const	SCENARIOS[] =
+	{
+		{ "seek past the data in the buffer",		0,		2, { { 0, 10 }, { 5000, 10 } } },
+		{ "seek past partial data",					1000,	1, { { 3000, 100 } } },
+		{ "write over the end of the data",			1000,	1, { { 500, 1000 } } },
+		{ "seek past the buffer",					0,		2, { { 0, 10 }, { 100000, 10 } } },
+		{ "first write past the buffer",			0,		1, { { 70000, 600 } } },
+	};
+
+	int	s_Failures	= 0;
+
+	void _Check( bool condition, char const * pWhat, Scenario const & scenario )
+	{
+		if ( !condition )
+		{
+			fprintf( stderr, "FAILED: %s (%s)\n", pWhat, scenario.pName );
+			++s_Failures;
+		}
+	}
+
+	// Returns the value of a byte written to the given location.
+
+	char _Pattern( int64_t location )
+	{
+		return static_cast< char >( location * 7 + location / 251 + 1 );
+	}
+
+	// Does the writes of a scenario and flushes the proxy.
+
+	AsyncTask< void > _Write( AsyncProxy * pProxy, Scenario const * pScenario )
+	{
+		for ( int i = 0; i < pScenario->writeCount; ++i )
+		{
+			Write const &		write	= pScenario->writes[ i ];
+			std::vector< char >	data( static_cast< size_t >( write.size ) );
+
+			for ( int64_t j = 0; j < write.size; ++j )
+			{
+				data[ j ] = _Pattern( write.location + j );
+			}
+
+			int64_t const	location	= co_await pProxy->SeekAsync( write.location );
+
+			_Check( location == write.location, "SeekAsync", *pScenario );
+
+			int64_t const	written		= co_await pProxy->WriteAsync( &data[ 0 ], write.size );
+
+			_Check( written == write.size, "WriteAsync", *pScenario );
+		}
+
+		bool const	flushed	= co_await pProxy->FlushAsync();
+
+		_Check( flushed, "FlushAsync", *pScenario );
+	}
+
+	// Runs a scenario and checks the data in the buffered object.
+
+	void _Run( Scenario const & scenario )
+	{
+		MemoryObject	object( BLOCK_SIZE, scenario.initialSize, true );
+
+		for ( int64_t i = 0; i < scenario.initialSize; ++i )
+		{
+			object.Data()[ i ] = _Pattern( i + 12345 );
+		}
+
+		std::vector< char >	model( object.Data(), object.Data() + scenario.initialSize );
+		int64_t				end		= scenario.initialSize;
+
+		for ( int i = 0; i < scenario.writeCount; ++i )
+		{
+			Write const &	write	= scenario.writes[ i ];
+
+			end = std::max( end, write.location + write.size );
+			model.resize( static_cast< size_t >( std::max< int64_t >( model.size(), end ) ), 0 );
+
+			for ( int64_t j = 0; j < write.size; ++j )
+			{
+				model[ write.location + j ] = _Pattern( write.location + j );
+			}
+		}
+
+		std::vector< char >	memory( BUFFER_SIZE + BLOCK_SIZE );
+		char * const		pBuffer	= &memory[ 0 ] + ( BLOCK_SIZE - reinterpret_cast< uintptr_t >( &memory[ 0 ] ) % BLOCK_SIZE ) % BLOCK_SIZE;
+
+		memset( pBuffer, GARBAGE, BUFFER_SIZE );
+
+		{
+			AsyncProxy::BlockingObjectAdapter	adapter( &object );
+			AsyncExecutor						executor;
+			AsyncProxy							proxy( pBuffer, BUFFER_SIZE, 0, &adapter, &executor, BLOCK_SIZE, BLOCK_SIZE, BLOCK_SIZE );
+
+			executor.Spawn( _Write( &proxy, &scenario ) );
+			executor.Run();
+		}
+
+		// The last block written may be padded, so the object can be larger than the model.
+
+		_Check( object.Size() >= end, "object size", scenario );
+
+		for ( int64_t i = 0; i < object.Size(); ++i )
+		{
+			char const	expected	= ( i < end ) ? model[ i ] : 0;
+
+			if ( object.Data()[ i ] != expected )
+			{
+				fprintf( stderr, "  byte %lld is %#x, expected %#x\n",
+						 static_cast< long long >( i ), object.Data()[ i ] & 0xff, expected & 0xff );
+				_Check( false, "object data", scenario );
+				break;
+			}
+		}
+	}
+
+} // anonymous namespace
+
+
+int main()
+{
+	for ( Scenario const & scenario : SCENARIOS )
+	{
+		_Run( scenario );
+	}
+
+	if ( s_Failures == 0 )
+	{
+		printf( "All checks passed.\n" );
+	}
+
+	return ( s_Failures == 0 ) ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/*********************************************************************************************************************
+
+                                               FixedBufferedProxyTest.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/FixedBufferedProxyTest.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+//! @file
+//!
+//! Checks that FixedBufferedProxy behaves exactly like BufferedProxy.
+//!
+//! For several geometries and sets of flags, the same random sequence of Seek(), Read(), Write(), Peek(), Reserve(),
+//! Flush(), and Fill() calls is made through a BufferedProxy and through a FixedBufferedProxy, each over its own
+//! MemoryObject holding the same data. The return values, the data read, and the contents of the objects must be the
+//! same.
+//!
+//! Returns 0 if all checks pass and 1 if any fail.
+
+#include "Buffer.h"
+#include "FixedBufferedProxy.h"
+#include "MemoryObject.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+	int64_t const	OBJECT_SIZE		= 64 * 1024;	// Initial size of the data
+	int64_t const	BUFFER_SIZE		= 8192;			// Size of the proxies' buffers
+	int64_t const	MAX_OPERATION	= 20000;		// Maximum size of a read or write
+	int64_t const	MAX_ALIGNMENT	= 4096;			// Largest buffer alignment tested
+	int const		OPERATIONS		= 2000;			// Number of operations in each run
+	int const		SEEDS			= 20;			// Number of runs of each configuration
+
+	int	s_Failures	= 0;
+
+	// Returns memory of the given size aligned on MAX_ALIGNMENT.
+
+	char * _Align( std::vector< char > & memory, int64_t size )
+	{
+		memory.resize( static_cast< size_t >( size + MAX_ALIGNMENT ) );
+
+		uintptr_t const	address	= reinterpret_cast< uintptr_t >( &memory[ 0 ] );
+
+		return &memory[ 0 ] + ( ( MAX_ALIGNMENT - address % MAX_ALIGNMENT ) % MAX_ALIGNMENT );
+	}
+
+	// Runs the same random operations through both proxies. Returns false at the first difference.
+
+	template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS >
+	bool _Compare( bool isPositional, int seed )
+	{
+		MemoryObject	expectedObject( BLOCK_SIZE, OBJECT_SIZE, isPositional );
+		MemoryObject	actualObject( BLOCK_SIZE, OBJECT_SIZE, isPositional );
+
+		for ( int64_t i = 0; i < OBJECT_SIZE; ++i )
+		{
+			expectedObject.Data()[ i ] = actualObject.Data()[ i ] = static_cast< char >( i * 7 + i / 251 );
+		}
+
+		std::vector< char >	expectedMemory;
+		std::vector< char >	actualMemory;
+		std::vector< char >	expectedDataMemory;
+		std::vector< char >	actualDataMemory;
+		char * const		pExpectedData	= _Align( expectedDataMemory, MAX_OPERATION + 8 );
+		char * const		pActualData		= _Align( actualDataMemory, MAX_OPERATION + 8 );
+
+		BufferedProxy	expected( _Align( expectedMemory, BUFFER_SIZE ), BUFFER_SIZE, 0, &expectedObject, FLAGS,
+								  BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN );
+		FixedBufferedProxy< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS >
+						actual( _Align( actualMemory, BUFFER_SIZE ), BUFFER_SIZE, 0, &actualObject );
+
+		std::mt19937	random( seed );
+
+		for ( int i = 0; i < OPERATIONS; ++i )
+		{
+			// Sometimes the data is aligned, so it can be transferred directly.
+
+			int64_t const	offset	= ( random() % 2 == 0 ) ? 0 : 1 + random() % 7;
+			int64_t const	n		= random() % ( ( random() % 4 == 0 ) ? MAX_OPERATION : 300 );
+			char * const	pE		= pExpectedData + offset;
+			char * const	pA		= pActualData + offset;
+			char const *	pWhat	= 0;
+
+			switch ( random() % 7 )
+			{
+			case 0:
+			{
+				int64_t const	location	= random() % ( OBJECT_SIZE + BUFFER_SIZE );
+
+				if ( expected.Seek( location ) != actual.Seek( location ) )
+				{
+					pWhat = "Seek()";
+				}
+				break;
+			}
+
+			case 1:
+			{
+				int64_t const	e	= expected.Read( pE, n );
+				int64_t const	a	= actual.Read( pA, n );
+
+				if ( e != a || ( e > 0 && memcmp( pE, pA, e ) != 0 ) )
+				{
+					pWhat = "Read()";
+				}
+				break;
+			}
+
+			case 2:
+			{
+				for ( int64_t j = 0; j < n; ++j )
+				{
+					pE[ j ] = pA[ j ] = static_cast< char >( random() );
+				}
+
+				if ( expected.Write( pE, n ) != actual.Write( pA, n ) )
+				{
+					pWhat = "Write()";
+				}
+				break;
+			}
+
+			case 3:
+			{
+				void const *	pEPeek;
+				void const *	pAPeek;
+				int64_t const	e	= expected.Peek( &pEPeek );
+				int64_t const	a	= actual.Peek( &pAPeek );
+
+				if ( e != a || ( e > 0 && memcmp( pEPeek, pAPeek, e ) != 0 ) )
+				{
+					pWhat = "Peek()";
+				}
+				else if ( e > 0 )
+				{
+					int64_t const	consumed	= random() % ( e + 1 );
+
+					expected.Consume( consumed );
+					actual.Consume( consumed );
+				}
+				break;
+			}
+
+			case 4:
+			{
+				void *			pESpace;
+				void *			pASpace;
+				int64_t const	e	= expected.Reserve( &pESpace );
+				int64_t const	a	= actual.Reserve( &pASpace );
+
+				if ( e != a )
+				{
+					pWhat = "Reserve()";
+				}
+				else if ( e > 0 )
+				{
+					int64_t const	committed	= random() % ( e + 1 );
+
+					for ( int64_t j = 0; j < committed; ++j )
+					{
+						reinterpret_cast< char * >( pESpace )[ j ] = reinterpret_cast< char * >( pASpace )[ j ] = static_cast< char >( random() );
+					}
+
+					expected.Commit( committed );
+					actual.Commit( committed );
+				}
+				break;
+			}
+
+			case 5:
+				if ( expected.Flush() != actual.Flush() )
+				{
+					pWhat = "Flush()";
+				}
+				break;
+
+			default:
+				if ( random() % 8 == 0 )
+				{
+					expected.Fill();
+					actual.Fill();
+				}
+				if (    expected.RemainingReadAmount() != actual.RemainingReadAmount()
+					 || expected.RemainingWriteSpace() != actual.RemainingWriteSpace() )
+				{
+					pWhat = "RemainingReadAmount() or RemainingWriteSpace()";
+				}
+				break;
+			}
+
+			if ( pWhat != 0 )
+			{
+				fprintf( stderr, "FAILED: %s differs (block size %lld, flags %#x, %s, seed %d, operation %d)\n",
+						 pWhat, static_cast< long long >( BLOCK_SIZE ), FLAGS, isPositional ? "positional" : "sequential",
+						 seed, i );
+				return false;
+			}
+		}
+
+		if (    expected.Flush() != actual.Flush()
+			 || expectedObject.Size() != actualObject.Size()
+			 || memcmp( expectedObject.Data(), actualObject.Data(), static_cast< size_t >( expectedObject.Size() ) ) != 0 )
+		{
+			fprintf( stderr, "FAILED: the objects differ (block size %lld, flags %#x, %s, seed %d)\n",
+					 static_cast< long long >( BLOCK_SIZE ), FLAGS, isPositional ? "positional" : "sequential", seed );
+			return false;
+		}
+
+		return true;
+	}
+
+	// Runs a configuration with several seeds, over positional and sequential objects.
+
+	template< int64_t BLOCK_SIZE, unsigned SECTOR_ALIGN, unsigned BUFFER_ALIGN, unsigned FLAGS >
+	void _Test()
+	{
+		for ( int seed = 0; seed < SEEDS; ++seed )
+		{
+			for ( int positional = 0; positional < 2; ++positional )
+			{
+				if ( !_Compare< BLOCK_SIZE, SECTOR_ALIGN, BUFFER_ALIGN, FLAGS >( positional != 0, seed ) )
+				{
+					++s_Failures;
+				}
+			}
+		}
+	}
+
+} // anonymous namespace
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int main()
+{
+	_Test< 1, 1, 1, 0 >();
+	_Test< 16, 16, 16, 0 >();
+	_Test< 16, 64, 1, 0 >();
+	_Test< 512, 512, 512, 0 >();
+	_Test< 512, 4096, 4096, 0 >();
+	_Test< 4096, 4096, 4096, 0 >();
+	_Test< 1, 1, 1, BufferedProxy::CF_NO_DIRECT_IO >();
+	_Test< 512, 512, 512, BufferedProxy::CF_NO_DIRECT_IO >();
+	_Test< 512, 512, 512, BufferedProxy::CF_NO_FILLS >();
+	_Test< 16, 16, 16, BufferedProxy::CF_READ_ONLY >();
+	_Test< 16, 16, 16, BufferedProxy::CF_WRITE_ONLY >();
+
+	if ( s_Failures == 0 )
+	{
+		printf( "All checks passed.\n" );
+	}
+
+	return ( s_Failures == 0 ) ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+/*********************************************************************************************************************
+
+                                                SharedBlockCacheTest.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/SharedBlockCacheTest.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+//! @file
+//!
+//! Checks that a SharedBlockCache keeps the data intact when many threads pin, evict, and write back its pages at once.
+//!
+//! The cache is much smaller than the data, so pages are constantly evicted and written back. The buffered object is a
+//! MemoryObject wrapped in a SimulatedObject that makes each transfer slow and often short, so the other threads have
+//! time to use the stripes while pages are being loaded and written back.
+//!
+//! Each thread owns every Nth block, so the threads share pages but not blocks. The threads write their blocks, read
+//! ranges of blocks that include the other threads' blocks, check their own blocks, and occasionally flush the cache.
+//! Afterwards, the data in the buffered object is compared with what each thread last wrote.
+//!
+//! Returns 0 if all checks pass and 1 if any fail.
+
+#include "MemoryObject.h"
+#include "SharedBlockCache.h"
+#include "SimulatedObject.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	int64_t const	BLOCK_SIZE		= 512;					// Size of a block
+	int64_t const	PAGE_SIZE		= 4 * BLOCK_SIZE;		// Size of a page
+	int64_t const	CACHE_SIZE		= 64 * PAGE_SIZE;		// Size of the cache's memory
+	int64_t const	OBJECT_BLOCKS	= 2048;					// Size of the data (in blocks)
+	int64_t const	MAX_READ		= 3 * 4;				// Maximum number of blocks read at once
+	int const		THREADS			= 8;					// Number of threads
+	int const		OPERATIONS		= 3000;					// Number of operations by each thread
+	int const		FLUSH_RATE		= 500;					// One operation in this many is a flush
+	int64_t const	LATENCY			= 10000;				// Time taken by each read and write of the buffered object (in ns)
+	double const	SHORT_RATE		= 0.25;					// Probability that a transfer is short
+
+	std::atomic< int >	s_Failures( 0 );
+
+	void _Check( bool condition, char const * pWhat, bool isPositional )
+	{
+		if ( !condition )
+		{
+			fprintf( stderr, "FAILED: %s (%s)\n", pWhat, isPositional ? "positional" : "sequential" );
+			++s_Failures;
+		}
+	}
+
+	// Returns the value of a byte in a block after the given version of the block has been written.
+
+	char _Pattern( int64_t block, int version, int64_t i )
+	{
+		return static_cast< char >( block * 131 + version * 17 + i );
+	}
+
+	// Returns true if the data matches the given version of a block.
+
+	bool _Matches( char const * pData, int64_t block, int version )
+	{
+		for ( int64_t i = 0; i < BLOCK_SIZE; ++i )
+		{
+			if ( pData[ i ] != _Pattern( block, version, i ) )
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Writes and reads the blocks owned by a thread. The last version written to each block is recorded.
+
+	void _Work( SharedBlockCache * pCache, int thread, std::vector< int > * pVersions, bool isPositional )
+	{
+		std::mt19937			random( thread );
+		std::vector< char >		data( static_cast< size_t >( MAX_READ * BLOCK_SIZE ) );
+
+		for ( int i = 0; i < OPERATIONS; ++i )
+		{
+			int const	operation	= static_cast< int >( random() % FLUSH_RATE );
+
+			if ( operation == 0 )
+			{
+				_Check( pCache->Flush(), "Flush", isPositional );
+			}
+			else if ( operation % 2 == 0 )
+			{
+				int64_t const	block	= static_cast< int64_t >( random() % ( OBJECT_BLOCKS / THREADS ) ) * THREADS + thread;
+				int const		version	= ( *pVersions )[ block ] + 1;
+
+				for ( int64_t j = 0; j < BLOCK_SIZE; ++j )
+				{
+					data[ j ] = _Pattern( block, version, j );
+				}
+
+				_Check( pCache->WriteAt( 0, &data[ 0 ], 1, block ) == 1, "WriteAt", isPositional );
+				( *pVersions )[ block ] = version;
+			}
+			else
+			{
+				int64_t const	n		= 1 + static_cast< int64_t >( random() % MAX_READ );
+				int64_t const	first	= static_cast< int64_t >( random() % ( OBJECT_BLOCKS - n + 1 ) );
+
+				_Check( pCache->ReadAt( 0, &data[ 0 ], n, first ) == n, "ReadAt", isPositional );
+
+				for ( int64_t block = first; block < first + n; ++block )
+				{
+					if ( block % THREADS == thread )
+					{
+						_Check( _Matches( &data[ ( block - first ) * BLOCK_SIZE ], block, ( *pVersions )[ block ] ),
+								"read data", isPositional );
+					}
+				}
+			}
+		}
+	}
+
+	// Runs the threads on a cache and checks the data in the buffered object.
+
+	void _Run( bool isPositional )
+	{
+		MemoryObject	object( BLOCK_SIZE, OBJECT_BLOCKS * BLOCK_SIZE, isPositional );
+
+		for ( int64_t block = 0; block < OBJECT_BLOCKS; ++block )
+		{
+			for ( int64_t i = 0; i < BLOCK_SIZE; ++i )
+			{
+				object.Data()[ block * BLOCK_SIZE + i ] = _Pattern( block, 0, i );
+			}
+		}
+
+		SimulatedObject::Profile	profile	= { LATENCY, 0, 0, 0, 0, SHORT_RATE };
+		SimulatedObject				device( &object, profile, BLOCK_SIZE );
+
+		// Each thread only changes the versions of its own blocks.
+
+		std::vector< char >		memory( static_cast< size_t >( CACHE_SIZE ) );
+		std::vector< int >		versions( static_cast< size_t >( OBJECT_BLOCKS ), 0 );
+
+		{
+			SharedBlockCache			cache( &device, &memory[ 0 ], CACHE_SIZE, PAGE_SIZE, BLOCK_SIZE );
+			std::vector< std::thread >	threads;
+
+			for ( int i = 0; i < THREADS; ++i )
+			{
+				threads.push_back( std::thread( _Work, &cache, i, &versions, isPositional ) );
+			}
+
+			for ( std::thread & thread : threads )
+			{
+				thread.join();
+			}
+
+			_Check( cache.Flush(), "final Flush", isPositional );
+			_Check( cache.MissCount() > CACHE_SIZE / PAGE_SIZE, "pages evicted", isPositional );
+			_Check( cache.WriteBackCount() > 0, "pages written back", isPositional );
+		}
+
+		_Check( object.Size() == OBJECT_BLOCKS * BLOCK_SIZE, "object size", isPositional );
+
+		for ( int64_t block = 0; block < OBJECT_BLOCKS; ++block )
+		{
+			_Check( _Matches( object.Data() + block * BLOCK_SIZE, block, versions[ block ] ), "object data", isPositional );
+		}
+	}
+
+} // anonymous namespace
+
+
+int main()
+{
+	_Run( true );
+	_Run( false );
+
+	if ( s_Failures == 0 )
+	{
+		printf( "All checks passed.\n" );
+	}
+
+	return ( s_Failures == 0 ) ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*********************************************************************************************************************
+
+                                                SimulatedObjectTest.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/SimulatedObjectTest.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+//! @file
+//!
+//! Checks that data round-trips through a BufferedProxy when the buffered object transfers fewer blocks than
+//! requested.
+//!
+//! A MemoryObject is wrapped in a SimulatedObject that limits the number of blocks per call and makes many of the
+//! calls short. Random seeks, reads, writes, and flushes are done through a proxy and through a model of the data, and
+//! the data read and the data in the object are compared with the model.
+//!
+//! Returns 0 if all checks pass and 1 if any fail.
+
+#include "Buffer.h"
+#include "MemoryObject.h"
+#include "SimulatedObject.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+	int64_t const	OBJECT_SIZE		= 256 * 1024;	// Size of the data
+	int64_t const	BUFFER_SIZE		= 4096;			// Size of the proxy's buffer
+	int64_t const	MAX_OPERATION	= 3 * 4096;		// Maximum size of a read or write
+	int const		OPERATIONS		= 2000;			// Number of operations in each run
+	int const		SEEDS			= 10;			// Number of runs of each configuration
+	int64_t const	MAX_TRANSFER	= 1536;			// Maximum size of a transfer by the simulated device
+	double const	SHORT_RATE		= 0.5;			// Probability that a transfer is short
+
+	int64_t const	BLOCK_SIZES[]	= { 1, 512 };
+	unsigned const	FLAGS[]			= { 0, BufferedProxy::CF_NO_DIRECT_IO, BufferedProxy::CF_ADAPTIVE };
+
+	int	s_Failures	= 0;
+
+	void _Check( bool condition, char const * pWhat, int64_t blockSize, unsigned flags, bool isPositional, int seed )
+	{
+		if ( !condition )
+		{
+			fprintf( stderr, "FAILED: %s (block size %lld, flags %#x, %s, seed %d)\n",
+					 pWhat, static_cast< long long >( blockSize ), flags, isPositional ? "positional" : "sequential", seed );
+			++s_Failures;
+		}
+	}
+
+	// Runs random operations through a proxy and checks the results against a model.
+
+	void _Run( int64_t blockSize, unsigned flags, bool isPositional, int seed )
+	{
+		MemoryObject	object( blockSize, OBJECT_SIZE, isPositional );
+
+		for ( int64_t i = 0; i < OBJECT_SIZE; ++i )
+		{
+			object.Data()[ i ] = static_cast< char >( i * 7 + i / 251 );
+		}
+
+		SimulatedObject::Profile	profile	= { 0, 0, 0, 0, MAX_TRANSFER / blockSize, SHORT_RATE };
+		SimulatedObject				device( &object, profile, blockSize, false );
+		std::vector< char >			model( object.Data(), object.Data() + OBJECT_SIZE );
+		std::vector< char >			memory( BUFFER_SIZE + MAX_OPERATION * 2 + 2 * blockSize );
+		char * const				pBuffer	= &memory[ 0 ] + ( blockSize - reinterpret_cast< uintptr_t >( &memory[ 0 ] ) % blockSize ) % blockSize;
+		char * const				pData	= pBuffer + BUFFER_SIZE;
+		BufferedProxy				proxy( pBuffer, BUFFER_SIZE, 0, &device, flags, blockSize,
+										   static_cast< unsigned >( blockSize ), static_cast< unsigned >( blockSize ) );
+		std::mt19937				random( seed );
+		int64_t						location	= 0;
+		bool						ok			= true;
+
+		for ( int i = 0; i < OPERATIONS && ok; ++i )
+		{
+			// Sometimes the data is aligned, so it is transferred directly.
+
+			char * const	p	= pData + ( ( random() % 2 == 0 ) ? 0 : 1 + random() % 7 );
+			int64_t			n	= random() % MAX_OPERATION;
+
+			switch ( random() % 4 )
+			{
+			case 0:
+				location = random() % OBJECT_SIZE;
+				ok = ( proxy.Seek( location ) == location );
+				_Check( ok, "Seek()", blockSize, flags, isPositional, seed );
+				break;
+
+			case 1:
+				n = std::min( n, OBJECT_SIZE - location );
+				ok = ( proxy.Read( p, n ) == n && memcmp( p, &model[ location ], n ) == 0 );
+				_Check( ok, "Read() returns the data", blockSize, flags, isPositional, seed );
+				location += n;
+				break;
+
+			case 2:
+				n = std::min( n, OBJECT_SIZE - location );
+				for ( int64_t j = 0; j < n; ++j )
+				{
+					p[ j ] = static_cast< char >( random() );
+				}
+				ok = ( proxy.Write( p, n ) == n );
+				_Check( ok, "Write() writes all of the data", blockSize, flags, isPositional, seed );
+				memcpy( &model[ location ], p, n );
+				location += n;
+				break;
+
+			default:
+				ok = proxy.Flush();
+				_Check( ok, "Flush() writes all of the data", blockSize, flags, isPositional, seed );
+				break;
+			}
+		}
+
+		_Check( proxy.Flush(), "Flush() writes all of the data", blockSize, flags, isPositional, seed );
+		_Check( memcmp( object.Data(), &model[ 0 ], OBJECT_SIZE ) == 0, "The object holds the data", blockSize, flags,
+				isPositional, seed );
+	}
+
+} // anonymous namespace
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int main()
+{
+	for ( int64_t blockSize : BLOCK_SIZES )
+	{
+		for ( unsigned flags : FLAGS )
+		{
+			for ( int positional = 0; positional < 2; ++positional )
+			{
+				for ( int seed = 0; seed < SEEDS; ++seed )
+				{
+					_Run( blockSize, flags, positional != 0, seed );
+				}
+			}
+		}
+	}
+
+	if ( s_Failures == 0 )
+	{
+		printf( "All checks passed.\n" );
+	}
+
+	return ( s_Failures == 0 ) ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+/*********************************************************************************************************************
+
+                                                   UringFileTest.cpp
+
+						                    Copyright 2003, John J. Bolton
+	--------------------------------------------------------------------------------------------------------------
+
+	$Header: //depot/Libraries/Buffer/UringFileTest.cpp#1 $
+
+	$NoKeywords: $
+
+*********************************************************************************************************************/
+
+//! @file
+//!
+//! Checks UringFile against a regular file in a temporary directory.
+//!
+//! Data is written with WriteAt() and read back with ReadAt(), with Read() and Write() at the current location, with
+//! several threads calling ReadAt() at once, and through a proxy. A read past the end of the file is checked too.
+//!
+//! Returns 0 if all checks pass, 1 if any fail, and 77 if io_uring or O_DIRECT is not available.
+//!
+//! Usage: UringFileTest [directory]
+
+#include "UringFile.h"
+
+#include "Misc/exceptions.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+	int const		SKIPPED			= 77;					// Exit code that tells CTest the test was skipped
+
+	int64_t const	FILE_BLOCKS		= 1000;					// Size of the file (in blocks)
+	unsigned const	QUEUE_DEPTH		= 4;					// Small, so transfers must wait for space in the ring
+	int64_t const	CHUNK_SIZE		= 16 * 1024;			// Small, so transfers are split into many chunks
+	int const		THREAD_COUNT	= 8;					// Number of threads calling ReadAt() at once
+	int const		THREAD_READS	= 200;					// Number of reads done by each thread
+
+	int	s_Failures	= 0;
+
+	void _Check( bool condition, char const * pWhat )
+	{
+		if ( !condition )
+		{
+			fprintf( stderr, "FAILED: %s\n", pWhat );
+			++s_Failures;
+		}
+	}
+
+	// Memory aligned for O_DIRECT
+
+	class AlignedMemory
+	{
+	public:
+
+		AlignedMemory( int64_t size, unsigned alignment )
+			: m_pMemory( 0 )
+		{
+			if ( posix_memalign( &m_pMemory, alignment, static_cast< size_t >( size ) ) != 0 )
+			{
+				m_pMemory = 0;
+			}
+		}
+
+		~AlignedMemory()
+		{
+			free( m_pMemory );
+		}
+
+		char * Get() const		{ return reinterpret_cast< char * >( m_pMemory ); }
+
+	private:
+
+		// Prevent copying
+		AlignedMemory( AlignedMemory const & );
+		AlignedMemory & operator =( AlignedMemory const & );
+
+		void *	m_pMemory;	// The memory
+	};
+
+	// Returns the expected value of the byte at the given offset in the file.
+
+	char _Expected( int64_t offset )
+	{
+		return static_cast< char >( offset * 7 + offset / 4093 );
+	}
+
+} // anonymous namespace
+
+
+/********************************************************************************************************************/
+/*																													*/
+/********************************************************************************************************************/
+
+int main( int argc, char ** argv )
+{
+	char const * const	pDirectory	= ( argc > 1 ) ? argv[ 1 ] : ( getenv( "TMPDIR" ) != 0 ) ? getenv( "TMPDIR" ) : "/tmp";
+	std::string			path		= std::string( pDirectory ) + "/UringFileTest.XXXXXX";
+	int const			tempFd		= mkstemp( &path[ 0 ] );
+
+	if ( tempFd < 0 )
+	{
+		fprintf( stderr, "Unable to create a file in %s\n", pDirectory );
+		return 1;
+	}
+
+	close( tempFd );
+
+	std::unique_ptr< UringFile >	pFile;
+
+	try
+	{
+		pFile.reset( new UringFile( path.c_str(), O_RDWR | O_TRUNC, QUEUE_DEPTH, CHUNK_SIZE ) );
+	}
+	catch ( ConstructorFailedException const & e )
+	{
+		fprintf( stderr, "Skipped: %s\n", e.what() );
+		unlink( path.c_str() );
+		return SKIPPED;
+	}
+
+	UringFile &			file		= *pFile;
+	unsigned const		handle		= file.Handle();
+	int64_t const		blockSize	= file.BlockSize();
+	int64_t const		fileSize	= FILE_BLOCKS * blockSize;
+	AlignedMemory		data( fileSize, file.MemoryAlign() );
+	AlignedMemory		readBack( fileSize + blockSize, file.MemoryAlign() );
+
+	for ( int64_t i = 0; i < fileSize; ++i )
+	{
+		data.Get()[ i ] = _Expected( i );
+	}
+
+	// Round trip with WriteAt() and ReadAt()
+
+	_Check( file.WriteAt( handle, data.Get(), FILE_BLOCKS, 0 ) == FILE_BLOCKS, "WriteAt() wrote the whole file" );
+	_Check( file.ReadAt( handle, readBack.Get(), FILE_BLOCKS, 0 ) == FILE_BLOCKS, "ReadAt() read the whole file" );
+	_Check( memcmp( readBack.Get(), data.Get(), static_cast< size_t >( fileSize ) ) == 0, "ReadAt() data matches" );
+
+	// A read past the end of the file stops at the end
+
+	_Check( file.ReadAt( handle, readBack.Get(), 10, FILE_BLOCKS - 3 ) == 3, "ReadAt() stops at the end of the file" );
+	_Check( file.ReadAt( handle, readBack.Get(), 10, FILE_BLOCKS ) == 0, "ReadAt() at the end of the file reads nothing" );
+
+	// Round trip with Write() and Read() at the current location
+
+	_Check( file.Seek( handle, 100 ) == 100, "Seek()" );
+	_Check( file.Write( handle, data.Get() + 100 * blockSize, 50 ) == 50, "Write() at the current location" );
+	_Check( file.Seek( handle, 90 ) == 90, "Seek()" );
+	_Check( file.Read( handle, readBack.Get(), 70 ) == 70, "Read() at the current location" );
+	_Check( memcmp( readBack.Get(), data.Get() + 90 * blockSize, static_cast< size_t >( 70 * blockSize ) ) == 0,
+			"Read() data matches" );
+
+	// Several threads reading at once
+
+	std::vector< std::thread >	threads;
+	std::vector< int >			mismatches( THREAD_COUNT, 0 );
+
+	for ( int t = 0; t < THREAD_COUNT; ++t )
+	{
+		threads.push_back( std::thread( [&file, &mismatches, handle, blockSize, t] ()
+			{
+				std::mt19937	random( t );
+				int64_t const	maxBlocks	= 64;
+				AlignedMemory	buffer( maxBlocks * blockSize, file.MemoryAlign() );
+
+				for ( int i = 0; i < THREAD_READS; ++i )
+				{
+					int64_t const	n			= 1 + random() % maxBlocks;
+					int64_t const	location	= random() % ( FILE_BLOCKS - n + 1 );
+
+					if ( file.ReadAt( handle, buffer.Get(), n, location ) != n )
+					{
+						++mismatches[ t ];
+						continue;
+					}
+
+					for ( int64_t j = 0; j < n * blockSize; ++j )
+					{
+						if ( buffer.Get()[ j ] != _Expected( location * blockSize + j ) )
+						{
+							++mismatches[ t ];
+							break;
+						}
+					}
+				}
+			} ) );
+	}
+
+	for ( size_t t = 0; t < threads.size(); ++t )
+	{
+		threads[ t ].join();
+		_Check( mismatches[ t ] == 0, "Concurrent ReadAt() data matches" );
+	}
+
+	// Round trip through a proxy, at locations that are not aligned
+
+	{
+		std::unique_ptr< BufferedProxy >	pProxy		= file.CreateProxy( 64 * 1024 );
+		char const							message[]	= "Written through a proxy";
+		int64_t const						end			= 12345 + sizeof( message );
+		char								result[ sizeof( message ) ];
+
+		_Check( pProxy != 0, "CreateProxy()" );
+		if ( pProxy != 0 )
+		{
+			_Check( pProxy->Seek( 12345 ) == 12345, "Proxy Seek()" );
+			_Check( pProxy->Write( message, sizeof( message ) ) == sizeof( message ), "Proxy Write()" );
+			pProxy->Flush();
+			_Check( pProxy->Seek( 12345 ) == 12345, "Proxy Seek()" );
+			_Check( pProxy->Read( result, sizeof( result ) ) == sizeof( result ), "Proxy Read()" );
+			_Check( memcmp( result, message, sizeof( message ) ) == 0, "Proxy data matches" );
+		}
+
+		pProxy.reset();
+
+		_Check( file.ReadAt( handle, readBack.Get(), FILE_BLOCKS, 0 ) == FILE_BLOCKS, "ReadAt() read the whole file" );
+		_Check( readBack.Get()[ 12344 ] == _Expected( 12344 ) && readBack.Get()[ end ] == _Expected( end ),
+				"The proxy did not change the data around the write" );
+	}
+
+	pFile.reset();
+	unlink( path.c_str() );
+
+	if ( s_Failures == 0 )
+	{
+		printf( "All checks passed.\n" );
+	}
+
+	return ( s_Failures == 0 ) ? 0 : 1;
+}